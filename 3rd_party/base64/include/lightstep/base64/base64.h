@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 
@@ -23,6 +24,36 @@ public:
    */
   static std::string decode(const char* input, size_t length);
 
+  /**
+   * @return the number of characters needed to base64 encode an input of a given length.
+   */
+  static size_t encodedSize(size_t length) { return (length + 2) / 3 * 4; }
+
+  /**
+   * @return an upper bound on the number of bytes decoded from a base64 input of a given length.
+   */
+  static size_t decodedSizeUpperBound(size_t length) { return length / 4 * 3; }
+
+  /**
+   * Base64 encode an input char buffer into an output buffer without allocating. Produces the
+   * same characters as encode(input, length).
+   * @param input char array to encode.
+   * @param length of the input array.
+   * @param output buffer of at least encodedSize(length) chars.
+   * @return the number of characters written.
+   */
+  static size_t encode(const char* input, size_t length, char* output);
+
+  /**
+   * Base64 decode an input string into an output buffer without allocating. Accepts exactly the
+   * inputs accepted by decode(input, length).
+   * @param input char array to decode.
+   * @param length of the input array.
+   * @param output buffer of at least decodedSizeUpperBound(length) chars.
+   * @return the number of bytes written, or 0 if the input isn't valid.
+   */
+  static size_t decode(const char* input, size_t length, char* output);
+
  private:
   /**
    * Helper method for encoding. This is used to encode all of the characters from the input string.
@@ -150,4 +150,98 @@ std::string Base64::encode(const char* input, uint64_t length) {
 
   return ret;
 }
+
+size_t Base64::encode(const char* input, size_t length, char* output) {
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(input);
+  char* out = output;
+
+  // Encode whole groups of 3 bytes into 4 chars each. There are no dependencies between groups,
+  // so compilers are free to unroll and vectorize the loop.
+  size_t num_groups = length / 3;
+  for (size_t i = 0; i < num_groups; ++i) {
+    const uint32_t word = static_cast<uint32_t>(in[0]) << 16 | static_cast<uint32_t>(in[1]) << 8 |
+                          static_cast<uint32_t>(in[2]);
+    out[0] = CHAR_TABLE[(word >> 18) & 0x3f];
+    out[1] = CHAR_TABLE[(word >> 12) & 0x3f];
+    out[2] = CHAR_TABLE[(word >> 6) & 0x3f];
+    out[3] = CHAR_TABLE[word & 0x3f];
+    in += 3;
+    out += 4;
+  }
+
+  switch (length % 3) {
+  case 1:
+    out[0] = CHAR_TABLE[in[0] >> 2];
+    out[1] = CHAR_TABLE[(in[0] & 0x03) << 4];
+    out[2] = '=';
+    out[3] = '=';
+    out += 4;
+    break;
+  case 2:
+    out[0] = CHAR_TABLE[in[0] >> 2];
+    out[1] = CHAR_TABLE[(in[0] & 0x03) << 4 | in[1] >> 4];
+    out[2] = CHAR_TABLE[(in[1] & 0x0f) << 2];
+    out[3] = '=';
+    out += 4;
+    break;
+  default:
+    break;
+  }
+  return static_cast<size_t>(out - output);
+}
+
+size_t Base64::decode(const char* input, size_t length, char* output) {
+  if (length % 4 || length == 0) {
+    return 0;
+  }
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(input);
+  char* out = output;
+
+  // At most last two chars can be '='; the group that contains them is decoded separately.
+  size_t padding = 0;
+  if (input[length - 1] == '=') {
+    padding = input[length - 2] == '=' ? 2 : 1;
+  }
+  size_t num_groups = length / 4 - (padding > 0 ? 1 : 0);
+  for (size_t i = 0; i < num_groups; ++i) {
+    const uint32_t a = REVERSE_LOOKUP_TABLE[in[0]];
+    const uint32_t b = REVERSE_LOOKUP_TABLE[in[1]];
+    const uint32_t c = REVERSE_LOOKUP_TABLE[in[2]];
+    const uint32_t d = REVERSE_LOOKUP_TABLE[in[3]];
+    // Valid characters decode to values below 64, so a single test catches any invalid one.
+    if ((a | b | c | d) & 64) {
+      return 0;
+    }
+    const uint32_t word = a << 18 | b << 12 | c << 6 | d;
+    out[0] = static_cast<char>(word >> 16);
+    out[1] = static_cast<char>(word >> 8);
+    out[2] = static_cast<char>(word);
+    in += 4;
+    out += 3;
+  }
+
+  if (padding > 0) {
+    const uint32_t a = REVERSE_LOOKUP_TABLE[in[0]];
+    const uint32_t b = REVERSE_LOOKUP_TABLE[in[1]];
+    if ((a | b) & 64) {
+      return 0;
+    }
+    if (padding == 2) {
+      if (b & 0b1111) {
+        // There are unused bits at tail.
+        return 0;
+      }
+      *out++ = static_cast<char>(a << 2 | b >> 4);
+    } else {
+      const uint32_t c = REVERSE_LOOKUP_TABLE[in[2]];
+      if ((c & 64) || (c & 0b11)) {
+        // Invalid character or unused bits at tail.
+        return 0;
+      }
+      *out++ = static_cast<char>(a << 2 | b >> 4);
+      *out++ = static_cast<char>(b << 4 | c >> 2);
+    }
+  }
+  return static_cast<size_t>(out - output);
+}
 } // namespace lightstep
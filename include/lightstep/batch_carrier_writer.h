@@ -0,0 +1,29 @@
+#pragma once
+
+#include <opentracing/string_view.h>
+#include <opentracing/util.h>
+#include <cstddef>
+
+namespace lightstep {
+// CarrierField is a single key-value pair set by Inject.
+struct CarrierField {
+  opentracing::string_view key;
+  opentracing::string_view value;
+};
+
+// BatchCarrierWriter is a carrier for LightStepTracer::InjectBatch. It's
+// given the same fields that Inject sets on a TextMapWriter or
+// HTTPHeadersWriter, but all in a single SetBatch call instead of calling Set
+// once per field.
+class BatchCarrierWriter {
+ public:
+  virtual ~BatchCarrierWriter() = default;
+
+  // SetBatch sets `num_fields` fields. `total_size` is the sum of the sizes of
+  // every key and value so that the carrier can reserve space up front. The
+  // views are only valid for the duration of the call.
+  virtual opentracing::expected<void> SetBatch(const CarrierField* fields,
+                                               size_t num_fields,
+                                               size_t total_size) const = 0;
+};
+}  // namespace lightstep
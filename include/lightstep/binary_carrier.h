@@ -1,6 +1,7 @@
 #pragma once
 
 #include <opentracing/propagation.h>
+#include <cstddef>
 #include "lightstep-tracer-common/lightstep_carrier.pb.h"
 
 namespace lightstep {
@@ -27,4 +28,44 @@ class LightStepBinaryWriter : public opentracing::CustomCarrierWriter {
  private:
   BinaryCarrier& carrier_;
 };
+
+// LightStepBufferReader extracts a span context from a buffer holding a
+// serialized BinaryCarrier. An empty buffer extracts to a null span context.
+class LightStepBufferReader : public opentracing::CustomCarrierReader {
+ public:
+  LightStepBufferReader(const char* data, size_t size) noexcept
+      : data_{data}, size_{size} {}
+
+  opentracing::expected<std::unique_ptr<opentracing::SpanContext>> Extract(
+      const opentracing::Tracer& tracer) const override;
+
+ private:
+  const char* data_;
+  size_t size_;
+};
+
+// LightStepBufferWriter injects a span context into a buffer as a serialized
+// BinaryCarrier without constructing any protobuf objects. Inject fails with
+// std::errc::no_buffer_space if the buffer is too small; ComputeSize gives
+// the exact number of bytes needed.
+class LightStepBufferWriter : public opentracing::CustomCarrierWriter {
+ public:
+  LightStepBufferWriter(char* data, size_t size) noexcept
+      : data_{data}, size_{size} {}
+
+  opentracing::expected<void> Inject(
+      const opentracing::Tracer& tracer,
+      const opentracing::SpanContext& span_context) const override;
+
+  // Returns the number of bytes written by the last successful Inject.
+  size_t num_bytes_written() const noexcept { return num_bytes_written_; }
+
+  static opentracing::expected<size_t> ComputeSize(
+      const opentracing::SpanContext& span_context) noexcept;
+
+ private:
+  char* data_;
+  size_t size_;
+  mutable size_t num_bytes_written_ = 0;
+};
 }  // namespace lightstep
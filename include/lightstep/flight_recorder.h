@@ -0,0 +1,38 @@
+#pragma once
+
+#include <opentracing/util.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace lightstep {
+// Marks every open flight recorder (see
+// LightStepTracerOptions::flight_recorder_path) as finalized, so that a
+// reader can tell that the process ended abnormally. It only does atomic
+// stores to the mapped files and is async-signal-safe, so it can be called
+// from a crash handler.
+void FinalizeFlightRecorders() noexcept;
+
+// FlightRecorderContents holds what's read back from a flight recorder.
+struct FlightRecorderContents {
+  // The process that wrote the spans.
+  int pid = 0;
+
+  // True if FinalizeFlightRecorders was called by the process.
+  bool finalized = false;
+
+  // True if the tracer was closed normally.
+  bool closed = false;
+
+  // The most recent spans, oldest first, each serialized as a
+  // lightstep.collector.Span.
+  std::vector<std::string> spans;
+};
+
+// Reads up to `max_spans` of the most recent spans from `path`, which is
+// either a flight recorder's file or a core file of a process that had one
+// mapped. Core files only include the mapping if bit 3 of the process's
+// /proc/<pid>/coredump_filter was set; otherwise, read the file itself.
+opentracing::expected<FlightRecorderContents> ReadFlightRecorder(
+    const std::string& path, size_t max_spans);
+}  // namespace lightstep
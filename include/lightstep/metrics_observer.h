@@ -1,7 +1,32 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
+
 namespace lightstep {
+// SpanDropReason says why spans were dropped rather than sent.
+enum class SpanDropReason {
+  // The buffer of spans waiting to be sent was full.
+  buffer_full,
+
+  // Recording the span would have exceeded the tracer's max_memory_bytes.
+  memory_limit,
+
+  // The tracer was disabled by the collector or is shutting down.
+  disabled,
+
+  // The report containing the spans couldn't be sent.
+  transport_failure,
+
+  // The report containing the spans couldn't be built.
+  internal_error
+};
+
 // MetricsObserver can be used to track LightStep tracer events.
+//
+// Hooks are called from the threads recording spans and sending reports, so
+// they should be thread-safe and cheap; only OnSpansDropped and
+// OnSpansDroppedForReason can be called for individual spans.
 class MetricsObserver {
  public:
   virtual ~MetricsObserver() = default;
@@ -12,7 +37,38 @@ class MetricsObserver {
   // OnSpansDropped records spans dropped.
   virtual void OnSpansDropped(int /*num_spans*/) {}
 
+  // OnSpansDroppedForReason records spans dropped along with why. By default
+  // it calls OnSpansDropped.
+  virtual void OnSpansDroppedForReason(SpanDropReason /*reason*/,
+                                       int num_spans) {
+    OnSpansDropped(num_spans);
+  }
+
   // OnFlush records flush events by the recorder.
   virtual void OnFlush() {}
+
+  // OnBufferFill records how many spans were buffered out of at most
+  // `max_buffered_spans` when the recorder flushed.
+  virtual void OnBufferFill(size_t /*num_buffered_spans*/,
+                            size_t /*max_buffered_spans*/) {}
+
+  // OnReportEncoded records the time taken to encode a report's spans and the
+  // size of the serialized report. Reports aren't compressed by the tracer,
+  // so `num_bytes` is also what's handed to the transporter.
+  virtual void OnReportEncoded(
+      std::chrono::steady_clock::duration /*encode_time*/,
+      size_t /*num_bytes*/) {}
+
+  // OnReportSent records the time from handing a report to the transporter
+  // until it was acknowledged by the collector.
+  virtual void OnReportSent(std::chrono::steady_clock::duration /*latency*/) {}
+
+  // OnWriterWakeup records each time the thread that sends reports wakes up,
+  // whether because the reporting period passed or the buffer filled.
+  virtual void OnWriterWakeup() {}
+
+  // OnBaggageItemsDropped records baggage items dropped for exceeding the
+  // tracer's baggage limits.
+  virtual void OnBaggageItemsDropped(int /*num_baggage_items*/) {}
 };
 }  // namespace lightstep
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <lightstep/batch_carrier_writer.h>
 #include <lightstep/metrics_observer.h>
 #include <lightstep/transporter.h>
 #include <opentracing/tracer.h>
@@ -8,7 +9,9 @@
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace lightstep {
 
@@ -45,6 +48,86 @@ class DynamicConfigurationValue {
   std::function<T()> value_functor_;
 };
 
+// PropagationMode specifies a format used to inject and extract span contexts
+// with TextMap and HTTPHeaders carriers.
+enum class PropagationMode {
+  // The `ot-tracer-*` keys, or `x-ot-span-context` if
+  // `use_single_key_propagation` is set.
+  lightstep,
+
+  // The B3 format used by Zipkin (`x-b3-*` keys, or the single `b3` key when
+  // extracting).
+  b3,
+
+  // The W3C Trace Context format (`traceparent`).
+  trace_context
+};
+
+// SpanFilter describes spans that should be discarded as soon as they're
+// started. A filtered span is a no-op: its tags, logs, and finish are ignored
+// and it's never recorded. A filtered span shares the span context of the span
+// it references, so its descendants are reported as descendants of that span;
+// descendants of a filtered root span aren't sampled.
+//
+// A span is filtered if it matches any of the following rules.
+struct SpanFilter {
+  // Spans with an operation name equal to one of `operation_names`.
+  std::vector<std::string> operation_names;
+
+  // Spans with an operation name starting with one of
+  // `operation_name_prefixes`.
+  std::vector<std::string> operation_name_prefixes;
+
+  // Spans started with a tag for which `tag_predicate` returns true.
+  std::function<bool(opentracing::string_view key,
+                     const opentracing::Value& value)>
+      tag_predicate;
+};
+
+// MemoryUsage is the memory used by a tracer, in bytes. Finished spans are
+// counted by an estimate of their encoded size; open spans also include the
+// size of the span object. See LightStepTracer::GetMemoryUsage.
+struct MemoryUsage {
+  // Spans that have been started but not finished.
+  size_t open_spans = 0;
+
+  // Finished spans waiting for the next report.
+  size_t buffered_spans = 0;
+
+  // Spans in reports that are being sent.
+  size_t inflight_reports = 0;
+
+  // The tracer's `max_memory_bytes`, or zero if it's unlimited.
+  size_t max_bytes = 0;
+
+  // The number of tags, logs and spans dropped for exceeding `max_bytes`.
+  size_t num_rejected_reservations = 0;
+
+  size_t total() const noexcept {
+    return open_spans + buffered_spans + inflight_reports;
+  }
+};
+
+// TracerStats counts the spans that have passed through a tracer since it was
+// created. See LightStepTracer::GetStats.
+struct TracerStats {
+  uint64_t num_spans_started = 0;
+  uint64_t num_spans_finished = 0;
+
+  // Spans discarded by the span filter or not sampled.
+  uint64_t num_spans_sampled_out = 0;
+
+  // Finished spans that were dropped rather than sent; see SpanDropReason.
+  uint64_t num_spans_dropped = 0;
+
+  // Spans in reports that were sent successfully.
+  uint64_t num_spans_sent = 0;
+
+  // Finished spans summarized into metrics rather than sent individually;
+  // see LightStepTracerOptions::aggregated_operations.
+  uint64_t num_spans_aggregated = 0;
+};
+
 struct LightStepTracerOptions {
   // `component_name` is the human-readable identity of the instrumented
   // process. I.e., if one drew a block diagram of the distributed system,
@@ -73,6 +156,51 @@ struct LightStepTracerOptions {
   // key in TextMap and HTTPHeaders carriers.
   bool use_single_key_propagation = false;
 
+  // `propagation_modes` lists the formats used to inject and extract span
+  // contexts with TextMap and HTTPHeaders carriers. Span contexts are injected
+  // in every listed format and extracted from the first listed format found in
+  // the carrier. Baggage is propagated with `ot-baggage-*` keys unless the
+  // LightStep format is used.
+  //
+  // Only 64-bit trace ids are supported: the upper half of a 128-bit trace id
+  // is dropped when extracting and written as zeros when injecting.
+  std::vector<PropagationMode> propagation_modes = {
+      PropagationMode::lightstep};
+
+  // Set `use_compact_single_key_propagation` to encode the single key's value
+  // with a compact length-prefixed format rather than a serialized protobuf.
+  // Ignored unless `use_single_key_propagation` is set. Either encoding is
+  // accepted when extracting, but older tracers can only read the protobuf.
+  bool use_compact_single_key_propagation = false;
+
+  // Baggage is copied into every child span context and injected on every
+  // hop, so its size is limited. Items with a key longer than
+  // `max_baggage_key_length` or a value longer than `max_baggage_value_length`
+  // are dropped, as are items that would take a span context over
+  // `max_baggage_items` items or `max_baggage_bytes` bytes of keys and values.
+  // Dropped items are reported with MetricsObserver::OnBaggageItemsDropped.
+  size_t max_baggage_items = 64;
+  size_t max_baggage_key_length = 256;
+  size_t max_baggage_value_length = 4096;
+  size_t max_baggage_bytes = 8192;
+
+  // Limits on the data held by each span, so that a single oversized tag or
+  // log can't stall reporting. Tags and logs past `max_tags_per_span` and
+  // `max_logs_per_span` are dropped. Longer keys and string values are cut
+  // off at `max_tag_key_length` and `max_tag_value_length`, and Values or
+  // Dictionary nested deeper than `max_tag_json_depth` are replaced by "...".
+  // Only the first `max_tag_json_elements` elements of a Values or Dictionary,
+  // counted across all levels of nesting, are kept. These also apply to log
+  // fields. A span that lost data carries the tags `lightstep.dropped_tags`,
+  // `lightstep.dropped_logs`, `lightstep.truncated_values` and
+  // `lightstep.dropped_values` counting what was dropped or cut off.
+  size_t max_tags_per_span = 1000;
+  size_t max_logs_per_span = 1000;
+  size_t max_tag_key_length = 256;
+  size_t max_tag_value_length = 16384;
+  size_t max_tag_json_depth = 8;
+  size_t max_tag_json_elements = 1000;
+
   // Set `ssl_root_certificates` to specify the CA certificates to use when
   // transporting spans to the collector.  If not set, LightStep will try to
   // use CA certificates located in standard system locations.
@@ -88,6 +216,14 @@ struct LightStepTracerOptions {
   // before sending them to a collector.
   DynamicConfigurationValue<size_t> max_buffered_spans = 2000;
 
+  // `max_memory_bytes` limits the memory used by open spans, buffered spans
+  // and reports being sent, as estimated by their encoded size. Tags and logs
+  // that would exceed it are dropped from open spans, operation names are cut
+  // off at `max_tag_key_length` or the length of the name they replace, and
+  // finished spans that would exceed it are dropped. If zero, memory use is
+  // only tracked; see LightStepTracer::GetMemoryUsage.
+  size_t max_memory_bytes = 0;
+
   // If `use_thread` is true, then the tracer will internally manage a thread to
   // regularly send reports to the collector; otherwise, if false,
   // LightStepTracer::Flush must be manually invoked to send reports.
@@ -117,6 +253,41 @@ struct LightStepTracerOptions {
   // `metrics_observer` can be optionally provided to track LightStep tracer
   // events. See MetricsObserver.
   std::unique_ptr<MetricsObserver> metrics_observer;
+
+  // `span_filter` specifies spans that should be discarded when started. It
+  // can be changed at runtime with LightStepTracer::SetSpanFilter.
+  SpanFilter span_filter;
+
+  // Finished spans with an operation name in `aggregated_operations` aren't
+  // recorded individually. Instead, their latency distribution and error
+  // counts are accumulated and sent as internal metrics with each report.
+  std::vector<std::string> aggregated_operations;
+
+  // `num_encoding_threads` is the number of additional threads used to encode
+  // spans when sending a report. If zero, spans are encoded on the thread
+  // sending reports; ignored if `use_thread` is false.
+  size_t num_encoding_threads = 0;
+
+  // Set `use_buffer_pool` to encode reports into blocks from a pool of
+  // NUMA-local, huge-page-backed memory rather than the heap; ignored if
+  // `use_thread` is false. Only the threads encoding reports use the pool:
+  // spans are still buffered on the heap by the threads that finish them.
+  bool use_buffer_pool = false;
+
+  // If `flight_recorder_path` is set, finished spans are also written to a
+  // ring buffer of `flight_recorder_size` bytes mapped from that file, so
+  // that the most recent spans can be read back with ReadFlightRecorder if
+  // the process crashes. See lightstep/flight_recorder.h.
+  std::string flight_recorder_path;
+  size_t flight_recorder_size = 1024 * 1024;
+
+  // Set `enable_profiling` to time starting spans, setting tags, finishing
+  // and recording spans, and encoding and sending reports with the CPU's
+  // cycle counter. The totals are sent with each report as "profile.*"
+  // internal metrics, along with the tracer's nanoseconds per span, which
+  // leaves out the time blocked sending reports. Ignored if the library was
+  // built with WITH_PROFILING off.
+  bool enable_profiling = false;
 };
 
 // The LightStepTracer interface can be used by custom carriers that need more
@@ -132,6 +303,44 @@ class LightStepTracer : public opentracing::Tracer {
       noexcept;
 
   virtual bool Flush() noexcept = 0;
+
+  // Returns the tracer's current memory use broken down by category.
+  virtual MemoryUsage GetMemoryUsage() const noexcept = 0;
+
+  // Returns the tracer's span counts. It doesn't take any locks, so it's
+  // cheap enough to poll frequently.
+  virtual TracerStats GetStats() const noexcept = 0;
+
+  // ExtractPassthrough and InjectPassthrough are for proxies that forward a
+  // request's headers and record a single span for it. ExtractPassthrough
+  // only reads the trace id, span id and sampling decision; baggage headers
+  // are left alone. InjectPassthrough, given a span started from that
+  // context, then only rewrites the span id of the formats found in the
+  // request, so the rest of the forwarded headers, baggage included, are
+  // passed on byte-for-byte.
+  //
+  // If ExtractPassthrough finds no span context, there are no headers to
+  // rewrite and Inject should be used instead.
+  virtual opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
+  ExtractPassthrough(const opentracing::HTTPHeadersReader& reader) const = 0;
+
+  virtual opentracing::expected<void> InjectPassthrough(
+      const opentracing::SpanContext& span_context,
+      const opentracing::HTTPHeadersWriter& writer) const = 0;
+
+  // Injects `span_context` with the same fields as Inject does into a TextMap
+  // carrier, but passes them all to a single BatchCarrierWriter::SetBatch
+  // call.
+  virtual opentracing::expected<void> InjectBatch(
+      const opentracing::SpanContext& span_context,
+      const BatchCarrierWriter& writer) const = 0;
+
+  // Replaces the tracer's span filter. Spans started after SetSpanFilter
+  // returns are checked against `span_filter`. It's safe to call
+  // SetSpanFilter while spans are being started on other threads: checking
+  // the filter takes no locks, and SetSpanFilter waits until no span is being
+  // checked against a replaced filter before freeing it.
+  virtual void SetSpanFilter(SpanFilter&& span_filter) noexcept = 0;
 };
 
 // Returns a std::shared_ptr to a LightStepTracer or nullptr on failure.
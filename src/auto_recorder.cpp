@@ -1,8 +1,40 @@
 #include "auto_recorder.h"
 #include <exception>
+#include "buffer_pool.h"
 #include "utility.h"
 
 namespace lightstep {
+//------------------------------------------------------------------------------
+// AllocateReportBlock
+//------------------------------------------------------------------------------
+static void* AllocateReportBlock(size_t size) {
+  auto result = GetReportBufferPool().Allocate(size);
+  if (result == nullptr) {
+    throw std::bad_alloc{};
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// DeallocateReportBlock
+//------------------------------------------------------------------------------
+static void DeallocateReportBlock(void* data, size_t size) {
+  GetReportBufferPool().Deallocate(data, size);
+}
+
+//------------------------------------------------------------------------------
+// MakeReportArenaOptions
+//------------------------------------------------------------------------------
+static google::protobuf::ArenaOptions MakeReportArenaOptions() {
+  google::protobuf::ArenaOptions result;
+  auto block_size = GetReportBufferPool().block_size();
+  result.start_block_size = block_size;
+  result.max_block_size = block_size;
+  result.block_alloc = AllocateReportBlock;
+  result.block_dealloc = DeallocateReportBlock;
+  return result;
+}
+
 //------------------------------------------------------------------------------
 // Constructor
 //------------------------------------------------------------------------------
@@ -18,7 +50,12 @@ AutoRecorder::AutoRecorder(
     std::unique_ptr<ConditionVariableWrapper>&& write_cond)
     : logger_{logger},
       options_{std::move(options)},
+      memory_budget_{options_.max_memory_bytes},
+      profiler_{MakeProfiler(options_.enable_profiling)},
+      flight_recorder_{MakeFlightRecorder(logger_, options_)},
       builder_{options_.access_token, options_.tags},
+      aggregator_{options_.aggregated_operations},
+      encoder_pool_{logger_, options_.num_encoding_threads},
       transporter_{std::move(transporter)},
       write_cond_{std::move(write_cond)} {
   // If no MetricsObserver was provided, use a default one that does nothing.
@@ -40,18 +77,37 @@ AutoRecorder::~AutoRecorder() {
 //------------------------------------------------------------------------------
 // RecordSpan
 //------------------------------------------------------------------------------
-void AutoRecorder::RecordSpan(collector::Span&& span) noexcept try {
-  std::lock_guard<std::mutex> lock_guard{write_mutex_};
-  if (builder_.num_pending_spans() >= max_buffered_spans_snapshot_ ||
-      write_exit_) {
-    dropped_spans_++;
-    options_.metrics_observer->OnSpansDropped(1);
+void AutoRecorder::RecordSpan(SpanRecord&& span) noexcept try {
+  ScopedProfile profile{profiler_.get(), ProfileStage::record_span};
+  if (aggregator_.AggregateSpan(span)) {
+    stats_counters_.OnSpanAggregated();
     return;
   }
-  builder_.AddSpan(std::move(span));
+  // Spans are mirrored even if they're about to be dropped: they're still
+  // the most recent activity if the process crashes.
+  if (flight_recorder_ != nullptr) {
+    flight_recorder_->Record(logger_, span);
+  }
+  auto num_bytes = EstimateEncodedSize(span);
+  std::lock_guard<std::mutex> lock_guard{write_mutex_};
+  SpanDropReason drop_reason;
   if (builder_.num_pending_spans() >= max_buffered_spans_snapshot_) {
-    write_cond_->NotifyAll();
+    drop_reason = SpanDropReason::buffer_full;
+  } else if (write_exit_) {
+    drop_reason = SpanDropReason::disabled;
+  } else if (!memory_budget_.Reserve(MemoryCategory::buffered_spans,
+                                     num_bytes)) {
+    drop_reason = SpanDropReason::memory_limit;
+  } else {
+    pending_bytes_ += num_bytes;
+    builder_.AddSpan(std::move(span));
+    if (builder_.num_pending_spans() >= max_buffered_spans_snapshot_) {
+      write_cond_->NotifyAll();
+    }
+    return;
   }
+  dropped_spans_++;
+  DropSpans(drop_reason, 1);
 } catch (const std::exception& e) {
   logger_.Error("Failed to record span: ", e.what());
 }
@@ -66,7 +122,8 @@ bool AutoRecorder::FlushWithTimeout(
   // operations to clear out all the presently pending data.
   std::unique_lock<std::mutex> lock{write_mutex_};
 
-  bool has_encoded = builder_.num_pending_spans() != 0;
+  bool has_encoded =
+      builder_.num_pending_spans() != 0 || aggregator_.has_aggregates();
 
   if (!has_encoded && encoding_seqno_ == 1 + flushed_seqno_) {
     return true;
@@ -93,6 +150,7 @@ void AutoRecorder::Write() noexcept try {
   auto next = write_cond_->Now() + options_.reporting_period;
 
   while (WaitForNextWrite(next)) {
+    options_.metrics_observer->OnWriterWakeup();
     FlushOne();
 
     auto end = write_cond_->Now();
@@ -114,10 +172,17 @@ void AutoRecorder::Write() noexcept try {
 //------------------------------------------------------------------------------
 bool AutoRecorder::WriteReport(const collector::ReportRequest& report) {
   collector::ReportResponse response;
-  auto was_successful = transporter_->Send(report, response);
+  auto start_timestamp = std::chrono::steady_clock::now();
+  opentracing::expected<void> was_successful;
+  {
+    ScopedProfile profile{profiler_.get(), ProfileStage::send};
+    was_successful = transporter_->Send(report, response);
+  }
   if (!was_successful) {
     return false;
   }
+  options_.metrics_observer->OnReportSent(std::chrono::steady_clock::now() -
+                                          start_timestamp);
   LogReportResponse(logger_, options_.verbose, response);
   for (auto& command : response.commands()) {
     if (command.disable()) {
@@ -133,38 +198,127 @@ bool AutoRecorder::WriteReport(const collector::ReportRequest& report) {
 //------------------------------------------------------------------------------
 void AutoRecorder::FlushOne() {
   options_.metrics_observer->OnFlush();
+  auto start_timestamp = std::chrono::steady_clock::now();
+  if (options_.use_buffer_pool) {
+    // The previous report's arena has handed its blocks back by now, so
+    // slabs mapped for a burst can be released before the next one is built.
+    GetReportBufferPool().ReleaseIdleSlabs();
+  }
 
   size_t save_dropped;
   size_t save_pending;
+  size_t save_bytes;
   {
     // Swap the pending encoder with the inflight encoder, then use
     // inflight without a lock. Assumption is that this thread is the
     // only place inflight_ is used.
     std::lock_guard<std::mutex> lock_guard{write_mutex_};
     save_pending = builder_.num_pending_spans();
-    if (save_pending == 0) {
+    options_.metrics_observer->OnBufferFill(save_pending,
+                                            max_buffered_spans_snapshot_);
+    if (save_pending == 0 && !aggregator_.has_aggregates()) {
+      // Once a burst has passed, the buffers are only released as they're
+      // used; since nothing is being sent, release the pending ones here.
+      retention_policy_.Update(0);
+      ReleaseExcessCapacity(retention_policy_, builder_.pending_spans(),
+                            builder_.pending());
+      ReleaseExcessCapacity(retention_policy_, inflight_spans_, inflight_);
       return;
     }
     options_.metrics_observer->OnSpansSent(static_cast<int>(save_pending));
     // TODO(rnburn): Compute and set timestamp_offset_micros
     save_dropped = dropped_spans_;
     builder_.set_pending_client_dropped_spans(save_dropped);
+    HealthMetrics health_metrics;
+    health_metrics.num_buffered_spans = save_pending;
+    health_metrics.num_buffered_bytes = pending_bytes_;
+    health_metrics.num_memory_bytes = memory_budget_.usage().total();
+    health_metrics.num_failed_reports = num_failed_reports_;
+    health_metrics.flush_duration = last_flush_duration_;
+    health_metrics.encode_cpu_time = last_encode_cpu_time_;
+    health_metrics.sampling_rate =
+        sampling_rate_counter_.Reset(stats_counters_.snapshot());
+    builder_.set_pending_health_metrics(health_metrics);
+    if (profiler_ != nullptr) {
+      profiler_->Flush(builder_.pending_internal_metrics());
+    }
+    num_failed_reports_ = 0;
+    aggregator_.Flush(builder_.pending_internal_metrics());
     dropped_spans_ = 0;
+    save_bytes = pending_bytes_;
+    pending_bytes_ = 0;
+    memory_budget_.Transfer(MemoryCategory::buffered_spans,
+                            MemoryCategory::inflight_reports, save_bytes);
     std::swap(builder_.pending(), inflight_);
+    std::swap(builder_.pending_spans(), inflight_spans_);
     ++encoding_seqno_;
   }
-  bool success = WriteReport(inflight_);
+
+  // Encode the spans outside of the lock so that threads recording spans
+  // aren't blocked.
+  bool success;
+  if (options_.use_buffer_pool) {
+    success = EncodeAndWritePooledReport();
+  } else {
+    EncodeReport(inflight_);
+    success = WriteReport(inflight_);
+  }
   {
     std::lock_guard<std::mutex> lock_guard{write_mutex_};
     ++flushed_seqno_;
     write_cond_->NotifyAll();
     inflight_.Clear();
+    memory_budget_.Release(MemoryCategory::inflight_reports, save_bytes);
 
-    if (!success) {
-      options_.metrics_observer->OnSpansDropped(static_cast<int>(save_pending));
+    if (success) {
+      stats_counters_.OnSpansSent(save_pending);
+    } else {
+      DropSpans(SpanDropReason::transport_failure, save_pending);
       dropped_spans_ += save_dropped + save_pending;
+      ++num_failed_reports_;
     }
   }
+  last_flush_duration_ = std::chrono::steady_clock::now() - start_timestamp;
+  retention_policy_.Update(save_pending);
+  ReleaseExcessCapacity(retention_policy_, inflight_spans_, inflight_);
+}
+
+//------------------------------------------------------------------------------
+// EncodeAndWritePooledReport
+//------------------------------------------------------------------------------
+bool AutoRecorder::EncodeAndWritePooledReport() {
+  // The spans are encoded into a report on an arena whose blocks come from
+  // the buffer pool; they're all handed back at once when the arena is
+  // destroyed. inflight_ only holds the reporter and metrics at this point,
+  // so copying it is cheap.
+  google::protobuf::Arena arena{MakeReportArenaOptions()};
+  auto report =
+      google::protobuf::Arena::CreateMessage<collector::ReportRequest>(&arena);
+  report->CopyFrom(inflight_);
+  EncodeReport(*report);
+  return WriteReport(*report);
+}
+
+//------------------------------------------------------------------------------
+// EncodeReport
+//------------------------------------------------------------------------------
+void AutoRecorder::EncodeReport(collector::ReportRequest& report) {
+  ScopedProfile profile{profiler_.get(), ProfileStage::encode};
+  auto start_timestamp = std::chrono::steady_clock::now();
+  last_encode_cpu_time_ = encoder_pool_.Encode(inflight_spans_, report);
+  inflight_spans_.clear();
+  auto encode_time = std::chrono::steady_clock::now() - start_timestamp;
+  options_.metrics_observer->OnReportEncoded(encode_time,
+                                             report.ByteSizeLong());
+}
+
+//------------------------------------------------------------------------------
+// DropSpans
+//------------------------------------------------------------------------------
+void AutoRecorder::DropSpans(SpanDropReason reason, size_t num_spans) noexcept {
+  stats_counters_.OnSpansDropped(num_spans);
+  options_.metrics_observer->OnSpansDroppedForReason(
+      reason, static_cast<int>(num_spans));
 }
 
 //------------------------------------------------------------------------------
@@ -7,10 +7,13 @@
 #include <mutex>
 #include <thread>
 #include "condition_variable_wrapper.h"
+#include "flight_recorder.h"
 #include "lightstep-tracer-common/collector.pb.h"
 #include "logger.h"
 #include "recorder.h"
 #include "report_builder.h"
+#include "span_aggregator.h"
+#include "span_encoder_pool.h"
 
 namespace lightstep {
 // AutoRecorder buffers spans finished by a tracer and sends them over to
@@ -32,11 +35,23 @@ class AutoRecorder : public Recorder {
 
   ~AutoRecorder() override;
 
-  void RecordSpan(collector::Span&& span) noexcept override;
+  void RecordSpan(SpanRecord&& span) noexcept override;
 
   bool FlushWithTimeout(
       std::chrono::system_clock::duration timeout) noexcept override;
 
+  MetricsObserver& metrics_observer() noexcept override {
+    return *options_.metrics_observer;
+  }
+
+  MemoryBudget& memory_budget() noexcept override { return memory_budget_; }
+
+  Profiler* profiler() noexcept override { return profiler_.get(); }
+
+  TracerStatsCounters& stats_counters() noexcept override {
+    return stats_counters_;
+  }
+
   // used for testing only.
   bool is_writer_running() const {
     std::lock_guard<std::mutex> lock_guard{write_mutex_};
@@ -48,6 +63,16 @@ class AutoRecorder : public Recorder {
   bool WriteReport(const collector::ReportRequest& report);
   void FlushOne();
 
+  // Counts `num_spans` as dropped for `reason` and tells the MetricsObserver.
+  void DropSpans(SpanDropReason reason, size_t num_spans) noexcept;
+
+  // Encodes inflight_spans_ into `report`.
+  void EncodeReport(collector::ReportRequest& report);
+
+  // Encodes inflight_spans_ into memory from the buffer pool and sends the
+  // report.
+  bool EncodeAndWritePooledReport();
+
   // Forces the writer thread to exit immediately.
   void MakeWriterExit();
 
@@ -58,6 +83,12 @@ class AutoRecorder : public Recorder {
 
   Logger& logger_;
   LightStepTracerOptions options_;
+  MemoryBudget memory_budget_;
+  std::unique_ptr<Profiler> profiler_;
+  TracerStatsCounters stats_counters_;
+
+  // Mirrors recorded spans to a file; null unless configured (thread-safe).
+  std::unique_ptr<FlightRecorder> flight_recorder_;
 
   // Writer state.
   mutable std::mutex write_mutex_;
@@ -67,10 +98,29 @@ class AutoRecorder : public Recorder {
   // Buffer state (protected by write_mutex_).
   ReportBuilder builder_;
   collector::ReportRequest inflight_;
+  std::vector<SpanRecord> inflight_spans_;
   size_t max_buffered_spans_snapshot_;
   size_t flushed_seqno_ = 0;
   size_t encoding_seqno_ = 1;
   size_t dropped_spans_ = 0;
+  size_t pending_bytes_ = 0;
+  size_t num_failed_reports_ = 0;
+
+  // Health of the previous flush (only used by the writer thread).
+  std::chrono::steady_clock::duration last_flush_duration_{};
+  std::chrono::nanoseconds last_encode_cpu_time_{};
+
+  SamplingRateCounter sampling_rate_counter_;
+
+  // Decides when the buffers swapped between builder_ and inflight_ are
+  // released after a burst (only used by the writer thread).
+  BufferRetentionPolicy retention_policy_;
+
+  // Summarizes spans of aggregated operations (lock-free).
+  SpanAggregator aggregator_;
+
+  // Encodes inflight_spans_ into inflight_ (only used by the writer thread).
+  SpanEncoderPool encoder_pool_;
 
   // SyncTransporter through which to send span reports.
   std::unique_ptr<SyncTransporter> transporter_;
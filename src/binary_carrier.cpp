@@ -1,5 +1,8 @@
 #include <lightstep/binary_carrier.h>
 #include <lightstep/tracer.h>
+#include "binary_carrier_format.h"
+#include "lightstep_span_context.h"
+#include "lightstep_tracer_impl.h"
 
 namespace lightstep {
 //------------------------------------------------------------------------------
@@ -7,7 +10,7 @@ namespace lightstep {
 //------------------------------------------------------------------------------
 opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
 LightStepBinaryReader::Extract(const opentracing::Tracer& tracer) const try {
-  auto lightstep_tracer = dynamic_cast<const LightStepTracer*>(&tracer);
+  auto lightstep_tracer = AsLightStepTracer(tracer);
   if (lightstep_tracer == nullptr) {
     return opentracing::make_unexpected(opentracing::invalid_carrier_error);
   }
@@ -32,7 +35,7 @@ LightStepBinaryReader::Extract(const opentracing::Tracer& tracer) const try {
 opentracing::expected<void> LightStepBinaryWriter::Inject(
     const opentracing::Tracer& tracer,
     const opentracing::SpanContext& span_context) const try {
-  auto lightstep_tracer = dynamic_cast<const LightStepTracer*>(&tracer);
+  auto lightstep_tracer = AsLightStepTracer(tracer);
   if (lightstep_tracer == nullptr) {
     return opentracing::make_unexpected(opentracing::invalid_carrier_error);
   }
@@ -59,4 +62,69 @@ opentracing::expected<void> LightStepBinaryWriter::Inject(
   return opentracing::make_unexpected(
       std::make_error_code(std::errc::not_enough_memory));
 }
+
+//------------------------------------------------------------------------------
+// Extract
+//------------------------------------------------------------------------------
+opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
+LightStepBufferReader::Extract(const opentracing::Tracer& tracer) const try {
+  auto tracer_impl = AsLightStepTracerImpl(tracer);
+  if (tracer_impl == nullptr) {
+    return opentracing::make_unexpected(opentracing::invalid_carrier_error);
+  }
+  if (size_ == 0) {
+    return {};
+  }
+  uint64_t trace_id, span_id;
+  bool sampled;
+  std::string encoded_baggage;
+  if (!ParseBinaryCarrier(opentracing::string_view{data_, size_}, trace_id,
+                          span_id, sampled, encoded_baggage)) {
+    return opentracing::make_unexpected(
+        opentracing::span_context_corrupted_error);
+  }
+  std::unique_ptr<LightStepSpanContext> span_context{new LightStepSpanContext{
+      trace_id, span_id, sampled, std::move(encoded_baggage)}};
+  tracer_impl->ApplyBaggageLimits(*span_context);
+  return std::unique_ptr<opentracing::SpanContext>{span_context.release()};
+} catch (const std::bad_alloc&) {
+  return opentracing::make_unexpected(
+      std::make_error_code(std::errc::not_enough_memory));
+}
+
+//------------------------------------------------------------------------------
+// Inject
+//------------------------------------------------------------------------------
+opentracing::expected<void> LightStepBufferWriter::Inject(
+    const opentracing::Tracer& tracer,
+    const opentracing::SpanContext& span_context) const {
+  if (AsLightStepTracer(tracer) == nullptr) {
+    return opentracing::make_unexpected(opentracing::invalid_carrier_error);
+  }
+  auto lightstep_span_context = AsLightStepSpanContext(&span_context);
+  if (lightstep_span_context == nullptr) {
+    return opentracing::make_unexpected(
+        opentracing::invalid_span_context_error);
+  }
+  auto num_bytes_written_maybe =
+      lightstep_span_context->SerializeBinaryCarrier(data_, size_);
+  if (!num_bytes_written_maybe) {
+    return opentracing::make_unexpected(num_bytes_written_maybe.error());
+  }
+  num_bytes_written_ = *num_bytes_written_maybe;
+  return {};
+}
+
+//------------------------------------------------------------------------------
+// ComputeSize
+//------------------------------------------------------------------------------
+opentracing::expected<size_t> LightStepBufferWriter::ComputeSize(
+    const opentracing::SpanContext& span_context) noexcept {
+  auto lightstep_span_context = AsLightStepSpanContext(&span_context);
+  if (lightstep_span_context == nullptr) {
+    return opentracing::make_unexpected(
+        opentracing::invalid_span_context_error);
+  }
+  return lightstep_span_context->ComputeBinaryCarrierSize();
+}
 }  // namespace lightstep
@@ -0,0 +1,467 @@
+#include "binary_carrier_format.h"
+#include <cstring>
+
+namespace lightstep {
+// Protobuf wire types.
+const uint32_t WireTypeVarint = 0;
+const uint32_t WireTypeFixed64 = 1;
+const uint32_t WireTypeLengthDelimited = 2;
+const uint32_t WireTypeFixed32 = 5;
+
+// Field numbers from lightstep_carrier.proto.
+const uint32_t BinaryCarrierBasicCtxField = 2;
+const uint32_t BasicTracerCarrierTraceIdField = 1;
+const uint32_t BasicTracerCarrierSpanIdField = 2;
+const uint32_t BasicTracerCarrierSampledField = 3;
+const uint32_t BasicTracerCarrierBaggageItemsField = 4;
+const uint32_t MapEntryKeyField = 1;
+const uint32_t MapEntryValueField = 2;
+
+//------------------------------------------------------------------------------
+// MakeTag
+//------------------------------------------------------------------------------
+static char MakeTag(uint32_t field, uint32_t wire_type) noexcept {
+  return static_cast<char>(field << 3 | wire_type);
+}
+
+//------------------------------------------------------------------------------
+// ComputeVarintSize
+//------------------------------------------------------------------------------
+static size_t ComputeVarintSize(uint64_t x) noexcept {
+  size_t result = 1;
+  while (x >= 0x80) {
+    x >>= 7;
+    ++result;
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// ComputeLengthDelimitedSize
+//------------------------------------------------------------------------------
+// Returns the size of a length-delimited field with a single byte tag.
+static size_t ComputeLengthDelimitedSize(size_t length) noexcept {
+  return 1 + ComputeVarintSize(length) + length;
+}
+
+//------------------------------------------------------------------------------
+// ComputeBaggageItemSize
+//------------------------------------------------------------------------------
+static size_t ComputeBaggageItemSize(opentracing::string_view key,
+                                     opentracing::string_view value) noexcept {
+  return ComputeLengthDelimitedSize(key.size()) +
+         ComputeLengthDelimitedSize(value.size());
+}
+
+//------------------------------------------------------------------------------
+// ComputeBasicTracerCarrierSize
+//------------------------------------------------------------------------------
+static size_t ComputeBasicTracerCarrierSize(
+    uint64_t trace_id, uint64_t span_id, bool sampled,
+    const BaggageRef& baggage) noexcept {
+  // Fields with default values are omitted, as protobuf does for proto3.
+  size_t result = 0;
+  if (trace_id != 0) {
+    result += 1 + sizeof(uint64_t);
+  }
+  if (span_id != 0) {
+    result += 1 + sizeof(uint64_t);
+  }
+  if (sampled) {
+    result += 2;
+  }
+  baggage.Foreach(
+      [&result](opentracing::string_view key, opentracing::string_view value) {
+        result +=
+            ComputeLengthDelimitedSize(ComputeBaggageItemSize(key, value));
+        return true;
+      });
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// WriteVarint
+//------------------------------------------------------------------------------
+static char* WriteVarint(uint64_t x, char* data) noexcept {
+  while (x >= 0x80) {
+    *data++ = static_cast<char>(x | 0x80);
+    x >>= 7;
+  }
+  *data++ = static_cast<char>(x);
+  return data;
+}
+
+//------------------------------------------------------------------------------
+// WriteFixed64
+//------------------------------------------------------------------------------
+static char* WriteFixed64(uint64_t x, char* data) noexcept {
+  for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+    *data++ = static_cast<char>(x >> (8 * i));
+  }
+  return data;
+}
+
+//------------------------------------------------------------------------------
+// WriteString
+//------------------------------------------------------------------------------
+static char* WriteString(uint32_t field, opentracing::string_view s,
+                         char* data) noexcept {
+  *data++ = MakeTag(field, WireTypeLengthDelimited);
+  data = WriteVarint(s.size(), data);
+  std::memcpy(data, s.data(), s.size());
+  return data + s.size();
+}
+
+//------------------------------------------------------------------------------
+// ReadVarint
+//------------------------------------------------------------------------------
+static bool ReadVarint(const char*& data, const char* last,
+                       uint64_t& x) noexcept {
+  x = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (data == last) {
+      return false;
+    }
+    auto byte = static_cast<uint8_t>(*data++);
+    x |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// ReadFixed64
+//------------------------------------------------------------------------------
+static bool ReadFixed64(const char*& data, const char* last,
+                        uint64_t& x) noexcept {
+  if (last - data < static_cast<std::ptrdiff_t>(sizeof(uint64_t))) {
+    return false;
+  }
+  x = 0;
+  for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+    x |= static_cast<uint64_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+  }
+  data += sizeof(uint64_t);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// ReadLengthDelimited
+//------------------------------------------------------------------------------
+static bool ReadLengthDelimited(const char*& data, const char* last,
+                                opentracing::string_view& s) noexcept {
+  uint64_t length;
+  if (!ReadVarint(data, last, length)) {
+    return false;
+  }
+  if (length > static_cast<uint64_t>(last - data)) {
+    return false;
+  }
+  s = opentracing::string_view{data, static_cast<size_t>(length)};
+  data += length;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// ReadTag
+//------------------------------------------------------------------------------
+static bool ReadTag(const char*& data, const char* last, uint32_t& field,
+                    uint32_t& wire_type) noexcept {
+  uint64_t tag;
+  if (!ReadVarint(data, last, tag) || tag > UINT32_MAX) {
+    return false;
+  }
+  field = static_cast<uint32_t>(tag >> 3);
+  wire_type = static_cast<uint32_t>(tag & 0x7);
+  return field != 0;
+}
+
+//------------------------------------------------------------------------------
+// SkipField
+//------------------------------------------------------------------------------
+static bool SkipField(uint32_t wire_type, const char*& data,
+                      const char* last) noexcept {
+  uint64_t x;
+  opentracing::string_view s;
+  switch (wire_type) {
+    case WireTypeVarint:
+      return ReadVarint(data, last, x);
+    case WireTypeFixed64:
+      return ReadFixed64(data, last, x);
+    case WireTypeLengthDelimited:
+      return ReadLengthDelimited(data, last, s);
+    case WireTypeFixed32:
+      if (last - data < 4) {
+        return false;
+      }
+      data += 4;
+      return true;
+    default:
+      // Groups aren't used by the carrier, so treat them as corruption.
+      return false;
+  }
+}
+
+//------------------------------------------------------------------------------
+// AddBaggageItem
+//------------------------------------------------------------------------------
+static void AddBaggageItem(
+    opentracing::string_view key, opentracing::string_view value,
+    std::unordered_map<std::string, std::string>& baggage) {
+  baggage[key].assign(value.data(), value.size());
+}
+
+static void AddBaggageItem(opentracing::string_view key,
+                           opentracing::string_view value,
+                           std::string& encoded_baggage) {
+  AppendEncodedBaggageItem(key, value, encoded_baggage);
+}
+
+//------------------------------------------------------------------------------
+// ParseBaggageItem
+//------------------------------------------------------------------------------
+template <class Baggage>
+static bool ParseBaggageItem(opentracing::string_view entry,
+                             Baggage& baggage) {
+  auto data = entry.data();
+  auto last = data + entry.size();
+  opentracing::string_view key;
+  opentracing::string_view value;
+  while (data != last) {
+    uint32_t field, wire_type;
+    if (!ReadTag(data, last, field, wire_type)) {
+      return false;
+    }
+    if (field == MapEntryKeyField && wire_type == WireTypeLengthDelimited) {
+      if (!ReadLengthDelimited(data, last, key)) {
+        return false;
+      }
+    } else if (field == MapEntryValueField &&
+               wire_type == WireTypeLengthDelimited) {
+      if (!ReadLengthDelimited(data, last, value)) {
+        return false;
+      }
+    } else if (!SkipField(wire_type, data, last)) {
+      return false;
+    }
+  }
+  AddBaggageItem(key, value, baggage);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// ParseBasicTracerCarrier
+//------------------------------------------------------------------------------
+template <class Baggage>
+static bool ParseBasicTracerCarrier(opentracing::string_view basic,
+                                    uint64_t& trace_id, uint64_t& span_id,
+                                    bool& sampled, Baggage& baggage) {
+  auto data = basic.data();
+  auto last = data + basic.size();
+  while (data != last) {
+    uint32_t field, wire_type;
+    if (!ReadTag(data, last, field, wire_type)) {
+      return false;
+    }
+    bool was_successful;
+    if (field == BasicTracerCarrierTraceIdField &&
+        wire_type == WireTypeFixed64) {
+      was_successful = ReadFixed64(data, last, trace_id);
+    } else if (field == BasicTracerCarrierSpanIdField &&
+               wire_type == WireTypeFixed64) {
+      was_successful = ReadFixed64(data, last, span_id);
+    } else if (field == BasicTracerCarrierSampledField &&
+               wire_type == WireTypeVarint) {
+      uint64_t x;
+      was_successful = ReadVarint(data, last, x);
+      sampled = x != 0;
+    } else if (field == BasicTracerCarrierBaggageItemsField &&
+               wire_type == WireTypeLengthDelimited) {
+      opentracing::string_view entry;
+      was_successful = ReadLengthDelimited(data, last, entry) &&
+                       ParseBaggageItem(entry, baggage);
+    } else {
+      was_successful = SkipField(wire_type, data, last);
+    }
+    if (!was_successful) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// ComputeBinaryCarrierSize
+//------------------------------------------------------------------------------
+size_t ComputeBinaryCarrierSize(uint64_t trace_id, uint64_t span_id,
+                                bool sampled,
+                                const BaggageRef& baggage) noexcept {
+  return ComputeLengthDelimitedSize(
+      ComputeBasicTracerCarrierSize(trace_id, span_id, sampled, baggage));
+}
+
+//------------------------------------------------------------------------------
+// SerializeBinaryCarrier
+//------------------------------------------------------------------------------
+size_t SerializeBinaryCarrier(uint64_t trace_id, uint64_t span_id,
+                              bool sampled, const BaggageRef& baggage,
+                              char* data) noexcept {
+  auto first = data;
+  *data++ = MakeTag(BinaryCarrierBasicCtxField, WireTypeLengthDelimited);
+  data = WriteVarint(
+      ComputeBasicTracerCarrierSize(trace_id, span_id, sampled, baggage),
+      data);
+  if (trace_id != 0) {
+    *data++ = MakeTag(BasicTracerCarrierTraceIdField, WireTypeFixed64);
+    data = WriteFixed64(trace_id, data);
+  }
+  if (span_id != 0) {
+    *data++ = MakeTag(BasicTracerCarrierSpanIdField, WireTypeFixed64);
+    data = WriteFixed64(span_id, data);
+  }
+  if (sampled) {
+    *data++ = MakeTag(BasicTracerCarrierSampledField, WireTypeVarint);
+    *data++ = 1;
+  }
+  baggage.Foreach(
+      [&data](opentracing::string_view key, opentracing::string_view value) {
+        *data++ = MakeTag(BasicTracerCarrierBaggageItemsField,
+                          WireTypeLengthDelimited);
+        data = WriteVarint(ComputeBaggageItemSize(key, value), data);
+        data = WriteString(MapEntryKeyField, key, data);
+        data = WriteString(MapEntryValueField, value, data);
+        return true;
+      });
+  return static_cast<size_t>(data - first);
+}
+
+//------------------------------------------------------------------------------
+// ParseBinaryCarrierImpl
+//------------------------------------------------------------------------------
+template <class Baggage>
+static bool ParseBinaryCarrierImpl(opentracing::string_view data,
+                                   uint64_t& trace_id, uint64_t& span_id,
+                                   bool& sampled, Baggage& baggage) {
+  trace_id = 0;
+  span_id = 0;
+  sampled = false;
+  auto first = data.data();
+  auto last = first + data.size();
+  while (first != last) {
+    uint32_t field, wire_type;
+    if (!ReadTag(first, last, field, wire_type)) {
+      return false;
+    }
+    if (field == BinaryCarrierBasicCtxField &&
+        wire_type == WireTypeLengthDelimited) {
+      // As with protobuf, multiple occurrences of the message are merged.
+      opentracing::string_view basic;
+      if (!ReadLengthDelimited(first, last, basic) ||
+          !ParseBasicTracerCarrier(basic, trace_id, span_id, sampled,
+                                   baggage)) {
+        return false;
+      }
+    } else if (!SkipField(wire_type, first, last)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// ParseBinaryCarrier
+//------------------------------------------------------------------------------
+bool ParseBinaryCarrier(opentracing::string_view data, uint64_t& trace_id,
+                        uint64_t& span_id, bool& sampled,
+                        std::unordered_map<std::string, std::string>& baggage) {
+  return ParseBinaryCarrierImpl(data, trace_id, span_id, sampled, baggage);
+}
+
+bool ParseBinaryCarrier(opentracing::string_view data, uint64_t& trace_id,
+                        uint64_t& span_id, bool& sampled,
+                        std::string& encoded_baggage) {
+  return ParseBinaryCarrierImpl(data, trace_id, span_id, sampled,
+                                encoded_baggage);
+}
+
+//------------------------------------------------------------------------------
+// ComputeCompactCarrierSize
+//------------------------------------------------------------------------------
+size_t ComputeCompactCarrierSize(const BaggageRef& baggage) noexcept {
+  size_t result = MaxCompactCarrierSizeWithoutBaggage;
+  baggage.Foreach(
+      [&result](opentracing::string_view key, opentracing::string_view value) {
+        result += ComputeVarintSize(key.size()) + key.size() +
+                  ComputeVarintSize(value.size()) + value.size();
+        return true;
+      });
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// SerializeCompactCarrier
+//------------------------------------------------------------------------------
+size_t SerializeCompactCarrier(uint64_t trace_id, uint64_t span_id,
+                               bool sampled, const BaggageRef& baggage,
+                               char* data) noexcept {
+  auto first = data;
+  *data++ = CompactCarrierVersion;
+  data = WriteFixed64(trace_id, data);
+  data = WriteFixed64(span_id, data);
+  *data++ = static_cast<char>(sampled ? 1 : 0);
+  baggage.Foreach(
+      [&data](opentracing::string_view key, opentracing::string_view value) {
+        for (auto s : {key, value}) {
+          data = WriteVarint(s.size(), data);
+          std::memcpy(data, s.data(), s.size());
+          data += s.size();
+        }
+        return true;
+      });
+  return static_cast<size_t>(data - first);
+}
+
+//------------------------------------------------------------------------------
+// ParseCompactCarrierImpl
+//------------------------------------------------------------------------------
+template <class Baggage>
+static bool ParseCompactCarrierImpl(opentracing::string_view data,
+                                    uint64_t& trace_id, uint64_t& span_id,
+                                    bool& sampled, Baggage& baggage) {
+  auto first = data.data();
+  auto last = first + data.size();
+  if (first == last || *first++ != CompactCarrierVersion ||
+      !ReadFixed64(first, last, trace_id) ||
+      !ReadFixed64(first, last, span_id) || first == last) {
+    return false;
+  }
+  sampled = (*first++ & 1) != 0;
+  while (first != last) {
+    opentracing::string_view key, value;
+    if (!ReadLengthDelimited(first, last, key) ||
+        !ReadLengthDelimited(first, last, value)) {
+      return false;
+    }
+    AddBaggageItem(key, value, baggage);
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// ParseCompactCarrier
+//------------------------------------------------------------------------------
+bool ParseCompactCarrier(
+    opentracing::string_view data, uint64_t& trace_id, uint64_t& span_id,
+    bool& sampled, std::unordered_map<std::string, std::string>& baggage) {
+  return ParseCompactCarrierImpl(data, trace_id, span_id, sampled, baggage);
+}
+
+bool ParseCompactCarrier(opentracing::string_view data, uint64_t& trace_id,
+                         uint64_t& span_id, bool& sampled,
+                         std::string& encoded_baggage) {
+  return ParseCompactCarrierImpl(data, trace_id, span_id, sampled,
+                                 encoded_baggage);
+}
+}  // namespace lightstep
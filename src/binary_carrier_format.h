@@ -0,0 +1,83 @@
+#pragma once
+
+#include <opentracing/string_view.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include "encoded_baggage.h"
+
+namespace lightstep {
+// Functions for reading and writing the wire format of the BinaryCarrier
+// protobuf message (see lightstep_carrier.proto) without going through the
+// generated protobuf classes.
+
+// The serialized size of a BinaryCarrier without baggage is at most this many
+// bytes.
+const size_t MaxBinaryCarrierSizeWithoutBaggage = 22;
+
+// Returns the number of bytes needed to serialize a BinaryCarrier with the
+// given span context.
+size_t ComputeBinaryCarrierSize(
+    uint64_t trace_id, uint64_t span_id, bool sampled,
+    const BaggageRef& baggage) noexcept;
+
+// Serializes a BinaryCarrier into `data`, which must hold at least
+// ComputeBinaryCarrierSize bytes. Returns the number of bytes written. The
+// output is identical to what BinaryCarrier::SerializeToString produces
+// (baggage is written in the map's iteration order).
+size_t SerializeBinaryCarrier(
+    uint64_t trace_id, uint64_t span_id, bool sampled,
+    const BaggageRef& baggage, char* data) noexcept;
+
+// Parses a serialized BinaryCarrier. Fields are handled the way protobuf
+// would: unknown fields are skipped and repeated scalar fields take the last
+// value. Returns false if `data` isn't a valid BinaryCarrier.
+bool ParseBinaryCarrier(opentracing::string_view data, uint64_t& trace_id,
+                        uint64_t& span_id, bool& sampled,
+                        std::unordered_map<std::string, std::string>& baggage);
+
+// Parses a serialized BinaryCarrier, appending its baggage to
+// `encoded_baggage` rather than decoding it into a map.
+bool ParseBinaryCarrier(opentracing::string_view data, uint64_t& trace_id,
+                        uint64_t& span_id, bool& sampled,
+                        std::string& encoded_baggage);
+
+// The compact carrier is an alternative to BinaryCarrier that avoids the
+// nested message and per-field tags. It's laid out as
+//
+//    CompactCarrierVersion
+//    trace_id (8 bytes, little-endian)
+//    span_id (8 bytes, little-endian)
+//    flags (1 byte, bit 0 is sampled)
+//    repeated {key length (varint), key, value length (varint), value}
+//
+// CompactCarrierVersion would be a tag for field 0 in protobuf, so a compact
+// carrier can never be mistaken for a BinaryCarrier.
+const char CompactCarrierVersion = 0x07;
+
+const size_t MaxCompactCarrierSizeWithoutBaggage = 18;
+
+// Returns the number of bytes needed to serialize a compact carrier with the
+// given baggage.
+size_t ComputeCompactCarrierSize(
+    const BaggageRef& baggage) noexcept;
+
+// Serializes a compact carrier into `data`, which must hold at least
+// ComputeCompactCarrierSize bytes. Returns the number of bytes written.
+size_t SerializeCompactCarrier(
+    uint64_t trace_id, uint64_t span_id, bool sampled,
+    const BaggageRef& baggage, char* data) noexcept;
+
+// Parses a compact carrier. Returns false if `data` isn't a valid compact
+// carrier.
+bool ParseCompactCarrier(opentracing::string_view data, uint64_t& trace_id,
+                         uint64_t& span_id, bool& sampled,
+                         std::unordered_map<std::string, std::string>& baggage);
+
+// Parses a compact carrier, appending its baggage to `encoded_baggage`
+// rather than decoding it into a map.
+bool ParseCompactCarrier(opentracing::string_view data, uint64_t& trace_id,
+                         uint64_t& span_id, bool& sampled,
+                         std::string& encoded_baggage);
+}  // namespace lightstep
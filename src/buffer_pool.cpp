@@ -0,0 +1,302 @@
+#include "buffer_pool.h"
+#include <sys/mman.h>
+#include <algorithm>
+#include <iterator>
+#include <new>
+
+namespace lightstep {
+// Every block is preceded by a header recording the node it belongs to. The
+// header is a full cache line so that blocks stay cache-line aligned.
+const size_t BlockHeaderSize = 64;
+
+// The node recorded for blocks allocated from the heap.
+const int HeapNode = -1;
+
+//------------------------------------------------------------------------------
+// GetHeader
+//------------------------------------------------------------------------------
+static int& GetHeader(void* block) noexcept {
+  return *reinterpret_cast<int*>(static_cast<char*>(block) - BlockHeaderSize);
+}
+
+//------------------------------------------------------------------------------
+// AllocateFromHeap
+//------------------------------------------------------------------------------
+static void* AllocateFromHeap(size_t size) noexcept {
+  auto data = static_cast<char*>(
+      ::operator new(BlockHeaderSize + size, std::nothrow));
+  if (data == nullptr) {
+    return nullptr;
+  }
+  auto block = static_cast<void*>(data + BlockHeaderSize);
+  GetHeader(block) = HeapNode;
+  return block;
+}
+
+//------------------------------------------------------------------------------
+// MapMemory
+//------------------------------------------------------------------------------
+static void* MapMemory(size_t size, bool use_huge_pages,
+                       bool& is_huge_page) noexcept {
+  const int protection = PROT_READ | PROT_WRITE;
+  const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  is_huge_page = false;
+#ifdef MAP_HUGETLB
+  if (use_huge_pages) {
+    auto data = ::mmap(nullptr, size, protection, flags | MAP_HUGETLB, -1, 0);
+    if (data != MAP_FAILED) {
+      is_huge_page = true;
+      return data;
+    }
+  }
+#endif
+  auto data = ::mmap(nullptr, size, protection, flags, -1, 0);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+#ifdef MADV_HUGEPAGE
+  // Fall back to transparent huge pages when none are reserved. This is only
+  // advice, so a failure is ignored.
+  if (use_huge_pages) {
+    ::madvise(data, size, MADV_HUGEPAGE);
+  }
+#endif
+  return data;
+}
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+BufferPool::BufferPool(std::unique_ptr<NumaTopology>&& topology,
+                       const BufferPoolOptions& options)
+    : topology_{std::move(topology)},
+      options_{options},
+      block_stride_{BlockHeaderSize + options.block_size},
+      nodes_{new Node[std::max(topology_->num_nodes(), 1)]} {
+  options_.slab_size = std::max(options_.slab_size, block_stride_);
+}
+
+//------------------------------------------------------------------------------
+// Destructor
+//------------------------------------------------------------------------------
+BufferPool::~BufferPool() {
+  auto num_nodes = std::max(topology_->num_nodes(), 1);
+  for (int node = 0; node < num_nodes; ++node) {
+    for (auto& slab : nodes_[node].slabs) {
+      ::munmap(slab.data, slab.size);
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// Allocate
+//------------------------------------------------------------------------------
+void* BufferPool::Allocate(size_t size) noexcept {
+  if (size > options_.block_size) {
+    num_heap_allocations_.fetch_add(1, std::memory_order_relaxed);
+    return AllocateFromHeap(size);
+  }
+  auto num_nodes = std::max(topology_->num_nodes(), 1);
+  auto local_node = topology_->current_node();
+  if (local_node < 0 || local_node >= num_nodes) {
+    local_node = 0;
+  }
+  auto result = AllocateFromNode(local_node, true);
+  if (result != nullptr) {
+    num_local_allocations_.fetch_add(1, std::memory_order_relaxed);
+    return result;
+  }
+
+  // The local node is out of slabs; prefer memory that's already mapped on
+  // another node to the heap.
+  for (int node = 0; node < num_nodes; ++node) {
+    if (node == local_node) {
+      continue;
+    }
+    result = AllocateFromNode(node, false);
+    if (result != nullptr) {
+      num_remote_allocations_.fetch_add(1, std::memory_order_relaxed);
+      return result;
+    }
+  }
+  num_heap_allocations_.fetch_add(1, std::memory_order_relaxed);
+  return AllocateFromHeap(size);
+}
+
+//------------------------------------------------------------------------------
+// Deallocate
+//------------------------------------------------------------------------------
+void BufferPool::Deallocate(void* data, size_t /*size*/) noexcept {
+  if (data == nullptr) {
+    return;
+  }
+  auto node = GetHeader(data);
+  if (node == HeapNode) {
+    ::operator delete(static_cast<char*>(data) - BlockHeaderSize);
+    return;
+  }
+  auto& node_state = nodes_[node];
+  std::lock_guard<std::mutex> lock_guard{node_state.mutex};
+  // Capacity for every block of the node's slabs is reserved when a slab is
+  // mapped, so this never allocates.
+  node_state.free_blocks.push_back(data);
+  --node_state.num_allocated_blocks;
+}
+
+//------------------------------------------------------------------------------
+// ReleaseIdleSlabs
+//------------------------------------------------------------------------------
+void BufferPool::ReleaseIdleSlabs() noexcept {
+  std::lock_guard<std::mutex> retention_lock_guard{retention_mutex_};
+  auto num_nodes = std::max(topology_->num_nodes(), 1);
+  size_t max_allocated_blocks = 0;
+  size_t num_mapped_blocks = 0;
+  auto blocks_per_slab = options_.slab_size / block_stride_;
+  for (int node = 0; node < num_nodes; ++node) {
+    auto& node_state = nodes_[node];
+    std::lock_guard<std::mutex> lock_guard{node_state.mutex};
+    max_allocated_blocks += node_state.max_allocated_blocks;
+    node_state.max_allocated_blocks = node_state.num_allocated_blocks;
+    num_mapped_blocks += node_state.slabs.size() * blocks_per_slab;
+  }
+  retention_policy_.Update(max_allocated_blocks);
+
+  // Slabs are released from the nodes in turn so that what's kept stays
+  // spread across them.
+  bool was_released = true;
+  while (was_released && retention_policy_.ShouldRelease(num_mapped_blocks)) {
+    was_released = false;
+    for (int node = 0; node < num_nodes; ++node) {
+      if (!retention_policy_.ShouldRelease(num_mapped_blocks)) {
+        break;
+      }
+      auto& node_state = nodes_[node];
+      std::lock_guard<std::mutex> lock_guard{node_state.mutex};
+      if (UnmapIdleSlab(node_state)) {
+        num_mapped_blocks -= blocks_per_slab;
+        was_released = true;
+      }
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// stats
+//------------------------------------------------------------------------------
+BufferPoolStats BufferPool::stats() const noexcept {
+  BufferPoolStats result;
+  auto num_nodes = std::max(topology_->num_nodes(), 1);
+  for (int node = 0; node < num_nodes; ++node) {
+    std::lock_guard<std::mutex> lock_guard{nodes_[node].mutex};
+    result.num_slabs += nodes_[node].slabs.size();
+  }
+  result.num_huge_page_slabs =
+      num_huge_page_slabs_.load(std::memory_order_relaxed);
+  result.num_local_allocations =
+      num_local_allocations_.load(std::memory_order_relaxed);
+  result.num_remote_allocations =
+      num_remote_allocations_.load(std::memory_order_relaxed);
+  result.num_heap_allocations =
+      num_heap_allocations_.load(std::memory_order_relaxed);
+  result.num_released_slabs =
+      num_released_slabs_.load(std::memory_order_relaxed);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// AllocateFromNode
+//------------------------------------------------------------------------------
+void* BufferPool::AllocateFromNode(int node, bool can_map_slab) noexcept {
+  auto& node_state = nodes_[node];
+  std::lock_guard<std::mutex> lock_guard{node_state.mutex};
+  if (node_state.free_blocks.empty() &&
+      !(can_map_slab && MapSlab(node, node_state))) {
+    return nullptr;
+  }
+  auto result = node_state.free_blocks.back();
+  node_state.free_blocks.pop_back();
+  node_state.max_allocated_blocks = std::max(
+      node_state.max_allocated_blocks, ++node_state.num_allocated_blocks);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// MapSlab
+//------------------------------------------------------------------------------
+bool BufferPool::MapSlab(int node, Node& node_state) noexcept try {
+  if (node_state.slabs.size() >= options_.max_slabs_per_node) {
+    return false;
+  }
+  auto num_blocks = options_.slab_size / block_stride_;
+  node_state.slabs.reserve(node_state.slabs.size() + 1);
+  node_state.free_blocks.reserve((node_state.slabs.size() + 1) * num_blocks);
+  bool is_huge_page;
+  auto data = static_cast<char*>(
+      MapMemory(options_.slab_size, options_.use_huge_pages, is_huge_page));
+  if (data == nullptr) {
+    return false;
+  }
+
+  // Set the placement before the headers are written so that the pages are
+  // faulted in on the right node.
+  topology_->BindToNode(data, options_.slab_size, node);
+  node_state.slabs.push_back(Slab{data, options_.slab_size, is_huge_page});
+  if (is_huge_page) {
+    num_huge_page_slabs_.fetch_add(1, std::memory_order_relaxed);
+  }
+  for (size_t i = 0; i < num_blocks; ++i) {
+    auto block = static_cast<void*>(data + i * block_stride_ + BlockHeaderSize);
+    GetHeader(block) = node;
+    node_state.free_blocks.push_back(block);
+  }
+  return true;
+} catch (const std::bad_alloc&) {
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// UnmapIdleSlab
+//------------------------------------------------------------------------------
+bool BufferPool::UnmapIdleSlab(Node& node_state) noexcept {
+  // Only the most recently mapped slabs are considered, so that the slabs
+  // kept are the ones mapped first.
+  auto blocks_per_slab = options_.slab_size / block_stride_;
+  for (auto slab = node_state.slabs.rbegin(); slab != node_state.slabs.rend();
+       ++slab) {
+    auto first = static_cast<char*>(slab->data);
+    auto last = first + slab->size;
+    auto is_in_slab = [&](void* block) {
+      return block >= first && block < last;
+    };
+    auto num_free_blocks = static_cast<size_t>(
+        std::count_if(node_state.free_blocks.begin(),
+                      node_state.free_blocks.end(), is_in_slab));
+    if (num_free_blocks != blocks_per_slab) {
+      continue;
+    }
+    node_state.free_blocks.erase(
+        std::remove_if(node_state.free_blocks.begin(),
+                       node_state.free_blocks.end(), is_in_slab),
+        node_state.free_blocks.end());
+    ::munmap(slab->data, slab->size);
+    if (slab->is_huge_page) {
+      num_huge_page_slabs_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    node_state.slabs.erase(std::next(slab).base());
+    num_released_slabs_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// GetReportBufferPool
+//------------------------------------------------------------------------------
+BufferPool& GetReportBufferPool() {
+  // Leaked so that reports being torn down while the process exits can still
+  // return their blocks.
+  static auto pool = new BufferPool{MakeSystemNumaTopology(),
+                                    BufferPoolOptions{}};
+  return *pool;
+}
+}  // namespace lightstep
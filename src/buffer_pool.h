@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "memory_budget.h"
+#include "numa_topology.h"
+
+namespace lightstep {
+struct BufferPoolOptions {
+  // The size of the blocks handed out by the pool.
+  size_t block_size = 64 * 1024;
+
+  // Blocks are carved out of slabs of this size, which should be a multiple
+  // of the huge page size.
+  size_t slab_size = 2 * 1024 * 1024;
+
+  // The most slabs mapped for each node.
+  size_t max_slabs_per_node = 16;
+
+  // Set `use_huge_pages` to back slabs with huge pages: MAP_HUGETLB if any
+  // are reserved, and otherwise transparent huge pages.
+  bool use_huge_pages = true;
+};
+
+// Counts how BufferPool's allocations were satisfied.
+struct BufferPoolStats {
+  // Slabs mapped, how many of them are backed by MAP_HUGETLB, and how many
+  // were unmapped again by ReleaseIdleSlabs.
+  size_t num_slabs = 0;
+  size_t num_huge_page_slabs = 0;
+  size_t num_released_slabs = 0;
+
+  // Blocks taken from the calling thread's node, taken from another node
+  // because the local node was out of slabs, or allocated from the heap
+  // because the pool was exhausted or the request larger than a block.
+  size_t num_local_allocations = 0;
+  size_t num_remote_allocations = 0;
+  size_t num_heap_allocations = 0;
+};
+
+// BufferPool hands out fixed-size blocks from slabs kept separately for each
+// NUMA node, so that a thread writes to memory on its own node. Freed blocks
+// go back to the node they came from. When a node runs out of slabs, blocks
+// are taken from other nodes and then from the heap. Slabs mapped for a burst
+// are unmapped by ReleaseIdleSlabs once they're no longer needed.
+//
+// BufferPool is thread-safe.
+class BufferPool {
+ public:
+  BufferPool(std::unique_ptr<NumaTopology>&& topology,
+             const BufferPoolOptions& options);
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool(BufferPool&&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+  BufferPool& operator=(BufferPool&&) = delete;
+
+  ~BufferPool();
+
+  // Returns a block of at least `size` bytes, or null if no memory is left.
+  void* Allocate(size_t size) noexcept;
+
+  // Frees a block returned by Allocate(`size`).
+  void Deallocate(void* data, size_t size) noexcept;
+
+  // Unmaps slabs with no allocated blocks if BufferRetentionPolicy says the
+  // pool has grown larger than needed. The policy is given the most blocks
+  // allocated at once since the last call, so this should be called
+  // periodically, e.g. once per flush.
+  void ReleaseIdleSlabs() noexcept;
+
+  size_t block_size() const noexcept { return options_.block_size; }
+
+  BufferPoolStats stats() const noexcept;
+
+ private:
+  struct Slab {
+    void* data;
+    size_t size;
+    bool is_huge_page;
+  };
+
+  struct Node {
+    mutable std::mutex mutex;
+    std::vector<void*> free_blocks;
+    std::vector<Slab> slabs;
+
+    // The blocks of the node's slabs that are allocated now, and the most
+    // that were since the last call to ReleaseIdleSlabs.
+    size_t num_allocated_blocks = 0;
+    size_t max_allocated_blocks = 0;
+  };
+
+  std::unique_ptr<NumaTopology> topology_;
+  BufferPoolOptions options_;
+  size_t block_stride_;
+  std::unique_ptr<Node[]> nodes_;
+
+  std::mutex retention_mutex_;
+  BufferRetentionPolicy retention_policy_;
+
+  std::atomic<size_t> num_huge_page_slabs_{0};
+  std::atomic<size_t> num_local_allocations_{0};
+  std::atomic<size_t> num_remote_allocations_{0};
+  std::atomic<size_t> num_heap_allocations_{0};
+  std::atomic<size_t> num_released_slabs_{0};
+
+  void* AllocateFromNode(int node, bool can_map_slab) noexcept;
+
+  bool MapSlab(int node, Node& node_state) noexcept;
+
+  bool UnmapIdleSlab(Node& node_state) noexcept;
+};
+
+// Returns the process-wide pool used to encode reports when
+// LightStepTracerOptions::use_buffer_pool is set. Only the report arena on
+// the writer and encoding threads is backed by it; span records are
+// allocated from the heap on the threads that finish them.
+BufferPool& GetReportBufferPool();
+}  // namespace lightstep
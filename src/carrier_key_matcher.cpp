@@ -0,0 +1,100 @@
+#include "carrier_key_matcher.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace lightstep {
+const int CarrierKeyMatcher::NoMatch;
+const int CarrierKeyMatcher::PrefixMatch;
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+CarrierKeyMatcher::CarrierKeyMatcher(
+    std::initializer_list<opentracing::string_view> names,
+    opentracing::string_view prefix)
+    : prefix_{MakePattern(prefix, PrefixMatch)} {
+  int index = 0;
+  for (auto name : names) {
+    patterns_.push_back(MakePattern(name, index++));
+  }
+  std::stable_sort(patterns_.begin(), patterns_.end(),
+                   [](const Pattern& lhs, const Pattern& rhs) {
+                     return lhs.length < rhs.length;
+                   });
+  for (size_t i = 0; i < patterns_.size(); ++i) {
+    auto& range = ranges_[patterns_[i].length];
+    if (range.second == 0) {
+      range.first = static_cast<uint16_t>(i);
+    }
+    ++range.second;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Match
+//------------------------------------------------------------------------------
+int CarrierKeyMatcher::Match(opentracing::string_view key,
+                             bool ignore_case) const noexcept {
+  if (key.size() <= MaxNameLength) {
+    auto range = ranges_[key.size()];
+    for (size_t i = range.first; i < range.first + range.second; ++i) {
+      if (Equals(patterns_[i], key.data(), ignore_case)) {
+        return patterns_[i].index;
+      }
+    }
+  }
+  if (key.size() > prefix_.length &&
+      Equals(prefix_, key.data(), ignore_case)) {
+    return PrefixMatch;
+  }
+  return NoMatch;
+}
+
+//------------------------------------------------------------------------------
+// MakePattern
+//------------------------------------------------------------------------------
+CarrierKeyMatcher::Pattern CarrierKeyMatcher::MakePattern(
+    opentracing::string_view name, int index) {
+  if (name.size() > MaxNameLength) {
+    throw std::length_error{"carrier key is too long"};
+  }
+  Pattern result;
+  result.length = name.size();
+  result.index = index;
+  char bytes[MaxNameLength] = {};
+  char case_masks[MaxNameLength] = {};
+  for (size_t i = 0; i < name.size(); ++i) {
+    bytes[i] = name[i];
+    if ('a' <= name[i] && name[i] <= 'z') {
+      case_masks[i] = 0x20;
+    }
+  }
+  std::memcpy(result.words.data(), bytes, sizeof(bytes));
+  std::memcpy(result.case_masks.data(), case_masks, sizeof(case_masks));
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// Equals
+//------------------------------------------------------------------------------
+// Compares the first `pattern.length` bytes of `key` against `pattern`.
+bool CarrierKeyMatcher::Equals(const Pattern& pattern, const char* key,
+                               bool ignore_case) noexcept {
+  auto length = pattern.length;
+  for (size_t i = 0; length > 0; ++i) {
+    auto n = std::min(length, sizeof(uint64_t));
+    uint64_t word = 0;
+    std::memcpy(&word, key, n);
+    if (ignore_case) {
+      word |= pattern.case_masks[i];
+    }
+    if (word != pattern.words[i]) {
+      return false;
+    }
+    key += n;
+    length -= n;
+  }
+  return true;
+}
+}  // namespace lightstep
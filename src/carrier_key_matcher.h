@@ -0,0 +1,57 @@
+#pragma once
+
+#include <opentracing/string_view.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+namespace lightstep {
+// CarrierKeyMatcher matches carrier keys against a fixed set of names and a
+// key prefix. Everything needed for a match is precomputed so that a key is
+// checked in a single pass: keys are first dispatched on their length (most
+// keys of an HTTP request are rejected there) and then compared eight bytes at
+// a time against the candidate names of that length.
+//
+// Case-insensitive matching uses ASCII-only folding, so it never depends on
+// the locale.
+class CarrierKeyMatcher {
+ public:
+  static const int NoMatch = -1;
+  static const int PrefixMatch = -2;
+
+  // `names` and `prefix` must be lowercase ASCII and no longer than
+  // MaxNameLength.
+  CarrierKeyMatcher(std::initializer_list<opentracing::string_view> names,
+                    opentracing::string_view prefix);
+
+  // Returns the index of the name that `key` matches, PrefixMatch if `key`
+  // starts with the prefix and is longer than it, or NoMatch.
+  int Match(opentracing::string_view key, bool ignore_case) const noexcept;
+
+ private:
+  static const size_t MaxNameLength = 32;
+  static const size_t MaxWords = MaxNameLength / sizeof(uint64_t);
+
+  struct Pattern {
+    size_t length;
+    int index;
+    std::array<uint64_t, MaxWords> words;
+
+    // Has 0x20 for every byte that's a letter so that or-ing it into a key
+    // folds the key's letters to lowercase.
+    std::array<uint64_t, MaxWords> case_masks;
+  };
+
+  // Candidates for each key length, in the order of `patterns_`.
+  std::array<std::pair<uint16_t, uint16_t>, MaxNameLength + 1> ranges_{};
+  std::vector<Pattern> patterns_;
+  Pattern prefix_;
+
+  static Pattern MakePattern(opentracing::string_view name, int index);
+
+  static bool Equals(const Pattern& pattern, const char* key,
+                     bool ignore_case) noexcept;
+};
+}  // namespace lightstep
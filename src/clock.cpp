@@ -0,0 +1,87 @@
+#include "clock.h"
+#include <atomic>
+#include <cstdint>
+
+namespace lightstep {
+// The system time minus the steady time, in system clock ticks, and the
+// steady time at which it was measured. Both start out zero, which forces a
+// calibration on first use.
+//
+// The pair is guarded by a sequence lock: ClockSequence is odd while a
+// calibration is writing them, and readers retry if it was odd or changed
+// while they read.
+static std::atomic<uint64_t> ClockSequence{0};
+static std::atomic<int64_t> ClockOffset{0};
+static std::atomic<int64_t> ClockCalibrationTime{0};
+
+//------------------------------------------------------------------------------
+// ReadClockCalibration
+//------------------------------------------------------------------------------
+static void ReadClockCalibration(int64_t& offset,
+                                 int64_t& calibration_time) noexcept {
+  while (true) {
+    auto sequence = ClockSequence.load(std::memory_order_acquire);
+    offset = ClockOffset.load(std::memory_order_relaxed);
+    calibration_time = ClockCalibrationTime.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if ((sequence & 1) == 0 &&
+        sequence == ClockSequence.load(std::memory_order_relaxed)) {
+      return;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// CalibrateClockOffset
+//------------------------------------------------------------------------------
+void CalibrateClockOffset() noexcept {
+  using namespace std::chrono;
+  // If another thread is already calibrating, its measurement is just as
+  // recent, so there's no need to wait for it.
+  auto sequence = ClockSequence.load(std::memory_order_relaxed);
+  if ((sequence & 1) != 0 ||
+      !ClockSequence.compare_exchange_strong(sequence, sequence + 1,
+                                             std::memory_order_relaxed)) {
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+
+  // Read the steady clock on both sides of the system clock and assume the
+  // system clock was read half way between them.
+  auto steady_start = steady_clock::now();
+  auto system_now = system_clock::now();
+  auto steady_finish = steady_clock::now();
+  auto steady_now = steady_start + (steady_finish - steady_start) / 2;
+  auto offset =
+      system_now.time_since_epoch() -
+      duration_cast<system_clock::duration>(steady_now.time_since_epoch());
+  ClockOffset.store(offset.count(), std::memory_order_relaxed);
+  ClockCalibrationTime.store(steady_now.time_since_epoch().count(),
+                             std::memory_order_relaxed);
+  ClockSequence.store(sequence + 2, std::memory_order_release);
+}
+
+//------------------------------------------------------------------------------
+// ToSystemTime
+//------------------------------------------------------------------------------
+std::chrono::system_clock::time_point ToSystemTime(
+    std::chrono::steady_clock::time_point steady_time) noexcept {
+  using namespace std::chrono;
+  int64_t offset_count, calibration_count;
+  ReadClockCalibration(offset_count, calibration_count);
+  // Conversions happen when spans are encoded, off the application's threads,
+  // and `steady_time` may be well in the past by then, so the calibration's
+  // age is measured against the current time.
+  auto calibration_time =
+      steady_clock::time_point{steady_clock::duration{calibration_count}};
+  if (calibration_count == 0 ||
+      steady_clock::now() - calibration_time > ClockCalibrationInterval) {
+    CalibrateClockOffset();
+    ReadClockCalibration(offset_count, calibration_count);
+  }
+  auto offset = system_clock::duration{offset_count};
+  return system_clock::time_point{
+      duration_cast<system_clock::duration>(steady_time.time_since_epoch()) +
+      offset};
+}
+}  // namespace lightstep
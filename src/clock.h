@@ -0,0 +1,21 @@
+#pragma once
+
+#include <chrono>
+
+namespace lightstep {
+// How often the offset between the steady and system clocks is measured
+// again, so that adjustments to the system clock are picked up.
+const std::chrono::steady_clock::duration ClockCalibrationInterval =
+    std::chrono::seconds{1};
+
+// Converts a steady clock time point to the system clock using the offset
+// between the two clocks. Only the steady clock needs to be read when a span
+// starts or logs; the conversion to wall time is left until the span is
+// encoded.
+std::chrono::system_clock::time_point ToSystemTime(
+    std::chrono::steady_clock::time_point steady_time) noexcept;
+
+// Measures the offset between the steady and system clocks now rather than
+// waiting for the next calibration.
+void CalibrateClockOffset() noexcept;
+}  // namespace lightstep
@@ -0,0 +1,80 @@
+#include "encoded_baggage.h"
+#include <cstdint>
+
+namespace lightstep {
+//------------------------------------------------------------------------------
+// AppendVarint
+//------------------------------------------------------------------------------
+static void AppendVarint(uint64_t x, std::string& s) {
+  while (x >= 0x80) {
+    s.push_back(static_cast<char>(x | 0x80));
+    x >>= 7;
+  }
+  s.push_back(static_cast<char>(x));
+}
+
+//------------------------------------------------------------------------------
+// AppendEncodedBaggageItem
+//------------------------------------------------------------------------------
+void AppendEncodedBaggageItem(opentracing::string_view key,
+                              opentracing::string_view value,
+                              std::string& encoded_baggage) {
+  AppendVarint(key.size(), encoded_baggage);
+  encoded_baggage.append(key.data(), key.size());
+  AppendVarint(value.size(), encoded_baggage);
+  encoded_baggage.append(value.data(), value.size());
+}
+
+//------------------------------------------------------------------------------
+// ReadEncodedString
+//------------------------------------------------------------------------------
+bool ReadEncodedString(const char*& data, const char* last,
+                       opentracing::string_view& s) noexcept {
+  uint64_t length = 0;
+  for (int shift = 0;; shift += 7) {
+    if (data == last || shift >= 64) {
+      return false;
+    }
+    auto byte = static_cast<uint8_t>(*data++);
+    length |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      break;
+    }
+  }
+  if (length > static_cast<uint64_t>(last - data)) {
+    return false;
+  }
+  s = opentracing::string_view{data, static_cast<size_t>(length)};
+  data += length;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// HasEncodedBaggageItem
+//------------------------------------------------------------------------------
+bool HasEncodedBaggageItem(opentracing::string_view encoded_baggage,
+                           opentracing::string_view key) noexcept {
+  bool result = false;
+  ForeachEncodedBaggageItem(
+      encoded_baggage,
+      [&](opentracing::string_view item_key, opentracing::string_view
+          /*item_value*/) {
+        result = item_key == key;
+        return !result;
+      });
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// DecodeBaggage
+//------------------------------------------------------------------------------
+bool DecodeBaggage(opentracing::string_view encoded_baggage,
+                   std::unordered_map<std::string, std::string>& baggage) {
+  return ForeachEncodedBaggageItem(
+      encoded_baggage,
+      [&baggage](opentracing::string_view key, opentracing::string_view value) {
+        baggage[key].assign(value.data(), value.size());
+        return true;
+      });
+}
+}  // namespace lightstep
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <opentracing/string_view.h>
+#include <string>
+#include <unordered_map>
+
+namespace lightstep {
+// Baggage can be kept encoded as a sequence of items, each a varint
+// length-prefixed key followed by a varint length-prefixed value (the same
+// layout the compact carrier uses). Extracted span contexts hold their
+// baggage this way so that it's only decoded into a map if it's read.
+
+// Appends an item to `encoded_baggage`.
+void AppendEncodedBaggageItem(opentracing::string_view key,
+                              opentracing::string_view value,
+                              std::string& encoded_baggage);
+
+// Reads a varint length-prefixed string starting at `data` and advances
+// `data` past it. Returns false if the input is truncated.
+bool ReadEncodedString(const char*& data, const char* last,
+                       opentracing::string_view& s) noexcept;
+
+// Calls `f` with the key and value of each item in `encoded_baggage`, in
+// order, until `f` returns false. Returns false if `encoded_baggage` is
+// malformed.
+template <class F>
+bool ForeachEncodedBaggageItem(opentracing::string_view encoded_baggage,
+                               F f) {
+  auto data = encoded_baggage.data();
+  auto last = data + encoded_baggage.size();
+  while (data != last) {
+    opentracing::string_view key, value;
+    if (!ReadEncodedString(data, last, key) ||
+        !ReadEncodedString(data, last, value)) {
+      return false;
+    }
+    if (!f(key, value)) {
+      return true;
+    }
+  }
+  return true;
+}
+
+// Returns true if `encoded_baggage` has an item with the key `key`.
+bool HasEncodedBaggageItem(opentracing::string_view encoded_baggage,
+                           opentracing::string_view key) noexcept;
+
+// Adds the items of `encoded_baggage` to `baggage`. Later items replace
+// earlier ones with the same key. Returns false if `encoded_baggage` is
+// malformed.
+bool DecodeBaggage(opentracing::string_view encoded_baggage,
+                   std::unordered_map<std::string, std::string>& baggage);
+
+// BaggageRef refers to the baggage of a span context, both the decoded items
+// and any that are still encoded.
+class BaggageRef {
+ public:
+  BaggageRef(
+      const std::unordered_map<std::string, std::string>& items) noexcept
+      : items_{items} {}
+
+  BaggageRef(const std::unordered_map<std::string, std::string>& items,
+             opentracing::string_view encoded_items) noexcept
+      : items_{items}, encoded_items_{encoded_items} {}
+
+  bool empty() const noexcept {
+    return items_.empty() && encoded_items_.empty();
+  }
+
+  // Calls `f` with the key and value of each item until `f` returns false.
+  // Returns false if `f` did.
+  template <class F>
+  bool Foreach(F f) const {
+    for (auto& item : items_) {
+      if (!f(opentracing::string_view{item.first},
+             opentracing::string_view{item.second})) {
+        return false;
+      }
+    }
+    bool was_stopped = false;
+    ForeachEncodedBaggageItem(
+        encoded_items_, [&](opentracing::string_view key,
+                            opentracing::string_view value) {
+          was_stopped = !f(key, value);
+          return !was_stopped;
+        });
+    return !was_stopped;
+  }
+
+ private:
+  const std::unordered_map<std::string, std::string>& items_;
+  opentracing::string_view encoded_items_;
+};
+}  // namespace lightstep
@@ -0,0 +1,304 @@
+#include "flight_recorder.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+namespace lightstep {
+// "LSFLTREC" read as a little-endian integer. It's kept as a number rather
+// than a string so that a copy of the magic in the binary isn't mistaken for
+// a header when scanning a core file.
+const uint64_t FlightRecorderMagic = 0x434552544c46534cULL;
+const uint32_t FlightRecorderVersion = 1;
+
+const uint32_t FlightRecorderOpen = 1;
+const uint32_t FlightRecorderFinalized = 2;
+const uint32_t FlightRecorderClosed = 3;
+
+// The smallest ring a flight recorder can be created with.
+const size_t MinFlightRecorderCapacity = 4096;
+
+// FinalizeFlightRecorders can't take a lock, so the open recorders are kept in
+// a fixed table of atomic pointers.
+const size_t MaxFlightRecorders = 8;
+static std::atomic<FlightRecorderHeader*> FlightRecorders[MaxFlightRecorders];
+
+static_assert(sizeof(FlightRecorderHeader) == 64,
+              "FlightRecorderHeader has a fixed layout");
+
+//------------------------------------------------------------------------------
+// ReadRing
+//------------------------------------------------------------------------------
+static void ReadRing(const char* ring, uint64_t capacity, uint64_t position,
+                     void* data, size_t size) noexcept {
+  auto offset = static_cast<size_t>(position % capacity);
+  auto first_size = std::min(size, static_cast<size_t>(capacity) - offset);
+  std::memcpy(data, ring + offset, first_size);
+  std::memcpy(static_cast<char*>(data) + first_size, ring, size - first_size);
+}
+
+//------------------------------------------------------------------------------
+// IsValidHeader
+//------------------------------------------------------------------------------
+static bool IsValidHeader(const FlightRecorderHeader& header,
+                          size_t available) noexcept {
+  if (header.magic != FlightRecorderMagic ||
+      header.version != FlightRecorderVersion ||
+      header.header_size != sizeof(FlightRecorderHeader) ||
+      header.capacity_check != ~header.capacity || header.capacity == 0 ||
+      header.capacity > available - sizeof(FlightRecorderHeader)) {
+    return false;
+  }
+  auto reserve_position = header.reserve_position.load();
+  auto write_position = header.write_position.load();
+  return write_position <= reserve_position &&
+         reserve_position - write_position <= header.capacity;
+}
+
+//------------------------------------------------------------------------------
+// ReadSpans
+//------------------------------------------------------------------------------
+static void ReadSpans(const FlightRecorderHeader& header, size_t max_spans,
+                      std::vector<std::string>& spans) {
+  auto ring = reinterpret_cast<const char*>(&header) + header.header_size;
+  auto capacity = header.capacity;
+  auto reserve_position = header.reserve_position.load();
+  auto position = header.write_position.load();
+
+  // Anything before `window_start` may have been overwritten.
+  auto window_start =
+      reserve_position > capacity ? reserve_position - capacity : 0;
+  const uint64_t framing_size = 2 * sizeof(uint32_t);
+  while (spans.size() < max_spans &&
+         position - window_start >= framing_size) {
+    uint32_t trailing_size;
+    ReadRing(ring, capacity, position - sizeof(uint32_t), &trailing_size,
+             sizeof(trailing_size));
+    auto record_size = trailing_size + framing_size;
+    if (record_size > position - window_start) {
+      break;
+    }
+    position -= record_size;
+    uint32_t leading_size;
+    ReadRing(ring, capacity, position, &leading_size, sizeof(leading_size));
+    if (leading_size != trailing_size) {
+      break;
+    }
+    std::string span(trailing_size, '\0');
+    ReadRing(ring, capacity, position + sizeof(uint32_t), &span[0],
+             trailing_size);
+    spans.emplace_back(std::move(span));
+  }
+  std::reverse(spans.begin(), spans.end());
+}
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+FlightRecorder::FlightRecorder(void* data, size_t size) noexcept
+    : header_{new (data) FlightRecorderHeader{}},
+      ring_{static_cast<char*>(data) + sizeof(FlightRecorderHeader)},
+      size_{size} {
+  header_->magic = FlightRecorderMagic;
+  header_->version = FlightRecorderVersion;
+  header_->header_size = sizeof(FlightRecorderHeader);
+  header_->capacity = size - sizeof(FlightRecorderHeader);
+  header_->capacity_check = ~header_->capacity;
+  header_->reserve_position.store(0, std::memory_order_relaxed);
+  header_->write_position.store(0, std::memory_order_relaxed);
+  header_->pid = static_cast<int32_t>(::getpid());
+  header_->state.store(FlightRecorderOpen, std::memory_order_release);
+  for (auto& slot : FlightRecorders) {
+    FlightRecorderHeader* expected = nullptr;
+    if (slot.compare_exchange_strong(expected, header_)) {
+      return;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// Destructor
+//------------------------------------------------------------------------------
+FlightRecorder::~FlightRecorder() {
+  for (auto& slot : FlightRecorders) {
+    auto expected = header_;
+    if (slot.compare_exchange_strong(expected, nullptr)) {
+      break;
+    }
+  }
+  uint32_t expected = FlightRecorderOpen;
+  header_->state.compare_exchange_strong(expected, FlightRecorderClosed);
+  ::munmap(static_cast<void*>(header_), size_);
+}
+
+//------------------------------------------------------------------------------
+// Record
+//------------------------------------------------------------------------------
+void FlightRecorder::Record(Logger& logger, const SpanRecord& span) noexcept
+    try {
+  // The encoded span and the buffer for spans that wrap around the end of the
+  // ring are reused so that recording a span doesn't usually allocate.
+  static thread_local collector::Span encoded_span;
+  static thread_local std::string buffer;
+  encoded_span.Clear();
+  EncodeSpanRecord(logger, span, encoded_span);
+  auto span_size = encoded_span.ByteSizeLong();
+  std::lock_guard<std::mutex> lock_guard{mutex_};
+  WriteSpan(encoded_span, span_size, buffer);
+} catch (const std::exception& e) {
+  logger.Error("Failed to write span to flight recorder: ", e.what());
+}
+
+//------------------------------------------------------------------------------
+// WriteSpan
+//------------------------------------------------------------------------------
+void FlightRecorder::WriteSpan(const collector::Span& span, size_t span_size,
+                               std::string& buffer) {
+  if (span_size > header_->capacity / 4) {
+    return;
+  }
+  auto size = static_cast<uint32_t>(span_size);
+  auto record_size = span_size + 2 * sizeof(uint32_t);
+  auto position = header_->write_position.load(std::memory_order_relaxed);
+  header_->reserve_position.store(position + record_size,
+                                  std::memory_order_release);
+  WriteRing(position, &size, sizeof(size));
+  auto span_position = position + sizeof(size);
+  auto offset = static_cast<size_t>(span_position % header_->capacity);
+  if (offset + span_size <= header_->capacity) {
+    span.SerializeWithCachedSizesToArray(
+        reinterpret_cast<uint8_t*>(ring_ + offset));
+  } else {
+    buffer.resize(span_size);
+    span.SerializeWithCachedSizesToArray(
+        reinterpret_cast<uint8_t*>(&buffer[0]));
+    WriteRing(span_position, buffer.data(), span_size);
+  }
+  WriteRing(span_position + span_size, &size, sizeof(size));
+  header_->write_position.store(position + record_size,
+                                std::memory_order_release);
+}
+
+//------------------------------------------------------------------------------
+// WriteRing
+//------------------------------------------------------------------------------
+void FlightRecorder::WriteRing(uint64_t position, const void* data,
+                               size_t size) noexcept {
+  auto capacity = header_->capacity;
+  auto offset = static_cast<size_t>(position % capacity);
+  auto first_size = std::min(size, static_cast<size_t>(capacity) - offset);
+  std::memcpy(ring_ + offset, data, first_size);
+  std::memcpy(ring_, static_cast<const char*>(data) + first_size,
+              size - first_size);
+}
+
+//------------------------------------------------------------------------------
+// MakeFlightRecorder
+//------------------------------------------------------------------------------
+std::unique_ptr<FlightRecorder> MakeFlightRecorder(
+    Logger& logger, const LightStepTracerOptions& options) {
+  if (options.flight_recorder_path.empty()) {
+    return nullptr;
+  }
+  auto& path = options.flight_recorder_path;
+  auto size = options.flight_recorder_size;
+  if (size < sizeof(FlightRecorderHeader) + MinFlightRecorderCapacity) {
+    logger.Error("flight_recorder_size must be at least ",
+                 sizeof(FlightRecorderHeader) + MinFlightRecorderCapacity);
+    return nullptr;
+  }
+  auto fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    logger.Error("Failed to open flight recorder ", path, ": ",
+                 std::strerror(errno));
+    return nullptr;
+  }
+  void* data = MAP_FAILED;
+  if (::ftruncate(fd, static_cast<off_t>(size)) == 0) {
+    data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  auto error = errno;
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    logger.Error("Failed to map flight recorder ", path, ": ",
+                 std::strerror(error));
+    return nullptr;
+  }
+  return std::unique_ptr<FlightRecorder>{new FlightRecorder{data, size}};
+}
+
+//------------------------------------------------------------------------------
+// FinalizeFlightRecorders
+//------------------------------------------------------------------------------
+void FinalizeFlightRecorders() noexcept {
+  for (auto& slot : FlightRecorders) {
+    auto header = slot.load(std::memory_order_acquire);
+    if (header != nullptr) {
+      header->state.store(FlightRecorderFinalized, std::memory_order_release);
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// ReadFlightRecorder
+//------------------------------------------------------------------------------
+opentracing::expected<FlightRecorderContents> ReadFlightRecorder(
+    const std::string& path, size_t max_spans) {
+  auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return opentracing::make_unexpected(
+        std::error_code{errno, std::generic_category()});
+  }
+  struct stat file_status;
+  void* data = MAP_FAILED;
+  size_t size = 0;
+  if (::fstat(fd, &file_status) == 0) {
+    size = static_cast<size_t>(file_status.st_size);
+    if (size >= sizeof(FlightRecorderHeader)) {
+      data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    } else {
+      errno = EINVAL;
+    }
+  }
+  auto error = errno;
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    return opentracing::make_unexpected(
+        std::error_code{error, std::generic_category()});
+  }
+
+  // A flight recorder's file starts with the header, but in a core file the
+  // mapping can be anywhere, so look for the first valid header.
+  opentracing::expected<FlightRecorderContents> result =
+      opentracing::make_unexpected(
+          std::make_error_code(std::errc::invalid_argument));
+  auto first = static_cast<const char*>(data);
+  try {
+    for (size_t offset = 0; offset + sizeof(FlightRecorderHeader) <= size;
+         offset += alignof(FlightRecorderHeader)) {
+      auto header =
+          reinterpret_cast<const FlightRecorderHeader*>(first + offset);
+      if (!IsValidHeader(*header, size - offset)) {
+        continue;
+      }
+      FlightRecorderContents contents;
+      auto state = header->state.load();
+      contents.pid = header->pid;
+      contents.finalized = state == FlightRecorderFinalized;
+      contents.closed = state == FlightRecorderClosed;
+      ReadSpans(*header, max_spans, contents.spans);
+      result = std::move(contents);
+      break;
+    }
+  } catch (const std::bad_alloc&) {
+    result = opentracing::make_unexpected(
+        std::make_error_code(std::errc::not_enough_memory));
+  }
+  ::munmap(data, size);
+  return result;
+}
+}  // namespace lightstep
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <lightstep/flight_recorder.h>
+#include <lightstep/tracer.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include "lightstep-tracer-common/collector.pb.h"
+#include "logger.h"
+#include "span_record.h"
+
+namespace lightstep {
+// FlightRecorderHeader is at the start of a flight recorder's file and is
+// followed by the ring of `capacity` bytes.
+//
+// Each span is written to the ring as its serialized size, the serialized
+// collector::Span and the size again, so that the ring can be walked backward
+// from `write_position`. Positions count every byte ever written and are
+// taken modulo `capacity`. Before a span is written, `reserve_position` is
+// advanced past it so that a reader knows which of the oldest bytes may have
+// been overwritten.
+struct FlightRecorderHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t capacity;
+  uint64_t capacity_check;
+  std::atomic<uint64_t> reserve_position;
+  std::atomic<uint64_t> write_position;
+  std::atomic<uint32_t> state;
+  int32_t pid;
+  uint64_t reserved;
+};
+
+// FlightRecorder mirrors recorded spans into a ring buffer mapped from a file
+// so that the most recent ones can be read back with ReadFlightRecorder after
+// the process crashes. Spans are written by the thread that finishes them,
+// before they're buffered for a report, so spans that hadn't been sent yet
+// when the process crashed are in the ring.
+//
+// The mapping is shared with the file, so what's written survives the
+// process without being synced: the file is the durable copy. Core files only
+// include file-backed shared mappings if bit 3 of /proc/<pid>/coredump_filter
+// is set, which it isn't by default.
+//
+// FlightRecorder is thread-safe.
+class FlightRecorder {
+ public:
+  // Creates the header at the start of the `size` bytes mapped at `data`.
+  FlightRecorder(void* data, size_t size) noexcept;
+
+  FlightRecorder(const FlightRecorder&) = delete;
+  FlightRecorder(FlightRecorder&&) = delete;
+  FlightRecorder& operator=(const FlightRecorder&) = delete;
+  FlightRecorder& operator=(FlightRecorder&&) = delete;
+
+  ~FlightRecorder();
+
+  // Encodes `span` and writes it to the ring, overwriting the oldest spans
+  // when it's full. Spans larger than a quarter of the ring are skipped.
+  void Record(Logger& logger, const SpanRecord& span) noexcept;
+
+ private:
+  std::mutex mutex_;
+  FlightRecorderHeader* header_;
+  char* ring_;
+  size_t size_;
+
+  void WriteRing(uint64_t position, const void* data, size_t size) noexcept;
+
+  // Writes `span`, whose sizes have been cached, to the ring.
+  void WriteSpan(const collector::Span& span, size_t span_size,
+                 std::string& buffer);
+};
+
+// Returns a FlightRecorder for `options.flight_recorder_path`, or null if it's
+// unset or the file can't be mapped, in which case the error is logged.
+std::unique_ptr<FlightRecorder> MakeFlightRecorder(
+    Logger& logger, const LightStepTracerOptions& options);
+}  // namespace lightstep
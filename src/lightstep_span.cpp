@@ -1,9 +1,10 @@
 #include "lightstep_span.h"
 #include <opentracing/ext/tags.h>
+#include <algorithm>
+#include "clock.h"
 #include "utility.h"
 
 using opentracing::SystemTime;
-using opentracing::SystemClock;
 using opentracing::SteadyClock;
 using opentracing::SteadyTime;
 
@@ -21,18 +22,17 @@ static bool is_sampled(const opentracing::Value& value) {
 static std::tuple<SystemTime, SteadyTime> ComputeStartTimestamps(
     const SystemTime& start_system_timestamp,
     const SteadyTime& start_steady_timestamp) {
-  // If neither the system nor steady timestamps are set, get the tme from the
-  // respective clocks; otherwise, use the set timestamp to initialize the
-  // other.
-  if (start_system_timestamp == SystemTime() &&
-      start_steady_timestamp == SteadyTime()) {
-    return std::tuple<SystemTime, SteadyTime>{SystemClock::now(),
-                                              SteadyClock::now()};
-  }
+  // If the system timestamp isn't set, only the steady timestamp is kept and
+  // the system timestamp is derived from it when the span is encoded (see
+  // ToSystemTime). Otherwise, the set system timestamp is used to initialize
+  // the steady timestamp if it's missing.
   if (start_system_timestamp == SystemTime()) {
-    return std::tuple<SystemTime, SteadyTime>{
-        opentracing::convert_time_point<SystemClock>(start_steady_timestamp),
-        start_steady_timestamp};
+    if (start_steady_timestamp == SteadyTime()) {
+      return std::tuple<SystemTime, SteadyTime>{SystemTime(),
+                                                SteadyClock::now()};
+    }
+    return std::tuple<SystemTime, SteadyTime>{SystemTime(),
+                                              start_steady_timestamp};
   }
   if (start_steady_timestamp == SteadyTime()) {
     return std::tuple<SystemTime, SteadyTime>{
@@ -50,68 +50,69 @@ static bool SetSpanReference(
     Logger& logger,
     const std::pair<opentracing::SpanReferenceType,
                     const opentracing::SpanContext*>& reference,
-    std::unordered_map<std::string, std::string>& baggage,
-    collector::Reference& collector_reference, bool& sampled) {
-  collector_reference.Clear();
-  switch (reference.first) {
-    case opentracing::SpanReferenceType::ChildOfRef:
-      collector_reference.set_relationship(collector::Reference::CHILD_OF);
-      break;
-    case opentracing::SpanReferenceType::FollowsFromRef:
-      collector_reference.set_relationship(collector::Reference::FOLLOWS_FROM);
-      break;
-  }
+    SpanRecord::Reference& span_reference, bool& sampled) {
   if (reference.second == nullptr) {
     logger.Warn("Passed in null span reference.");
     return false;
   }
-  auto referenced_context =
-      dynamic_cast<const LightStepSpanContext*>(reference.second);
+  auto referenced_context = AsLightStepSpanContext(reference.second);
   if (referenced_context == nullptr) {
     logger.Warn("Passed in span reference of unexpected type.");
     return false;
   }
-  collector_reference.mutable_span_context()->set_trace_id(
-      referenced_context->trace_id());
-  collector_reference.mutable_span_context()->set_span_id(
-      referenced_context->span_id());
+  span_reference.type = reference.first;
+  span_reference.trace_id = referenced_context->trace_id();
+  span_reference.span_id = referenced_context->span_id();
   sampled = sampled || referenced_context->sampled();
-
-  referenced_context->ForeachBaggageItem(
-      [&baggage](const std::string& key, const std::string& value) {
-        baggage[key] = value;
-        return true;
-      });
-
   return true;
 }
 
+//------------------------------------------------------------------------------
+// MakeLogRecord
+//------------------------------------------------------------------------------
+template <class Fields>
+static SpanRecord::Log MakeLogRecord(const SpanLimits& span_limits,
+                                     const SystemTime& timestamp,
+                                     const SteadyTime& steady_timestamp,
+                                     const Fields& fields,
+                                     SpanTruncationCounts& counts) {
+  SpanRecord::Log log;
+  log.timestamp = timestamp;
+  log.steady_timestamp = steady_timestamp;
+  log.fields.reserve(fields.size());
+  for (auto& field : fields) {
+    log.fields.emplace_back(ToLimitedKey(span_limits, field.first, counts),
+                            ToLimitedValue(span_limits, field.second, counts));
+  }
+  return log;
+}
+
 //------------------------------------------------------------------------------
 // Constructor
 //------------------------------------------------------------------------------
 LightStepSpan::LightStepSpan(
     std::shared_ptr<const opentracing::Tracer>&& tracer, Logger& logger,
-    Recorder& recorder, opentracing::string_view operation_name,
+    Recorder& recorder, const BaggageLimits& baggage_limits,
+    const SpanLimits& span_limits, opentracing::string_view operation_name,
     const opentracing::StartSpanOptions& options)
     : tracer_{std::move(tracer)},
       logger_{logger},
       recorder_{recorder},
-      operation_name_{operation_name} {
+      baggage_limits_{baggage_limits},
+      span_limits_{span_limits} {
   // Set the start timestamps.
   std::tie(start_timestamp_, start_steady_) = ComputeStartTimestamps(
       options.start_system_timestamp, options.start_steady_timestamp);
 
   // Set any span references.
-  std::unordered_map<std::string, std::string> baggage;
   references_.reserve(options.references.size());
-  collector::Reference collector_reference;
+  SpanRecord::Reference span_reference;
   bool sampled = false;
   for (auto& reference : options.references) {
-    if (!SetSpanReference(logger_, reference, baggage, collector_reference,
-                          sampled)) {
+    if (!SetSpanReference(logger_, reference, span_reference, sampled)) {
       continue;
     }
-    references_.push_back(collector_reference);
+    references_.push_back(span_reference);
   }
 
   // If there are any span references, sampled should be true if any of the
@@ -120,25 +121,57 @@ LightStepSpan::LightStepSpan(
     sampled = true;
   }
 
-  // Set tags.
+  // Set the operation name. The span and as much of the name as a key may
+  // hold are always counted; the rest of a longer name has to fit within the
+  // memory budget.
+  auto num_name_bytes =
+      std::min(operation_name.size(), span_limits_.max_key_length);
+  num_reserved_bytes_ = sizeof(LightStepSpan) + num_name_bytes;
+  recorder_.memory_budget().Add(MemoryCategory::open_spans,
+                                num_reserved_bytes_);
+  operation_name_.assign(operation_name.data(), num_name_bytes);
+  SetLimitedOperationName(operation_name);
+
+  // Set tags. If sampling_priority is set, it overrides whatever sampling
+  // decision was derived from the referenced spans, even if the tag itself
+  // doesn't fit.
   for (auto& tag : options.tags) {
-    tags_[tag.first] = tag.second;
+    if (tag.first == opentracing::ext::sampling_priority) {
+      sampled = is_sampled(tag.second);
+    }
+    SetLimitedTag(tag.first, tag.second);
   }
 
-  // If sampling_priority is set, it overrides whatever sampling decision was
-  // derived from the referenced spans.
-  auto sampling_priority_tag = tags_.find(opentracing::ext::sampling_priority);
-  if (sampling_priority_tag != tags_.end()) {
-    sampled = is_sampled(sampling_priority_tag->second);
+  // Set opentracing::SpanContext.
+  // ids[0] is the span id and ids[1] the trace id of a root span.
+  uint64_t ids[2];
+  if (references_.empty()) {
+    GenerateIds(ids, 2);
+  } else {
+    ids[0] = GenerateId();
+    ids[1] = references_[0].trace_id;
   }
+  span_context_ = LightStepSpanContext{
+      ids[1], ids[0], sampled, std::unordered_map<std::string, std::string>{}};
 
-  // Set opentracing::SpanContext.
-  auto trace_id = references_.empty()
-                      ? GenerateId()
-                      : references_[0].span_context().trace_id();
-  auto span_id = GenerateId();
-  span_context_ =
-      LightStepSpanContext{trace_id, span_id, sampled, std::move(baggage)};
+  // A span started from a passthrough context rewrites the same headers.
+  for (auto& reference : options.references) {
+    auto referenced_context = AsLightStepSpanContext(reference.second);
+    if (referenced_context != nullptr) {
+      span_context_.set_passthrough_headers(
+          referenced_context->passthrough_headers());
+      break;
+    }
+  }
+
+  // Carry over the baggage of the referenced span contexts. Merged baggage can
+  // exceed the limits even when each referenced context's baggage doesn't.
+  auto num_baggage_items_dropped =
+      span_context_.SetReferencedBaggage(options.references, baggage_limits_);
+  if (num_baggage_items_dropped > 0) {
+    recorder_.metrics_observer().OnBaggageItemsDropped(
+        num_baggage_items_dropped);
+  }
 }
 
 //------------------------------------------------------------------------------
@@ -159,9 +192,21 @@ void LightStepSpan::FinishWithOptions(
   if (is_finished_.exchange(true)) {
     return;
   }
+  ScopedProfile profile{recorder_.profiler(), ProfileStage::finish_span};
+
+  // Once finished, the span's memory is counted by the recorder instead.
+  {
+    std::lock_guard<std::mutex> lock_guard{mutex_};
+    recorder_.memory_budget().Release(MemoryCategory::open_spans,
+                                      num_reserved_bytes_);
+    num_reserved_bytes_ = 0;
+  }
 
   // If the span isn't sampled do nothing.
+  auto& stats_counters = recorder_.stats_counters();
+  stats_counters.OnSpanFinished();
   if (!span_context_.sampled()) {
+    stats_counters.OnSpanSampledOut();
     return;
   }
 
@@ -170,69 +215,41 @@ void LightStepSpan::FinishWithOptions(
     finish_timestamp = SteadyClock::now();
   }
 
-  collector::Span span;
-
-  // Set timing information.
-  auto duration = finish_timestamp - start_steady_;
-  span.set_duration_micros(
-      std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
-  *span.mutable_start_timestamp() = ToTimestamp(start_timestamp_);
-
-  // Set references.
-  auto references = span.mutable_references();
-  references->Reserve(static_cast<int>(references_.size()));
-  for (const auto& reference : references_) {
-    *references->Add() = reference;
-  }
+  // Only collect the span's data here; encoding it is left to the recorder
+  // so that the cost isn't paid on the application's thread.
+  SpanRecord span;
+  span.trace_id = span_context_.trace_id();
+  span.span_id = span_context_.span_id();
+  span.start_timestamp = start_timestamp_;
+  span.start_steady_timestamp = start_steady_;
+  span.duration = finish_timestamp - start_steady_;
+  span.references = std::move(references_);
 
   // Set tags, logs, and operation name.
   {
     std::lock_guard<std::mutex> lock_guard{mutex_};
-    span.set_operation_name(std::move(operation_name_));
-    auto tags = span.mutable_tags();
-    tags->Reserve(static_cast<int>(tags_.size()));
-    for (const auto& tag : tags_) {
-      try {
-        *tags->Add() = ToKeyValue(tag.first, tag.second);
-      } catch (const std::exception& e) {
-        logger_.Error(R"(Dropping tag for key ")", tag.first,
-                      R"(": )", e.what());
-      }
-    }
-    auto logs = span.mutable_logs();
-    logs->Reserve(static_cast<int>(logs_.size()) +
-                  static_cast<int>(options.log_records.size()));
-    for (auto& log : logs_) {
-      try {
-        *logs->Add() = std::move(log);
-      } catch (const std::exception& e) {
-        logger_.Error("Dropping log record: ", e.what());
-      }
-    }
-    for (auto& log_record : options.log_records) {
-      try {
-        collector::Log log;
-        *log.mutable_timestamp() = ToTimestamp(log_record.timestamp);
-        auto key_values = log.mutable_fields();
-        for (auto& field : log_record.fields) {
-          *key_values->Add() = ToKeyValue(field.first, field.second);
-        }
-        *logs->Add() = std::move(log);
-      } catch (const std::exception& e) {
-        logger_.Error("Dropping log record: ", e.what());
-      }
-    }
+    span.operation_name = std::move(operation_name_);
+    span.tags = std::move(tags_);
+    span.logs = std::move(logs_);
+  }
+  auto max_log_records =
+      span_limits_.max_logs - std::min(span_limits_.max_logs, span.logs.size());
+  auto num_log_records = std::min(options.log_records.size(), max_log_records);
+  truncation_counts_.num_dropped_logs +=
+      options.log_records.size() - num_log_records;
+  span.logs.reserve(span.logs.size() + num_log_records);
+  for (size_t i = 0; i < num_log_records; ++i) {
+    auto& log_record = options.log_records[i];
+    span.logs.emplace_back(MakeLogRecord(span_limits_, log_record.timestamp,
+                                         SteadyTime{}, log_record.fields,
+                                         truncation_counts_));
   }
+  AddTruncationTags(truncation_counts_, span.tags);
 
-  // Set the span context.
-  auto span_context = span.mutable_span_context();
-  span_context->set_trace_id(span_context_.trace_id());
-  span_context->set_span_id(span_context_.span_id());
-  auto baggage = span_context->mutable_baggage();
+  // Set baggage.
   span_context_.ForeachBaggageItem(
-      [baggage](const std::string& key, const std::string& value) {
-        using StringMap = google::protobuf::Map<std::string, std::string>;
-        baggage->insert(StringMap::value_type(key, value));
+      [&span](const std::string& key, const std::string& value) {
+        span.baggage.emplace(key, value);
         return true;
       });
 
@@ -248,32 +265,91 @@ void LightStepSpan::FinishWithOptions(
 void LightStepSpan::SetOperationName(
     opentracing::string_view name) noexcept try {
   std::lock_guard<std::mutex> lock_guard{mutex_};
-  operation_name_ = name;
+  if (is_finished_) {
+    return;
+  }
+  SetLimitedOperationName(name);
 } catch (const std::exception& e) {
   logger_.Error("SetOperationName failed: ", e.what());
 }
 
+//------------------------------------------------------------------------------
+// SetLimitedOperationName
+//------------------------------------------------------------------------------
+void LightStepSpan::SetLimitedOperationName(opentracing::string_view name) {
+  // Only the growth of the name is counted. A name that doesn't fit is cut
+  // off at the length of the one it replaces.
+  if (name.size() > operation_name_.size()) {
+    auto num_bytes = name.size() - operation_name_.size();
+    if (recorder_.memory_budget().Reserve(MemoryCategory::open_spans,
+                                          num_bytes)) {
+      num_reserved_bytes_ += num_bytes;
+    } else {
+      ++truncation_counts_.num_truncated_values;
+      name = opentracing::string_view{name.data(), operation_name_.size()};
+    }
+  }
+  operation_name_.assign(name.data(), name.size());
+}
+
 //------------------------------------------------------------------------------
 // SetTag
 //------------------------------------------------------------------------------
 void LightStepSpan::SetTag(opentracing::string_view key,
                            const opentracing::Value& value) noexcept try {
+  ScopedProfile profile{recorder_.profiler(), ProfileStage::set_tag};
   std::lock_guard<std::mutex> lock_guard{mutex_};
-  tags_[key] = value;
-
   if (key == opentracing::ext::sampling_priority) {
     span_context_.set_sampled(is_sampled(value));
   }
+  if (is_finished_) {
+    return;
+  }
+  SetLimitedTag(key, value);
 } catch (const std::exception& e) {
   logger_.Error("SetTag failed: ", e.what());
 }
 
+//------------------------------------------------------------------------------
+// SetLimitedTag
+//------------------------------------------------------------------------------
+void LightStepSpan::SetLimitedTag(opentracing::string_view key,
+                                  const opentracing::Value& value) {
+  // Check the limits before copying the value so that no more of it than
+  // fits is ever copied.
+  key = ToLimitedKey(span_limits_, key, truncation_counts_);
+  auto iter = tags_.find(key);
+  if (iter == tags_.end() && tags_.size() >= span_limits_.max_tags) {
+    ++truncation_counts_.num_dropped_tags;
+    return;
+  }
+  auto owned_value = ToLimitedValue(span_limits_, value, truncation_counts_);
+
+  // Only the growth of a replaced tag is counted.
+  auto num_bytes = EstimateEncodedSize(key, owned_value);
+  size_t num_replaced_bytes = 0;
+  if (iter != tags_.end()) {
+    num_replaced_bytes = EstimateEncodedSize(key, iter->second);
+  }
+  if (num_bytes > num_replaced_bytes) {
+    if (!recorder_.memory_budget().Reserve(MemoryCategory::open_spans,
+                                           num_bytes - num_replaced_bytes)) {
+      return;
+    }
+    num_reserved_bytes_ += num_bytes - num_replaced_bytes;
+  }
+  tags_[key] = std::move(owned_value);
+}
+
 //------------------------------------------------------------------------------
 // SetBaggageItem
 //------------------------------------------------------------------------------
 void LightStepSpan::SetBaggageItem(opentracing::string_view restricted_key,
                                    opentracing::string_view value) noexcept {
-  span_context_.set_baggage_item(restricted_key, value);
+  if (!span_context_.set_baggage_item(baggage_limits_, restricted_key,
+                                      value)) {
+    recorder_.metrics_observer().OnBaggageItemsDropped(1);
+  }
 }
 
 //------------------------------------------------------------------------------
@@ -293,14 +369,26 @@ std::string LightStepSpan::BaggageItem(
 void LightStepSpan::Log(std::initializer_list<
                         std::pair<opentracing::string_view, opentracing::Value>>
                             fields) noexcept try {
-  auto timestamp = SystemClock::now();
-  collector::Log log;
-  *log.mutable_timestamp() = ToTimestamp(timestamp);
-  auto key_values = log.mutable_fields();
-  for (const auto& field : fields) {
-    *key_values->Add() = ToKeyValue(field.first, field.second);
+  // Only the steady clock is read; the timestamp is converted to the system
+  // clock when the span is encoded.
+  auto timestamp = SteadyClock::now();
+  std::lock_guard<std::mutex> lock_guard{mutex_};
+  if (is_finished_) {
+    return;
+  }
+  if (logs_.size() >= span_limits_.max_logs) {
+    ++truncation_counts_.num_dropped_logs;
+    return;
+  }
+  auto log = MakeLogRecord(span_limits_, SystemTime{}, timestamp, fields,
+                           truncation_counts_);
+  auto num_bytes = EstimateEncodedSize(log);
+  if (!recorder_.memory_budget().Reserve(MemoryCategory::open_spans,
+                                         num_bytes)) {
+    return;
   }
   logs_.emplace_back(std::move(log));
+  num_reserved_bytes_ += num_bytes;
 } catch (const std::exception& e) {
   logger_.Error("Log failed: ", e.what());
 }
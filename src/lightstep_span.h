@@ -4,16 +4,19 @@
 #include <atomic>
 #include <mutex>
 #include <vector>
-#include "lightstep-tracer-common/collector.pb.h"
 #include "lightstep_span_context.h"
 #include "logger.h"
 #include "recorder.h"
+#include "span_limits.h"
+#include "span_record.h"
 
 namespace lightstep {
 class LightStepSpan : public opentracing::Span {
  public:
   LightStepSpan(std::shared_ptr<const opentracing::Tracer>&& tracer,
                 Logger& logger, Recorder& recorder,
+                const BaggageLimits& baggage_limits,
+                const SpanLimits& span_limits,
                 opentracing::string_view operation_name,
                 const opentracing::StartSpanOptions& options);
 
@@ -54,17 +57,32 @@ class LightStepSpan : public opentracing::Span {
   std::shared_ptr<const opentracing::Tracer> tracer_;
   Logger& logger_;
   Recorder& recorder_;
-  std::vector<collector::Reference> references_;
+  const BaggageLimits& baggage_limits_;
+  const SpanLimits& span_limits_;
+  std::vector<SpanRecord::Reference> references_;
   std::chrono::system_clock::time_point start_timestamp_;
   std::chrono::steady_clock::time_point start_steady_;
   LightStepSpanContext span_context_;
 
   std::atomic<bool> is_finished_{false};
 
-  // Mutex protects tags_, logs_, and operation_name_.
+  // Set the operation name or a tag within the span's limits and the
+  // recorder's MemoryBudget. Called with mutex_ held or from the constructor.
+  void SetLimitedOperationName(opentracing::string_view name);
+
+  void SetLimitedTag(opentracing::string_view key,
+                     const opentracing::Value& value);
+
+  // Mutex protects tags_, logs_, operation_name_, num_reserved_bytes_, and
+  // truncation_counts_.
   std::mutex mutex_;
   std::string operation_name_;
   std::unordered_map<std::string, opentracing::Value> tags_;
-  std::vector<collector::Log> logs_;
+  std::vector<SpanRecord::Log> logs_;
+
+  // The bytes counted against the recorder's MemoryBudget for this span.
+  size_t num_reserved_bytes_ = 0;
+
+  SpanTruncationCounts truncation_counts_;
 };
 }  // namespace lightstep
@@ -1,6 +1,216 @@
 #include "lightstep_span_context.h"
+#include <cstring>
+#include <new>
+#include "binary_carrier_format.h"
 
 namespace lightstep {
+// The maximum number of freed contexts kept by each thread.
+const size_t MaxPooledSpanContexts = 64;
+
+namespace {
+// Injected headers are saved in a single buffer holding the number of headers
+// followed by the size of each header's key and value and then the key and
+// value themselves.
+struct EncodedHeaderSizes {
+  uint32_t key_size;
+  uint32_t value_size;
+};
+
+// HeaderRecorder is a TextMapWriter that saves the headers set on it.
+class HeaderRecorder : public opentracing::TextMapWriter {
+ public:
+  explicit HeaderRecorder(std::string& buffer) : buffer_{buffer} {
+    buffer_.assign(sizeof(uint32_t), '\0');
+  }
+
+  opentracing::expected<void> Set(
+      opentracing::string_view key,
+      opentracing::string_view value) const override try {
+    EncodedHeaderSizes sizes{static_cast<uint32_t>(key.size()),
+                             static_cast<uint32_t>(value.size())};
+    buffer_.append(reinterpret_cast<const char*>(&sizes), sizeof(sizes));
+    buffer_.append(key.data(), key.size());
+    buffer_.append(value.data(), value.size());
+    uint32_t num_headers;
+    std::memcpy(&num_headers, &buffer_[0], sizeof(num_headers));
+    ++num_headers;
+    std::memcpy(&buffer_[0], &num_headers, sizeof(num_headers));
+    return {};
+  } catch (const std::bad_alloc&) {
+    return opentracing::make_unexpected(
+        std::make_error_code(std::errc::not_enough_memory));
+  }
+
+ private:
+  std::string& buffer_;
+};
+
+// ForeachHeader calls `f` with the key and value of each header saved in
+// `headers` by a HeaderRecorder.
+template <class F>
+void ForeachHeader(const char* headers, F f) {
+  uint32_t num_headers;
+  std::memcpy(&num_headers, headers, sizeof(num_headers));
+  headers += sizeof(num_headers);
+  for (uint32_t i = 0; i < num_headers; ++i) {
+    EncodedHeaderSizes sizes;
+    std::memcpy(&sizes, headers, sizeof(sizes));
+    headers += sizeof(sizes);
+    opentracing::string_view key{headers, sizes.key_size};
+    headers += sizes.key_size;
+    opentracing::string_view value{headers, sizes.value_size};
+    headers += sizes.value_size;
+    if (!f(key, value)) {
+      return;
+    }
+  }
+}
+
+// WriteHeaders sets the headers saved in `headers` by a HeaderRecorder on
+// `writer`.
+opentracing::expected<void> WriteHeaders(
+    const char* headers, const opentracing::TextMapWriter& writer) {
+  opentracing::expected<void> result;
+  ForeachHeader(headers, [&](opentracing::string_view key,
+                             opentracing::string_view value) {
+    result = writer.Set(key, value);
+    return static_cast<bool>(result);
+  });
+  return result;
+}
+
+// The number of fields that WriteHeaders can pass to a BatchCarrierWriter
+// without allocating.
+const size_t MaxStackCarrierFields = 16;
+
+opentracing::expected<void> WriteHeaders(const char* headers,
+                                         const BatchCarrierWriter& writer) {
+  uint32_t num_headers;
+  std::memcpy(&num_headers, headers, sizeof(num_headers));
+  CarrierField stack_fields[MaxStackCarrierFields];
+  std::vector<CarrierField> heap_fields;
+  auto fields = stack_fields;
+  if (num_headers > MaxStackCarrierFields) {
+    try {
+      heap_fields.resize(num_headers);
+    } catch (const std::bad_alloc&) {
+      return opentracing::make_unexpected(
+          std::make_error_code(std::errc::not_enough_memory));
+    }
+    fields = heap_fields.data();
+  }
+  size_t num_fields = 0;
+  size_t total_size = 0;
+  ForeachHeader(headers, [&](opentracing::string_view key,
+                             opentracing::string_view value) {
+    fields[num_fields++] = {key, value};
+    total_size += key.size() + value.size();
+    return true;
+  });
+  return writer.SetBatch(fields, num_fields, total_size);
+}
+
+// InjectUnsavedHeaders injects headers that aren't worth saving into
+// `writer`. TextMapWriters are written to directly, but a BatchCarrierWriter
+// needs every header up front.
+opentracing::expected<void> InjectUnsavedHeaders(
+    const PropagationOptions& propagation_options,
+    const opentracing::TextMapWriter& writer, uint64_t trace_id,
+    uint64_t span_id, bool sampled, const BaggageRef& baggage) {
+  return InjectSpanContext(propagation_options, writer, trace_id, span_id,
+                           sampled, baggage);
+}
+
+opentracing::expected<void> InjectUnsavedHeaders(
+    const PropagationOptions& propagation_options,
+    const BatchCarrierWriter& writer, uint64_t trace_id, uint64_t span_id,
+    bool sampled, const BaggageRef& baggage) {
+  std::string headers;
+  auto result =
+      InjectSpanContext(propagation_options, HeaderRecorder{headers}, trace_id,
+                        span_id, sampled, baggage);
+  if (!result) {
+    return result;
+  }
+  return WriteHeaders(headers.data(), writer);
+}
+
+// SpanContextPool is a bounded free list of memory blocks sized for a
+// LightStepSpanContext.
+class SpanContextPool {
+ public:
+  SpanContextPool() noexcept = default;
+
+  SpanContextPool(const SpanContextPool&) = delete;
+  SpanContextPool& operator=(const SpanContextPool&) = delete;
+
+  ~SpanContextPool() {
+    while (free_list_ != nullptr) {
+      auto next = free_list_->next;
+      ::operator delete(free_list_);
+      free_list_ = next;
+    }
+    size_ = MaxPooledSpanContexts;
+  }
+
+  void* Allocate() {
+    if (free_list_ == nullptr) {
+      return ::operator new(sizeof(LightStepSpanContext));
+    }
+    auto result = free_list_;
+    free_list_ = free_list_->next;
+    --size_;
+    return result;
+  }
+
+  void Deallocate(void* ptr) noexcept {
+    if (size_ >= MaxPooledSpanContexts) {
+      ::operator delete(ptr);
+      return;
+    }
+    free_list_ = new (ptr) Node{free_list_};
+    ++size_;
+  }
+
+ private:
+  struct Node {
+    Node* next;
+  };
+  static_assert(sizeof(Node) <= sizeof(LightStepSpanContext),
+                "a pooled block must be able to hold a Node");
+
+  Node* free_list_ = nullptr;
+  size_t size_ = 0;
+};
+
+thread_local SpanContextPool SpanContextPoolInstance;
+}  // anonymous namespace
+
+//------------------------------------------------------------------------------
+// GetHeaderEncoding
+//------------------------------------------------------------------------------
+// Returns a nonzero value that's the same for any two sets of options that
+// inject the same headers, or zero if the options can't be summarized.
+static uint64_t GetHeaderEncoding(
+    const PropagationOptions& propagation_options) noexcept {
+  const int bits_per_mode = 4;
+  const uint64_t mode_mask = (1 << bits_per_mode) - 1;
+  uint64_t result = 1;
+  result |= static_cast<uint64_t>(propagation_options.use_single_key) << 1;
+  result |= static_cast<uint64_t>(propagation_options.use_compact_single_key)
+            << 2;
+  int shift = bits_per_mode;
+  for (auto mode : propagation_options.propagation_modes) {
+    auto value = static_cast<uint64_t>(mode) + 1;
+    if (value > mode_mask || shift + bits_per_mode > 64) {
+      return 0;
+    }
+    result |= value << shift;
+    shift += bits_per_mode;
+  }
+  return result;
+}
+
 //------------------------------------------------------------------------------
 // Constructor
 //------------------------------------------------------------------------------
@@ -17,6 +227,38 @@ LightStepSpanContext::LightStepSpanContext(
       sampled_{sampled},
       baggage_{std::move(baggage)} {}
 
+LightStepSpanContext::LightStepSpanContext(
+    uint64_t trace_id, uint64_t span_id, bool sampled,
+    std::string&& encoded_baggage) noexcept
+    : trace_id_{trace_id},
+      span_id_{span_id},
+      sampled_{sampled},
+      encoded_baggage_{std::move(encoded_baggage)} {}
+
+//------------------------------------------------------------------------------
+// operator new
+//------------------------------------------------------------------------------
+void* LightStepSpanContext::operator new(size_t size) {
+  if (size != sizeof(LightStepSpanContext)) {
+    return ::operator new(size);
+  }
+  return SpanContextPoolInstance.Allocate();
+}
+
+//------------------------------------------------------------------------------
+// operator delete
+//------------------------------------------------------------------------------
+void LightStepSpanContext::operator delete(void* ptr, size_t size) noexcept {
+  if (ptr == nullptr) {
+    return;
+  }
+  if (size != sizeof(LightStepSpanContext)) {
+    ::operator delete(ptr);
+    return;
+  }
+  SpanContextPoolInstance.Deallocate(ptr);
+}
+
 //------------------------------------------------------------------------------
 // operator=
 //------------------------------------------------------------------------------
@@ -24,20 +266,193 @@ LightStepSpanContext& LightStepSpanContext::operator=(
     LightStepSpanContext&& other) noexcept {
   trace_id_ = other.trace_id_;
   span_id_ = other.span_id_;
+  passthrough_headers_ = other.passthrough_headers_;
   sampled_ = other.sampled_;
   baggage_ = std::move(other.baggage_);
+  encoded_baggage_ = std::move(other.encoded_baggage_);
+  ClearEncodedHeaders();
   return *this;
 }
 
 //------------------------------------------------------------------------------
 // set_baggage_item
 //------------------------------------------------------------------------------
-void LightStepSpanContext::set_baggage_item(
-    opentracing::string_view key, opentracing::string_view value) noexcept try {
+bool LightStepSpanContext::set_baggage_item(
+    const BaggageLimits& baggage_limits, opentracing::string_view key,
+    opentracing::string_view value) noexcept try {
   std::lock_guard<std::mutex> lock_guard{mutex_};
-  baggage_.emplace(key, value);
+  DecodeBaggage();
+  std::string key_copy = key;
+  if (baggage_.find(key_copy) != baggage_.end()) {
+    return true;
+  }
+  if (!IsBaggageItemAllowed(baggage_limits, baggage_, key, value)) {
+    return false;
+  }
+  baggage_.emplace(std::move(key_copy), value);
+  ClearEncodedHeaders();
+  return true;
 } catch (const std::exception&) {
   // Drop baggage item upon error.
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// ApplyBaggageLimits
+//------------------------------------------------------------------------------
+int LightStepSpanContext::ApplyBaggageLimits(
+    const BaggageLimits& baggage_limits) {
+  std::lock_guard<std::mutex> lock_guard{mutex_};
+  if (IsWithinBaggageLimits(baggage_limits, encoded_baggage_)) {
+    if (baggage_.empty()) {
+      return 0;
+    }
+  } else {
+    DecodeBaggage();
+  }
+  auto num_dropped = lightstep::ApplyBaggageLimits(baggage_limits, baggage_);
+  if (num_dropped > 0) {
+    ClearEncodedHeaders();
+  }
+  return num_dropped;
+}
+
+//------------------------------------------------------------------------------
+// SetReferencedBaggage
+//------------------------------------------------------------------------------
+int LightStepSpanContext::SetReferencedBaggage(
+    const std::vector<std::pair<opentracing::SpanReferenceType,
+                                const opentracing::SpanContext*>>& references,
+    const BaggageLimits& baggage_limits) {
+  const LightStepSpanContext* baggage_source = nullptr;
+  int num_baggage_sources = 0;
+  for (auto& reference : references) {
+    auto referenced_context = AsLightStepSpanContext(reference.second);
+    if (referenced_context != nullptr && referenced_context != this &&
+        referenced_context->has_baggage()) {
+      baggage_source = referenced_context;
+      ++num_baggage_sources;
+    }
+  }
+  std::lock_guard<std::mutex> lock_guard{mutex_};
+  ClearEncodedHeaders();
+  baggage_.clear();
+  encoded_baggage_.clear();
+  if (num_baggage_sources == 0) {
+    return 0;
+  }
+  if (num_baggage_sources == 1) {
+    baggage_source->AppendEncodedBaggage(encoded_baggage_);
+    if (IsWithinBaggageLimits(baggage_limits, encoded_baggage_)) {
+      return 0;
+    }
+    DecodeBaggage();
+  } else {
+    // Merging requires a map so that items repeated across the references
+    // aren't duplicated.
+    for (auto& reference : references) {
+      auto referenced_context = AsLightStepSpanContext(reference.second);
+      if (referenced_context == nullptr || referenced_context == this) {
+        continue;
+      }
+      referenced_context->ForeachBaggageItem(
+          [this](const std::string& key, const std::string& value) {
+            baggage_[key] = value;
+            return true;
+          });
+    }
+  }
+  return lightstep::ApplyBaggageLimits(baggage_limits, baggage_);
+}
+
+//------------------------------------------------------------------------------
+// has_baggage
+//------------------------------------------------------------------------------
+bool LightStepSpanContext::has_baggage() const noexcept {
+  std::lock_guard<std::mutex> lock_guard{mutex_};
+  return !baggage_.empty() || !encoded_baggage_.empty();
+}
+
+//------------------------------------------------------------------------------
+// AppendEncodedBaggage
+//------------------------------------------------------------------------------
+void LightStepSpanContext::AppendEncodedBaggage(
+    std::string& encoded_baggage) const {
+  std::lock_guard<std::mutex> lock_guard{mutex_};
+  encoded_baggage.append(encoded_baggage_);
+  for (auto& baggage_item : baggage_) {
+    AppendEncodedBaggageItem(baggage_item.first, baggage_item.second,
+                             encoded_baggage);
+  }
+}
+
+//------------------------------------------------------------------------------
+// ClearEncodedHeaders
+//------------------------------------------------------------------------------
+void LightStepSpanContext::ClearEncodedHeaders() const noexcept {
+  header_encoding_ = 0;
+  encoded_headers_.reset();
+}
+
+//------------------------------------------------------------------------------
+// DecodeBaggage
+//------------------------------------------------------------------------------
+void LightStepSpanContext::DecodeBaggage() const {
+  if (encoded_baggage_.empty()) {
+    return;
+  }
+  lightstep::DecodeBaggage(encoded_baggage_, baggage_);
+  encoded_baggage_.clear();
+}
+
+//------------------------------------------------------------------------------
+// Inject
+//------------------------------------------------------------------------------
+opentracing::expected<void> LightStepSpanContext::Inject(
+    const PropagationOptions& propagation_options,
+    const opentracing::TextMapWriter& writer) const {
+  return InjectHeaders(propagation_options, writer);
+}
+
+opentracing::expected<void> LightStepSpanContext::Inject(
+    const PropagationOptions& propagation_options,
+    const BatchCarrierWriter& writer) const {
+  return InjectHeaders(propagation_options, writer);
+}
+
+//------------------------------------------------------------------------------
+// InjectHeaders
+//------------------------------------------------------------------------------
+template <class Writer>
+opentracing::expected<void> LightStepSpanContext::InjectHeaders(
+    const PropagationOptions& propagation_options, const Writer& writer) const {
+  std::lock_guard<std::mutex> lock_guard{mutex_};
+  auto header_encoding = GetHeaderEncoding(propagation_options);
+  if (encoded_headers_ != nullptr && header_encoding == header_encoding_) {
+    return WriteHeaders(encoded_headers_.get(), writer);
+  }
+  BaggageRef baggage{baggage_, encoded_baggage_};
+
+  // Most contexts are only injected once, so the headers are only saved when
+  // a context is injected a second time with the same encoding.
+  auto is_repeated =
+      header_encoding != 0 && header_encoding == header_encoding_;
+  header_encoding_ = header_encoding;
+  if (!is_repeated) {
+    return InjectUnsavedHeaders(propagation_options, writer, trace_id_,
+                                span_id_, sampled_, baggage);
+  }
+  std::string headers;
+  auto result = InjectSpanContext(propagation_options, HeaderRecorder{headers},
+                                  trace_id_, span_id_, sampled_, baggage);
+  if (!result) {
+    return result;
+  }
+  encoded_headers_.reset(new (std::nothrow) char[headers.size()]);
+  if (encoded_headers_ != nullptr) {
+    std::memcpy(encoded_headers_.get(), headers.data(), headers.size());
+  }
+  return WriteHeaders(headers.data(), writer);
 }
 
 //------------------------------------------------------------------------------
@@ -46,6 +461,7 @@ void LightStepSpanContext::set_baggage_item(
 std::string LightStepSpanContext::baggage_item(
     opentracing::string_view key) const {
   std::lock_guard<std::mutex> lock_guard{mutex_};
+  DecodeBaggage();
   auto lookup = baggage_.find(key);
   if (lookup != baggage_.end()) {
     return lookup->second;
@@ -60,6 +476,7 @@ void LightStepSpanContext::ForeachBaggageItem(
     std::function<bool(const std::string& key, const std::string& value)> f)
     const {
   std::lock_guard<std::mutex> lock_guard{mutex_};
+  DecodeBaggage();
   for (const auto& baggage_item : baggage_) {
     if (!f(baggage_item.first, baggage_item.second)) {
       return;
@@ -80,6 +497,34 @@ bool LightStepSpanContext::sampled() const noexcept {
 //------------------------------------------------------------------------------
 void LightStepSpanContext::set_sampled(bool sampled) noexcept {
   std::lock_guard<std::mutex> lock_guard{mutex_};
+  if (sampled_ != sampled) {
+    ClearEncodedHeaders();
+  }
   sampled_ = sampled;
 }
+
+//------------------------------------------------------------------------------
+// ComputeBinaryCarrierSize
+//------------------------------------------------------------------------------
+size_t LightStepSpanContext::ComputeBinaryCarrierSize() const noexcept {
+  std::lock_guard<std::mutex> lock_guard{mutex_};
+  return lightstep::ComputeBinaryCarrierSize(
+      trace_id_, span_id_, sampled_, BaggageRef{baggage_, encoded_baggage_});
+}
+
+//------------------------------------------------------------------------------
+// SerializeBinaryCarrier
+//------------------------------------------------------------------------------
+opentracing::expected<size_t> LightStepSpanContext::SerializeBinaryCarrier(
+    char* data, size_t size) const noexcept {
+  std::lock_guard<std::mutex> lock_guard{mutex_};
+  BaggageRef baggage{baggage_, encoded_baggage_};
+  if (lightstep::ComputeBinaryCarrierSize(trace_id_, span_id_, sampled_,
+                                          baggage) > size) {
+    return opentracing::make_unexpected(
+        std::make_error_code(std::errc::no_buffer_space));
+  }
+  return lightstep::SerializeBinaryCarrier(trace_id_, span_id_, sampled_,
+                                           baggage, data);
+}
 }  // namespace lightstep
@@ -1,14 +1,19 @@
 #pragma once
 
+#include <lightstep/batch_carrier_writer.h>
 #include <opentracing/span.h>
 #include <opentracing/string_view.h>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <typeinfo>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 #include "propagation.h"
 
 namespace lightstep {
-class LightStepSpanContext : public opentracing::SpanContext {
+class LightStepSpanContext final : public opentracing::SpanContext {
  public:
   LightStepSpanContext() = default;
 
@@ -20,51 +25,183 @@ class LightStepSpanContext : public opentracing::SpanContext {
       uint64_t trace_id, uint64_t span_id, bool sampled,
       std::unordered_map<std::string, std::string>&& baggage) noexcept;
 
+  // Constructs a context whose baggage is left encoded (see
+  // encoded_baggage.h) until it's read.
+  LightStepSpanContext(uint64_t trace_id, uint64_t span_id, bool sampled,
+                       std::string&& encoded_baggage) noexcept;
+
   LightStepSpanContext(const LightStepSpanContext&) = delete;
   LightStepSpanContext(LightStepSpanContext&&) = delete;
 
   ~LightStepSpanContext() override = default;
 
+  // A context is extracted for every inbound request, so heap-allocated
+  // contexts are recycled through a small per-thread pool.
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr, size_t size) noexcept;
+
   LightStepSpanContext& operator=(LightStepSpanContext&) = delete;
   LightStepSpanContext& operator=(LightStepSpanContext&& other) noexcept;
 
-  void set_baggage_item(opentracing::string_view key,
+  // Adds a baggage item unless doing so would exceed `baggage_limits`.
+  // Returns false if the item was dropped.
+  bool set_baggage_item(const BaggageLimits& baggage_limits,
+                        opentracing::string_view key,
                         opentracing::string_view value) noexcept;
 
+  // Removes baggage items until the context is within `baggage_limits` and
+  // returns the number of items removed.
+  int ApplyBaggageLimits(const BaggageLimits& baggage_limits);
+
+  // Sets the baggage to that of the LightStep span contexts in `references`,
+  // limited by `baggage_limits`, and returns the number of items dropped.
+  // Baggage from a single referenced context is copied in encoded form, so
+  // it's not decoded if it never was.
+  int SetReferencedBaggage(
+      const std::vector<std::pair<opentracing::SpanReferenceType,
+                                  const opentracing::SpanContext*>>&
+          references,
+      const BaggageLimits& baggage_limits);
+
+  bool has_baggage() const noexcept;
+
+  // Appends the baggage to `encoded_baggage` in encoded form.
+  void AppendEncodedBaggage(std::string& encoded_baggage) const;
+
   std::string baggage_item(opentracing::string_view key) const;
 
   void ForeachBaggageItem(
       std::function<bool(const std::string& key, const std::string& value)> f)
       const override;
 
-  template <class Carrier>
   opentracing::expected<void> Inject(
-      const PropagationOptions& propagation_options, Carrier& writer) const {
+      const PropagationOptions& propagation_options,
+      std::ostream& writer) const {
     std::lock_guard<std::mutex> lock_guard{mutex_};
     return InjectSpanContext(propagation_options, writer, trace_id_, span_id_,
-                             sampled_, baggage_);
+                             sampled_, BaggageRef{baggage_, encoded_baggage_});
+  }
+
+  // The headers injected into TextMap and HTTPHeaders carriers are saved once
+  // a context is injected a second time and reused by later calls until the
+  // baggage or sampling decision changes.
+  opentracing::expected<void> Inject(
+      const PropagationOptions& propagation_options,
+      const opentracing::TextMapWriter& writer) const;
+
+  opentracing::expected<void> Inject(
+      const PropagationOptions& propagation_options,
+      const BatchCarrierWriter& writer) const;
+
+  opentracing::expected<void> Inject(
+      const PropagationOptions& propagation_options,
+      const opentracing::HTTPHeadersWriter& writer) const {
+    return Inject(propagation_options,
+                  static_cast<const opentracing::TextMapWriter&>(writer));
+  }
+
+  opentracing::expected<void> Inject(
+      const PropagationOptions& propagation_options,
+      const PassthroughWriter& writer) const {
+    std::lock_guard<std::mutex> lock_guard{mutex_};
+    return InjectPassthroughSpanContext(
+        propagation_options, writer.carrier, trace_id_, span_id_, sampled_,
+        BaggageRef{baggage_, encoded_baggage_}, passthrough_headers_);
   }
 
+  // Returns the size of the context serialized as a BinaryCarrier.
+  size_t ComputeBinaryCarrierSize() const noexcept;
+
+  // Serializes the context as a BinaryCarrier into `data`. Fails with
+  // std::errc::no_buffer_space if it needs more than `size` bytes.
+  opentracing::expected<size_t> SerializeBinaryCarrier(char* data,
+                                                       size_t size) const
+      noexcept;
+
   template <class Carrier>
   opentracing::expected<bool> Extract(
       const PropagationOptions& propagation_options, Carrier& reader) {
     std::lock_guard<std::mutex> lock_guard{mutex_};
+    ClearEncodedHeaders();
+    baggage_.clear();
+    encoded_baggage_.clear();
+    passthrough_headers_ = 0;
     return ExtractSpanContext(propagation_options, reader, trace_id_, span_id_,
-                              sampled_, baggage_);
+                              sampled_, encoded_baggage_);
+  }
+
+  opentracing::expected<bool> Extract(
+      const PropagationOptions& propagation_options,
+      const PassthroughReader& reader) {
+    std::lock_guard<std::mutex> lock_guard{mutex_};
+    ClearEncodedHeaders();
+    baggage_.clear();
+    encoded_baggage_.clear();
+    return ExtractPassthroughSpanContext(
+        propagation_options, reader.carrier, trace_id_, span_id_, sampled_,
+        encoded_baggage_, passthrough_headers_);
   }
 
   uint64_t trace_id() const noexcept { return trace_id_; }
   uint64_t span_id() const noexcept { return span_id_; }
 
+  // The span context headers found by passthrough extraction (see
+  // propagation.h). They're carried over to spans that reference the context
+  // so that InjectPassthrough rewrites the same headers.
+  uint32_t passthrough_headers() const noexcept { return passthrough_headers_; }
+  void set_passthrough_headers(uint32_t passthrough_headers) noexcept {
+    passthrough_headers_ = passthrough_headers;
+  }
+
   bool sampled() const noexcept;
   void set_sampled(bool sampled) noexcept;
 
  private:
+  // Moves any encoded baggage into `baggage_`. Must be called with `mutex_`
+  // held.
+  void DecodeBaggage() const;
+
+  // Injects into a TextMapWriter or BatchCarrierWriter, saving the headers
+  // if they're injected more than once.
+  template <class Writer>
+  opentracing::expected<void> InjectHeaders(
+      const PropagationOptions& propagation_options,
+      const Writer& writer) const;
+
+  // Discards the saved headers after the context changes. Must be called with
+  // `mutex_` held.
+  void ClearEncodedHeaders() const noexcept;
+
   uint64_t trace_id_ = 0;
   uint64_t span_id_ = 0;
+  uint32_t passthrough_headers_ = 0;
 
   mutable std::mutex mutex_;
   bool sampled_ = true;
-  std::unordered_map<std::string, std::string> baggage_;
+
+  // Baggage is held in `baggage_` once decoded and in `encoded_baggage_`
+  // before then; at most one of them is non-empty.
+  mutable std::unordered_map<std::string, std::string> baggage_;
+  mutable std::string encoded_baggage_;
+
+  // The encoding (see GetHeaderEncoding) of the last headers injected and, if
+  // they've been injected more than once, the saved headers.
+  mutable uint64_t header_encoding_ = 0;
+  mutable std::unique_ptr<char[]> encoded_headers_;
 };
+
+// Returns `span_context` as a LightStepSpanContext, or null if it's null or of
+// another type. Comparing the exact type is much cheaper than a dynamic_cast;
+// the dynamic_cast is kept as a fallback for when type_info objects aren't
+// unique, as can happen when the library is loaded more than once.
+inline const LightStepSpanContext* AsLightStepSpanContext(
+    const opentracing::SpanContext* span_context) noexcept {
+  if (span_context == nullptr) {
+    return nullptr;
+  }
+  if (typeid(*span_context) == typeid(LightStepSpanContext)) {
+    return static_cast<const LightStepSpanContext*>(span_context);
+  }
+  return dynamic_cast<const LightStepSpanContext*>(span_context);
+}
 }  // namespace lightstep
@@ -28,6 +28,22 @@ LightStepTracerFactory::MakeTracer(const char* configuration,
   options.collector_plaintext = tracer_configuration.collector_plaintext();
   options.use_single_key_propagation =
       tracer_configuration.use_single_key_propagation();
+  if (tracer_configuration.propagation_modes_size() > 0) {
+    options.propagation_modes.clear();
+    for (auto propagation_mode : tracer_configuration.propagation_modes()) {
+      switch (propagation_mode) {
+        case tracer_configuration::TracerConfiguration::B3:
+          options.propagation_modes.push_back(PropagationMode::b3);
+          break;
+        case tracer_configuration::TracerConfiguration::TRACE_CONTEXT:
+          options.propagation_modes.push_back(PropagationMode::trace_context);
+          break;
+        default:
+          options.propagation_modes.push_back(PropagationMode::lightstep);
+          break;
+      }
+    }
+  }
 
   if (tracer_configuration.max_buffered_spans() != 0) {
     options.max_buffered_spans = tracer_configuration.max_buffered_spans();
@@ -43,6 +59,58 @@ LightStepTracerFactory::MakeTracer(const char* configuration,
         std::chrono::microseconds{tracer_configuration.report_timeout()};
   }
 
+  options.span_filter.operation_names.assign(
+      tracer_configuration.filtered_operation_names().begin(),
+      tracer_configuration.filtered_operation_names().end());
+  options.span_filter.operation_name_prefixes.assign(
+      tracer_configuration.filtered_operation_name_prefixes().begin(),
+      tracer_configuration.filtered_operation_name_prefixes().end());
+  options.aggregated_operations.assign(
+      tracer_configuration.aggregated_operations().begin(),
+      tracer_configuration.aggregated_operations().end());
+  options.num_encoding_threads = tracer_configuration.num_encoding_threads();
+  options.use_buffer_pool = tracer_configuration.use_buffer_pool();
+  options.enable_profiling = tracer_configuration.enable_profiling();
+  options.flight_recorder_path = tracer_configuration.flight_recorder_path();
+  if (tracer_configuration.flight_recorder_size() != 0) {
+    options.flight_recorder_size =
+        static_cast<size_t>(tracer_configuration.flight_recorder_size());
+  }
+
+  options.use_compact_single_key_propagation =
+      tracer_configuration.use_compact_single_key_propagation();
+  if (tracer_configuration.max_baggage_items() != 0) {
+    options.max_baggage_items = tracer_configuration.max_baggage_items();
+  }
+  if (tracer_configuration.max_baggage_key_length() != 0) {
+    options.max_baggage_key_length =
+        tracer_configuration.max_baggage_key_length();
+  }
+  if (tracer_configuration.max_baggage_value_length() != 0) {
+    options.max_baggage_value_length =
+        tracer_configuration.max_baggage_value_length();
+  }
+  if (tracer_configuration.max_baggage_bytes() != 0) {
+    options.max_baggage_bytes = tracer_configuration.max_baggage_bytes();
+  }
+  options.max_memory_bytes =
+      static_cast<size_t>(tracer_configuration.max_memory_bytes());
+  if (tracer_configuration.max_tags_per_span() != 0) {
+    options.max_tags_per_span = tracer_configuration.max_tags_per_span();
+  }
+  if (tracer_configuration.max_logs_per_span() != 0) {
+    options.max_logs_per_span = tracer_configuration.max_logs_per_span();
+  }
+  if (tracer_configuration.max_tag_key_length() != 0) {
+    options.max_tag_key_length = tracer_configuration.max_tag_key_length();
+  }
+  if (tracer_configuration.max_tag_value_length() != 0) {
+    options.max_tag_value_length = tracer_configuration.max_tag_value_length();
+  }
+  if (tracer_configuration.max_tag_json_depth() != 0) {
+    options.max_tag_json_depth = tracer_configuration.max_tag_json_depth();
+  }
+
   auto result = std::shared_ptr<opentracing::Tracer>{
       MakeLightStepTracer(std::move(options))};
   if (result == nullptr) {
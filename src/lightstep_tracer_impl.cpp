@@ -1,6 +1,8 @@
 #include "lightstep_tracer_impl.h"
+#include <thread>
 #include "lightstep_span.h"
 #include "lightstep_span_context.h"
+#include "noop_span.h"
 
 namespace lightstep {
 
@@ -11,8 +13,7 @@ template <class Carrier>
 static opentracing::expected<void> InjectImpl(
     const PropagationOptions& propagation_options,
     const opentracing::SpanContext& span_context, Carrier& writer) {
-  auto lightstep_span_context =
-      dynamic_cast<const LightStepSpanContext*>(&span_context);
+  auto lightstep_span_context = AsLightStepSpanContext(&span_context);
   if (lightstep_span_context == nullptr) {
     return opentracing::make_unexpected(
         opentracing::invalid_span_context_error);
@@ -20,12 +21,27 @@ static opentracing::expected<void> InjectImpl(
   return lightstep_span_context->Inject(propagation_options, writer);
 }
 
+//------------------------------------------------------------------------------
+// ApplyExtractedBaggageLimits
+//------------------------------------------------------------------------------
+static void ApplyExtractedBaggageLimits(
+    const PropagationOptions& propagation_options, Recorder& recorder,
+    LightStepSpanContext& span_context) {
+  auto num_baggage_items_dropped =
+      span_context.ApplyBaggageLimits(propagation_options.baggage_limits);
+  if (num_baggage_items_dropped > 0) {
+    recorder.metrics_observer().OnBaggageItemsDropped(
+        num_baggage_items_dropped);
+  }
+}
+
 //------------------------------------------------------------------------------
 // ExtractImpl
 //------------------------------------------------------------------------------
 template <class Carrier>
 opentracing::expected<std::unique_ptr<opentracing::SpanContext>> ExtractImpl(
-    const PropagationOptions& propagation_options, Carrier& reader) {
+    const PropagationOptions& propagation_options, Recorder& recorder,
+    Carrier& reader) {
   LightStepSpanContext* lightstep_span_context;
   try {
     lightstep_span_context = new LightStepSpanContext{};
@@ -41,7 +57,13 @@ opentracing::expected<std::unique_ptr<opentracing::SpanContext>> ExtractImpl(
   }
   if (!*result) {
     span_context.reset();
+    return std::move(span_context);
   }
+
+  // Limits are enforced here rather than while parsing so that an oversized
+  // item is dropped the same way for every carrier format.
+  ApplyExtractedBaggageLimits(propagation_options, recorder,
+                              *lightstep_span_context);
   return std::move(span_context);
 }
 
@@ -63,14 +85,43 @@ LightStepTracerImpl::LightStepTracerImpl(
       propagation_options_{propagation_options},
       recorder_{std::move(recorder)} {}
 
+LightStepTracerImpl::LightStepTracerImpl(
+    std::shared_ptr<Logger> logger,
+    const PropagationOptions& propagation_options,
+    const SpanLimits& span_limits,
+    std::unique_ptr<Recorder>&& recorder) noexcept
+    : logger_{std::move(logger)},
+      propagation_options_{propagation_options},
+      span_limits_{span_limits},
+      recorder_{std::move(recorder)} {}
+
+//------------------------------------------------------------------------------
+// Destructor
+//------------------------------------------------------------------------------
+LightStepTracerImpl::~LightStepTracerImpl() {
+  delete span_filter_.load(std::memory_order_acquire);
+}
+
 //------------------------------------------------------------------------------
 // StartSpanWithOptions
 //------------------------------------------------------------------------------
 std::unique_ptr<opentracing::Span> LightStepTracerImpl::StartSpanWithOptions(
     opentracing::string_view operation_name,
     const opentracing::StartSpanOptions& options) const noexcept try {
-  return std::unique_ptr<opentracing::Span>{new LightStepSpan{
-      shared_from_this(), *logger_, *recorder_, operation_name, options}};
+  ScopedProfile profile{recorder_->profiler(), ProfileStage::start_span};
+  auto& stats_counters = recorder_->stats_counters();
+  stats_counters.OnSpanStarted();
+  if (span_filter_.load(std::memory_order_acquire) != nullptr &&
+      IsFiltered(operation_name, options)) {
+    stats_counters.OnSpanSampledOut();
+    return std::unique_ptr<opentracing::Span>{
+        new NoopSpan{shared_from_this(), *recorder_,
+                     propagation_options_.baggage_limits, options}};
+  }
+  return std::unique_ptr<opentracing::Span>{
+      new LightStepSpan{shared_from_this(), *logger_, *recorder_,
+                        propagation_options_.baggage_limits, span_limits_,
+                        operation_name, options}};
 } catch (const std::exception& e) {
   logger_->Error("StartSpanWithOptions failed: ", e.what());
   return nullptr;
@@ -101,18 +152,47 @@ opentracing::expected<void> LightStepTracerImpl::Inject(
 //------------------------------------------------------------------------------
 opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
 LightStepTracerImpl::Extract(std::istream& reader) const {
-  return ExtractImpl(propagation_options_, reader);
+  return ExtractImpl(propagation_options_, *recorder_, reader);
 }
 
 opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
 LightStepTracerImpl::Extract(const opentracing::TextMapReader& reader) const {
-  return ExtractImpl(propagation_options_, reader);
+  return ExtractImpl(propagation_options_, *recorder_, reader);
 }
 
 opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
 LightStepTracerImpl::Extract(
     const opentracing::HTTPHeadersReader& reader) const {
-  return ExtractImpl(propagation_options_, reader);
+  return ExtractImpl(propagation_options_, *recorder_, reader);
+}
+
+//------------------------------------------------------------------------------
+// ExtractPassthrough
+//------------------------------------------------------------------------------
+opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
+LightStepTracerImpl::ExtractPassthrough(
+    const opentracing::HTTPHeadersReader& reader) const {
+  const PassthroughReader passthrough_reader{reader};
+  return ExtractImpl(propagation_options_, *recorder_, passthrough_reader);
+}
+
+//------------------------------------------------------------------------------
+// InjectPassthrough
+//------------------------------------------------------------------------------
+opentracing::expected<void> LightStepTracerImpl::InjectPassthrough(
+    const opentracing::SpanContext& span_context,
+    const opentracing::HTTPHeadersWriter& writer) const {
+  const PassthroughWriter passthrough_writer{writer};
+  return InjectImpl(propagation_options_, span_context, passthrough_writer);
+}
+
+//------------------------------------------------------------------------------
+// InjectBatch
+//------------------------------------------------------------------------------
+opentracing::expected<void> LightStepTracerImpl::InjectBatch(
+    const opentracing::SpanContext& span_context,
+    const BatchCarrierWriter& writer) const {
+  return InjectImpl(propagation_options_, span_context, writer);
 }
 
 //------------------------------------------------------------------------------
@@ -122,6 +202,81 @@ bool LightStepTracerImpl::Flush() noexcept {
   return recorder_->FlushWithTimeout(std::chrono::hours(24));
 }
 
+//------------------------------------------------------------------------------
+// GetMemoryUsage
+//------------------------------------------------------------------------------
+MemoryUsage LightStepTracerImpl::GetMemoryUsage() const noexcept {
+  return recorder_->memory_budget().usage();
+}
+
+//------------------------------------------------------------------------------
+// ApplyBaggageLimits
+//------------------------------------------------------------------------------
+void LightStepTracerImpl::ApplyBaggageLimits(
+    LightStepSpanContext& span_context) const {
+  ApplyExtractedBaggageLimits(propagation_options_, *recorder_, span_context);
+}
+
+//------------------------------------------------------------------------------
+// GetStats
+//------------------------------------------------------------------------------
+TracerStats LightStepTracerImpl::GetStats() const noexcept {
+  return recorder_->stats_counters().snapshot();
+}
+
+//------------------------------------------------------------------------------
+// SetSpanFilter
+//------------------------------------------------------------------------------
+void LightStepTracerImpl::SetSpanFilter(SpanFilter&& span_filter) noexcept try {
+  std::unique_ptr<const SpanFilterTable> span_filter_table{
+      new SpanFilterTable{std::move(span_filter)}};
+
+  // Store a null table when nothing can be filtered so that starting a span
+  // skips the check entirely.
+  if (span_filter_table->empty()) {
+    span_filter_table.reset();
+  }
+  std::lock_guard<std::mutex> lock_guard{span_filter_mutex_};
+  if (span_filter_readers_ == nullptr) {
+    span_filter_readers_.reset(new ShardedCounters<2>{});
+  }
+  std::unique_ptr<const SpanFilterTable> replaced_table{span_filter_.exchange(
+      span_filter_table.release(), std::memory_order_seq_cst)};
+  if (replaced_table == nullptr) {
+    return;
+  }
+
+  // Flip the epoch twice, each time waiting for the readers counted under the
+  // previous parity to finish. A reader that loaded the epoch before the first
+  // flip but counted itself after the wait can only see the new table.
+  for (int i = 0; i < 2; ++i) {
+    auto epoch = span_filter_epoch_.load(std::memory_order_relaxed);
+    span_filter_epoch_.store(epoch + 1, std::memory_order_release);
+    while (span_filter_readers_->Sum(epoch & 1, std::memory_order_seq_cst) !=
+           0) {
+      std::this_thread::yield();
+    }
+  }
+} catch (const std::exception& e) {
+  logger_->Error("SetSpanFilter failed: ", e.what());
+}
+
+//------------------------------------------------------------------------------
+// IsFiltered
+//------------------------------------------------------------------------------
+bool LightStepTracerImpl::IsFiltered(
+    opentracing::string_view operation_name,
+    const opentracing::StartSpanOptions& options) const noexcept {
+  auto parity = span_filter_epoch_.load(std::memory_order_acquire) & 1;
+  span_filter_readers_->Add(parity, 1, std::memory_order_seq_cst);
+  auto span_filter = span_filter_.load(std::memory_order_seq_cst);
+  auto result = span_filter != nullptr &&
+                span_filter->IsFiltered(operation_name, options);
+  span_filter_readers_->Add(parity, static_cast<uint64_t>(-1),
+                            std::memory_order_release);
+  return result;
+}
+
 //------------------------------------------------------------------------------
 // Close
 //------------------------------------------------------------------------------
@@ -1,12 +1,21 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <typeinfo>
 #include "logger.h"
 #include "propagation.h"
 #include "recorder.h"
+#include "span_filter.h"
+#include "span_limits.h"
+#include "utility.h"
 
 namespace lightstep {
-class LightStepTracerImpl
+class LightStepSpanContext;
+
+class LightStepTracerImpl final
     : public LightStepTracer,
       public std::enable_shared_from_this<LightStepTracerImpl> {
  public:
@@ -17,6 +26,13 @@ class LightStepTracerImpl
                       const PropagationOptions& propgation_options,
                       std::unique_ptr<Recorder>&& recorder) noexcept;
 
+  LightStepTracerImpl(std::shared_ptr<Logger> logger,
+                      const PropagationOptions& propgation_options,
+                      const SpanLimits& span_limits,
+                      std::unique_ptr<Recorder>&& recorder) noexcept;
+
+  ~LightStepTracerImpl() override;
+
   std::unique_ptr<opentracing::Span> StartSpanWithOptions(
       opentracing::string_view operation_name,
       const opentracing::StartSpanOptions& options) const noexcept override;
@@ -42,13 +58,70 @@ class LightStepTracerImpl
   opentracing::expected<std::unique_ptr<opentracing::SpanContext>> Extract(
       const opentracing::HTTPHeadersReader& reader) const override;
 
+  opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
+  ExtractPassthrough(
+      const opentracing::HTTPHeadersReader& reader) const override;
+
+  opentracing::expected<void> InjectPassthrough(
+      const opentracing::SpanContext& span_context,
+      const opentracing::HTTPHeadersWriter& writer) const override;
+
+  opentracing::expected<void> InjectBatch(
+      const opentracing::SpanContext& span_context,
+      const BatchCarrierWriter& writer) const override;
+
   bool Flush() noexcept override;
 
+  MemoryUsage GetMemoryUsage() const noexcept override;
+
+  TracerStats GetStats() const noexcept override;
+
+  // Drops baggage items of `span_context` that are over the tracer's baggage
+  // limits. Used by carriers that extract span contexts outside of Extract.
+  void ApplyBaggageLimits(LightStepSpanContext& span_context) const;
+
+  void SetSpanFilter(SpanFilter&& span_filter) noexcept override;
+
   void Close() noexcept override;
 
  private:
+  // Checks the active span filter without taking any locks.
+  bool IsFiltered(opentracing::string_view operation_name,
+                  const opentracing::StartSpanOptions& options) const noexcept;
+
   std::shared_ptr<Logger> logger_;
   PropagationOptions propagation_options_;
+  SpanLimits span_limits_;
   std::unique_ptr<Recorder> recorder_;
+
+  // The active span filter is published through an atomic pointer so that
+  // checking it when a span starts takes no locks. Threads checking a table
+  // count themselves in `span_filter_readers_` under the parity of
+  // `span_filter_epoch_`; SetSpanFilter flips the epoch and waits for the
+  // readers of the old parity to drain before freeing a replaced table.
+  // `span_filter_readers_` is allocated before the first table is published.
+  std::atomic<const SpanFilterTable*> span_filter_{nullptr};
+  std::atomic<uint32_t> span_filter_epoch_{0};
+  std::unique_ptr<ShardedCounters<2>> span_filter_readers_;
+  std::mutex span_filter_mutex_;
 };
+
+// Returns `tracer` as a LightStepTracer, or null if it's of another type.
+// See AsLightStepSpanContext.
+inline const LightStepTracer* AsLightStepTracer(
+    const opentracing::Tracer& tracer) noexcept {
+  if (typeid(tracer) == typeid(LightStepTracerImpl)) {
+    return static_cast<const LightStepTracerImpl*>(&tracer);
+  }
+  return dynamic_cast<const LightStepTracer*>(&tracer);
+}
+
+// Returns `tracer` as a LightStepTracerImpl, or null if it's of another type.
+inline const LightStepTracerImpl* AsLightStepTracerImpl(
+    const opentracing::Tracer& tracer) noexcept {
+  if (typeid(tracer) == typeid(LightStepTracerImpl)) {
+    return static_cast<const LightStepTracerImpl*>(&tracer);
+  }
+  return dynamic_cast<const LightStepTracerImpl*>(&tracer);
+}
 }  // namespace lightstep
@@ -9,7 +9,11 @@ ManualRecorder::ManualRecorder(Logger& logger, LightStepTracerOptions options,
                                std::unique_ptr<AsyncTransporter>&& transporter)
     : logger_{logger},
       options_{std::move(options)},
+      memory_budget_{options_.max_memory_bytes},
+      profiler_{MakeProfiler(options_.enable_profiling)},
+      flight_recorder_{MakeFlightRecorder(logger_, options_)},
       builder_{options_.access_token, options_.tags},
+      aggregator_{options_.aggregated_operations},
       transporter_{std::move(transporter)} {
   // If no MetricsObserver was provided, use a default one that does nothing.
   if (options_.metrics_observer == nullptr) {
@@ -20,13 +24,22 @@ ManualRecorder::ManualRecorder(Logger& logger, LightStepTracerOptions options,
 //------------------------------------------------------------------------------
 // RecordSpan
 //------------------------------------------------------------------------------
-void ManualRecorder::RecordSpan(collector::Span&& span) noexcept try {
+void ManualRecorder::RecordSpan(SpanRecord&& span) noexcept try {
+  ScopedProfile profile{profiler_.get(), ProfileStage::record_span};
   if (disabled_) {
     dropped_spans_++;
-    options_.metrics_observer->OnSpansDropped(1);
+    DropSpans(SpanDropReason::disabled, 1);
     return;
   }
 
+  if (aggregator_.AggregateSpan(span)) {
+    stats_counters_.OnSpanAggregated();
+    return;
+  }
+  if (flight_recorder_ != nullptr) {
+    flight_recorder_->Record(logger_, span);
+  }
+
   auto max_buffered_spans = options_.max_buffered_spans.value();
   if (builder_.num_pending_spans() >= max_buffered_spans) {
     // If there's no report in flight, flush the recoder. We can only get
@@ -37,10 +50,17 @@ void ManualRecorder::RecordSpan(collector::Span&& span) noexcept try {
       FlushOne();
     } else {
       dropped_spans_++;
-      options_.metrics_observer->OnSpansDropped(1);
+      DropSpans(SpanDropReason::buffer_full, 1);
       return;
     }
   }
+  auto num_bytes = EstimateEncodedSize(span);
+  if (!memory_budget_.Reserve(MemoryCategory::buffered_spans, num_bytes)) {
+    dropped_spans_++;
+    DropSpans(SpanDropReason::memory_limit, 1);
+    return;
+  }
+  pending_bytes_ += num_bytes;
   builder_.AddSpan(std::move(span));
   if (builder_.num_pending_spans() >= max_buffered_spans) {
     FlushOne();
@@ -69,26 +89,84 @@ bool ManualRecorder::FlushOne() noexcept try {
   }
 
   saved_pending_spans_ = builder_.num_pending_spans();
-  if (saved_pending_spans_ == 0) {
+  options_.metrics_observer->OnBufferFill(
+      saved_pending_spans_, options_.max_buffered_spans.value());
+  if (saved_pending_spans_ == 0 && !aggregator_.has_aggregates()) {
+    retention_policy_.Update(0);
+    ReleaseExcessCapacity(retention_policy_, builder_.pending_spans(),
+                          builder_.pending());
+    ReleaseExcessCapacity(retention_policy_, active_spans_, active_request_);
     return true;
   }
   options_.metrics_observer->OnSpansSent(
       static_cast<int>(saved_pending_spans_));
+  flush_start_timestamp_ = std::chrono::steady_clock::now();
   saved_dropped_spans_ = dropped_spans_;
   builder_.set_pending_client_dropped_spans(dropped_spans_);
+  HealthMetrics health_metrics;
+  health_metrics.num_buffered_spans = saved_pending_spans_;
+  health_metrics.num_buffered_bytes = pending_bytes_;
+  health_metrics.num_memory_bytes = memory_budget_.usage().total();
+  health_metrics.num_failed_reports = num_failed_reports_;
+  health_metrics.flush_duration = last_flush_duration_;
+  health_metrics.encode_cpu_time = last_encode_cpu_time_;
+  health_metrics.sampling_rate =
+      sampling_rate_counter_.Reset(stats_counters_.snapshot());
+  builder_.set_pending_health_metrics(health_metrics);
+  if (profiler_ != nullptr) {
+    profiler_->Flush(builder_.pending_internal_metrics());
+  }
+  num_failed_reports_ = 0;
+  aggregator_.Flush(builder_.pending_internal_metrics());
   dropped_spans_ = 0;
+  active_bytes_ = pending_bytes_;
+  pending_bytes_ = 0;
+  memory_budget_.Transfer(MemoryCategory::buffered_spans,
+                          MemoryCategory::inflight_reports, active_bytes_);
   std::swap(builder_.pending(), active_request_);
+  std::swap(builder_.pending_spans(), active_spans_);
+  auto encode_start_timestamp = std::chrono::steady_clock::now();
+  auto encode_start_cpu_time = GetThreadCpuTime();
+  {
+    ScopedProfile profile{profiler_.get(), ProfileStage::encode};
+    EncodeSpanRecords(logger_, active_spans_, active_request_);
+  }
+  active_spans_.clear();
+  last_encode_cpu_time_ = GetThreadCpuTime() - encode_start_cpu_time;
+  send_start_timestamp_ = std::chrono::steady_clock::now();
+  options_.metrics_observer->OnReportEncoded(
+      send_start_timestamp_ - encode_start_timestamp,
+      active_request_.ByteSizeLong());
   ++encoding_seqno_;
-  transporter_->Send(active_request_, active_response_, *this);
+  {
+    // Only the call is timed; the report is sent asynchronously.
+    ScopedProfile profile{profiler_.get(), ProfileStage::send};
+    transporter_->Send(active_request_, active_response_, *this);
+  }
   return true;
 } catch (const std::exception& e) {
   logger_.Error("Failed to Flush: ", e.what());
-  options_.metrics_observer->OnSpansDropped(saved_pending_spans_);
+  DropSpans(SpanDropReason::internal_error, saved_pending_spans_);
   dropped_spans_ += saved_pending_spans_;
-  active_request_.Clear();
+  ++num_failed_reports_;
+  active_spans_.clear();
+  FinishReport();
   return false;
 }
 
+//------------------------------------------------------------------------------
+// FinishReport
+//------------------------------------------------------------------------------
+void ManualRecorder::FinishReport() noexcept {
+  last_flush_duration_ =
+      std::chrono::steady_clock::now() - flush_start_timestamp_;
+  active_request_.Clear();
+  memory_budget_.Release(MemoryCategory::inflight_reports, active_bytes_);
+  active_bytes_ = 0;
+  retention_policy_.Update(saved_pending_spans_);
+  ReleaseExcessCapacity(retention_policy_, active_spans_, active_request_);
+}
+
 //------------------------------------------------------------------------------
 // FlushWithTimeout
 //------------------------------------------------------------------------------
@@ -100,12 +178,25 @@ bool ManualRecorder::FlushWithTimeout(
   return FlushOne();
 }
 
+//------------------------------------------------------------------------------
+// DropSpans
+//------------------------------------------------------------------------------
+void ManualRecorder::DropSpans(SpanDropReason reason,
+                               size_t num_spans) noexcept {
+  stats_counters_.OnSpansDropped(num_spans);
+  options_.metrics_observer->OnSpansDroppedForReason(
+      reason, static_cast<int>(num_spans));
+}
+
 //------------------------------------------------------------------------------
 // OnSuccess
 //------------------------------------------------------------------------------
 void ManualRecorder::OnSuccess() noexcept {
+  stats_counters_.OnSpansSent(saved_pending_spans_);
+  options_.metrics_observer->OnReportSent(std::chrono::steady_clock::now() -
+                                          send_start_timestamp_);
   ++flushed_seqno_;
-  active_request_.Clear();
+  FinishReport();
   LogReportResponse(logger_, options_.verbose, active_response_);
   for (auto& command : active_response_.commands()) {
     if (command.disable()) {
@@ -120,10 +211,10 @@ void ManualRecorder::OnSuccess() noexcept {
 //------------------------------------------------------------------------------
 void ManualRecorder::OnFailure(std::error_code error) noexcept {
   ++flushed_seqno_;
-  active_request_.Clear();
-  options_.metrics_observer->OnSpansDropped(
-      static_cast<int>(saved_pending_spans_));
+  FinishReport();
+  DropSpans(SpanDropReason::transport_failure, saved_pending_spans_);
   dropped_spans_ += saved_dropped_spans_ + saved_pending_spans_;
+  ++num_failed_reports_;
   logger_.Error("Failed to send report: ", error.message());
 }
 }  // namespace lightstep
@@ -1,9 +1,11 @@
 #pragma once
 
 #include <lightstep/transporter.h>
+#include "flight_recorder.h"
 #include "logger.h"
 #include "recorder.h"
 #include "report_builder.h"
+#include "span_aggregator.h"
 
 namespace lightstep {
 // ManualRecorder buffers spans finished by a tracer and sends them over to
@@ -13,33 +15,75 @@ class ManualRecorder : public Recorder, private AsyncTransporter::Callback {
   ManualRecorder(Logger& logger, LightStepTracerOptions options,
                  std::unique_ptr<AsyncTransporter>&& transporter);
 
-  void RecordSpan(collector::Span&& span) noexcept override;
+  void RecordSpan(SpanRecord&& span) noexcept override;
 
   bool FlushWithTimeout(
       std::chrono::system_clock::duration timeout) noexcept override;
 
+  MetricsObserver& metrics_observer() noexcept override {
+    return *options_.metrics_observer;
+  }
+
+  MemoryBudget& memory_budget() noexcept override { return memory_budget_; }
+
+  Profiler* profiler() noexcept override { return profiler_.get(); }
+
+  TracerStatsCounters& stats_counters() noexcept override {
+    return stats_counters_;
+  }
+
  private:
   bool IsReportInProgress() const noexcept;
 
   bool FlushOne() noexcept;
 
+  // Counts `num_spans` as dropped for `reason` and tells the MetricsObserver.
+  void DropSpans(SpanDropReason reason, size_t num_spans) noexcept;
+
+  // Releases the memory of the active report once it's done.
+  void FinishReport() noexcept;
+
   void OnSuccess() noexcept override;
   void OnFailure(std::error_code error) noexcept override;
 
   Logger& logger_;
   LightStepTracerOptions options_;
+  MemoryBudget memory_budget_;
+  std::unique_ptr<Profiler> profiler_;
+  TracerStatsCounters stats_counters_;
+
+  // Mirrors recorded spans to a file; null unless configured.
+  std::unique_ptr<FlightRecorder> flight_recorder_;
 
   bool disabled_ = false;
 
   // Buffer state
   ReportBuilder builder_;
   collector::ReportRequest active_request_;
+  std::vector<SpanRecord> active_spans_;
   collector::ReportResponse active_response_;
   size_t saved_dropped_spans_ = 0;
   size_t saved_pending_spans_ = 0;
   size_t flushed_seqno_ = 0;
   size_t encoding_seqno_ = 1;
   size_t dropped_spans_ = 0;
+  size_t pending_bytes_ = 0;
+  size_t active_bytes_ = 0;
+  std::chrono::steady_clock::time_point send_start_timestamp_;
+
+  // Health of the previous flush.
+  std::chrono::steady_clock::time_point flush_start_timestamp_;
+  std::chrono::steady_clock::duration last_flush_duration_{};
+  std::chrono::nanoseconds last_encode_cpu_time_{};
+  size_t num_failed_reports_ = 0;
+  SamplingRateCounter sampling_rate_counter_;
+
+  // Decides when the buffers swapped between builder_ and active_request_
+  // are released after a burst.
+  BufferRetentionPolicy retention_policy_;
+
+  // Summarizes spans of aggregated operations.
+  SpanAggregator aggregator_;
 
   // AsyncTransporter through which to send span reports.
   std::unique_ptr<AsyncTransporter> transporter_;
@@ -0,0 +1,102 @@
+#include "memory_budget.h"
+#include <algorithm>
+
+namespace lightstep {
+const size_t BufferRetentionPolicy::min_retained_capacity;
+
+//------------------------------------------------------------------------------
+// Reserve
+//------------------------------------------------------------------------------
+bool MemoryBudget::Reserve(MemoryCategory category,
+                           size_t num_bytes) noexcept {
+  auto total_bytes =
+      total_bytes_.fetch_add(num_bytes, std::memory_order_relaxed) + num_bytes;
+  if (max_bytes_ != 0 && total_bytes > max_bytes_) {
+    total_bytes_.fetch_sub(num_bytes, std::memory_order_relaxed);
+    num_rejected_reservations_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  category_bytes(category).fetch_add(num_bytes, std::memory_order_relaxed);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Add
+//------------------------------------------------------------------------------
+void MemoryBudget::Add(MemoryCategory category, size_t num_bytes) noexcept {
+  total_bytes_.fetch_add(num_bytes, std::memory_order_relaxed);
+  category_bytes(category).fetch_add(num_bytes, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// Release
+//------------------------------------------------------------------------------
+void MemoryBudget::Release(MemoryCategory category,
+                           size_t num_bytes) noexcept {
+  category_bytes(category).fetch_sub(num_bytes, std::memory_order_relaxed);
+  total_bytes_.fetch_sub(num_bytes, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// Transfer
+//------------------------------------------------------------------------------
+void MemoryBudget::Transfer(MemoryCategory from, MemoryCategory to,
+                            size_t num_bytes) noexcept {
+  category_bytes(to).fetch_add(num_bytes, std::memory_order_relaxed);
+  category_bytes(from).fetch_sub(num_bytes, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// usage
+//------------------------------------------------------------------------------
+MemoryUsage MemoryBudget::usage() const noexcept {
+  auto load = [this](MemoryCategory category) {
+    return category_bytes_[static_cast<size_t>(category)].load(
+        std::memory_order_relaxed);
+  };
+  MemoryUsage result;
+  result.open_spans = load(MemoryCategory::open_spans);
+  result.buffered_spans = load(MemoryCategory::buffered_spans);
+  result.inflight_reports = load(MemoryCategory::inflight_reports);
+  result.max_bytes = max_bytes_;
+  result.num_rejected_reservations =
+      num_rejected_reservations_.load(std::memory_order_relaxed);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// Update
+//------------------------------------------------------------------------------
+void BufferRetentionPolicy::Update(size_t num_spans) noexcept {
+  current_high_water_ = std::max(current_high_water_, num_spans);
+  if (++num_updates_ % window_size_ == 0) {
+    previous_high_water_ = current_high_water_;
+    current_high_water_ = 0;
+  }
+}
+
+//------------------------------------------------------------------------------
+// ShouldRelease
+//------------------------------------------------------------------------------
+bool BufferRetentionPolicy::ShouldRelease(size_t capacity) const noexcept {
+  auto high_water = std::max(current_high_water_, previous_high_water_);
+  return capacity > std::max(min_retained_capacity, 2 * high_water);
+}
+
+//------------------------------------------------------------------------------
+// ReleaseExcessCapacity
+//------------------------------------------------------------------------------
+void ReleaseExcessCapacity(const BufferRetentionPolicy& policy,
+                           std::vector<SpanRecord>& spans,
+                           collector::ReportRequest& report) noexcept {
+  if (policy.ShouldRelease(spans.capacity())) {
+    std::vector<SpanRecord>{}.swap(spans);
+  }
+
+  // Clearing a report keeps its spans allocated for reuse, so it has to be
+  // replaced to free them.
+  if (policy.ShouldRelease(static_cast<size_t>(report.spans().Capacity()))) {
+    report = collector::ReportRequest{};
+  }
+}
+}  // namespace lightstep
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <lightstep/tracer.h>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include "lightstep-tracer-common/collector.pb.h"
+#include "span_record.h"
+
+namespace lightstep {
+// The kinds of memory counted by MemoryBudget. See MemoryUsage.
+enum class MemoryCategory {
+  open_spans = 0,
+  buffered_spans = 1,
+  inflight_reports = 2
+};
+
+// MemoryBudget counts the bytes used by a tracer and enforces a limit on
+// their total. Reserving and releasing bytes is lock-free.
+class MemoryBudget {
+ public:
+  // A `max_bytes` of zero tracks usage without limiting it.
+  explicit MemoryBudget(size_t max_bytes = 0) noexcept
+      : max_bytes_{max_bytes} {}
+
+  // Returns true and counts `num_bytes` against `category` if they fit within
+  // the limit; otherwise, returns false and counts nothing.
+  bool Reserve(MemoryCategory category, size_t num_bytes) noexcept;
+
+  // Counts `num_bytes` against `category` whether or not they fit. Used for
+  // memory that's already been allocated.
+  void Add(MemoryCategory category, size_t num_bytes) noexcept;
+
+  // Returns `num_bytes` previously reserved or added to `category`.
+  void Release(MemoryCategory category, size_t num_bytes) noexcept;
+
+  // Moves `num_bytes` from one category to another without changing the
+  // total.
+  void Transfer(MemoryCategory from, MemoryCategory to,
+                size_t num_bytes) noexcept;
+
+  MemoryUsage usage() const noexcept;
+
+ private:
+  const size_t max_bytes_;
+  std::atomic<size_t> total_bytes_{0};
+  std::atomic<size_t> num_rejected_reservations_{0};
+  std::array<std::atomic<size_t>, 3> category_bytes_{};
+
+  std::atomic<size_t>& category_bytes(MemoryCategory category) noexcept {
+    return category_bytes_[static_cast<size_t>(category)];
+  }
+};
+
+// BufferRetentionPolicy decides when buffers that grew to hold a burst of
+// spans should be released so that memory goes back to what the steady
+// state needs. It tracks the most spans flushed at once over the last two
+// windows of `window_size` flushes; a buffer with room for more than twice
+// that many spans is released.
+class BufferRetentionPolicy {
+ public:
+  // Buffers at most this large are always kept.
+  static const size_t min_retained_capacity = 64;
+
+  explicit BufferRetentionPolicy(size_t window_size = 16) noexcept
+      : window_size_{window_size} {}
+
+  // Records the number of spans sent by a flush.
+  void Update(size_t num_spans) noexcept;
+
+  // Returns true if a buffer with room for `capacity` spans should be
+  // released.
+  bool ShouldRelease(size_t capacity) const noexcept;
+
+ private:
+  size_t window_size_;
+  size_t num_updates_ = 0;
+  size_t current_high_water_ = 0;
+  size_t previous_high_water_ = 0;
+};
+
+// Frees the memory held by `spans` and `report` if `policy` says they've
+// grown larger than needed. Both are expected to be empty.
+void ReleaseExcessCapacity(const BufferRetentionPolicy& policy,
+                           std::vector<SpanRecord>& spans,
+                           collector::ReportRequest& report) noexcept;
+}  // namespace lightstep
@@ -0,0 +1,85 @@
+#include "noop_span.h"
+#include "utility.h"
+
+namespace lightstep {
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+NoopSpan::NoopSpan(std::shared_ptr<const opentracing::Tracer>&& tracer,
+                   Recorder& recorder, const BaggageLimits& baggage_limits,
+                   const opentracing::StartSpanOptions& options)
+    : tracer_{std::move(tracer)},
+      recorder_{recorder},
+      baggage_limits_{baggage_limits} {
+  // A filtered span is transparent: it takes on the ids and sampling decision
+  // of the first referenced span so that anything injected from it, and any
+  // child started from it, still points at a span that's reported.
+  for (auto& reference : options.references) {
+    auto referenced_context = AsLightStepSpanContext(reference.second);
+    if (referenced_context != nullptr) {
+      span_context_ = LightStepSpanContext{
+          referenced_context->trace_id(), referenced_context->span_id(),
+          referenced_context->sampled(),
+          std::unordered_map<std::string, std::string>{}};
+      span_context_.set_passthrough_headers(
+          referenced_context->passthrough_headers());
+      break;
+    }
+  }
+
+  // A filtered root span drops its whole trace.
+  if (span_context_.trace_id() == 0) {
+    uint64_t ids[2];
+    GenerateIds(ids, 2);
+    span_context_ = LightStepSpanContext{
+        ids[1], ids[0], false, std::unordered_map<std::string, std::string>{}};
+  }
+  auto num_baggage_items_dropped =
+      span_context_.SetReferencedBaggage(options.references, baggage_limits_);
+  if (num_baggage_items_dropped > 0) {
+    recorder_.metrics_observer().OnBaggageItemsDropped(
+        num_baggage_items_dropped);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Destructor
+//------------------------------------------------------------------------------
+NoopSpan::~NoopSpan() {
+  if (!is_finished_) {
+    Finish();
+  }
+}
+
+//------------------------------------------------------------------------------
+// FinishWithOptions
+//------------------------------------------------------------------------------
+void NoopSpan::FinishWithOptions(
+    const opentracing::FinishSpanOptions& /*options*/) noexcept {
+  if (is_finished_.exchange(true)) {
+    return;
+  }
+  recorder_.stats_counters().OnSpanFinished();
+}
+
+//------------------------------------------------------------------------------
+// SetBaggageItem
+//------------------------------------------------------------------------------
+void NoopSpan::SetBaggageItem(opentracing::string_view restricted_key,
+                              opentracing::string_view value) noexcept {
+  if (!span_context_.set_baggage_item(baggage_limits_, restricted_key,
+                                      value)) {
+    recorder_.metrics_observer().OnBaggageItemsDropped(1);
+  }
+}
+
+//------------------------------------------------------------------------------
+// BaggageItem
+//------------------------------------------------------------------------------
+std::string NoopSpan::BaggageItem(opentracing::string_view restricted_key) const
+    noexcept try {
+  return span_context_.baggage_item(restricted_key);
+} catch (const std::exception& /*e*/) {
+  return {};
+}
+}  // namespace lightstep
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <opentracing/span.h>
+#include <opentracing/tracer.h>
+#include <atomic>
+#include "lightstep_span_context.h"
+#include "recorder.h"
+
+namespace lightstep {
+// NoopSpan is returned in place of a LightStepSpan for spans that were
+// filtered out. It's never recorded, but it shares the span context of the
+// span it references so that it can be propagated and referenced by other
+// spans as if it weren't there. Finishing it is still counted in the
+// tracer's stats.
+class NoopSpan : public opentracing::Span {
+ public:
+  NoopSpan(std::shared_ptr<const opentracing::Tracer>&& tracer,
+           Recorder& recorder, const BaggageLimits& baggage_limits,
+           const opentracing::StartSpanOptions& options);
+
+  NoopSpan(const NoopSpan&) = delete;
+  NoopSpan(NoopSpan&&) = delete;
+  NoopSpan& operator=(const NoopSpan&) = delete;
+  NoopSpan& operator=(NoopSpan&&) = delete;
+
+  ~NoopSpan() override;
+
+  void FinishWithOptions(
+      const opentracing::FinishSpanOptions& /*options*/) noexcept override;
+
+  void SetOperationName(opentracing::string_view /*name*/) noexcept override {}
+
+  void SetTag(opentracing::string_view /*key*/,
+              const opentracing::Value& /*value*/) noexcept override {}
+
+  void SetBaggageItem(opentracing::string_view restricted_key,
+                      opentracing::string_view value) noexcept override;
+
+  std::string BaggageItem(opentracing::string_view restricted_key) const
+      noexcept override;
+
+  void Log(std::initializer_list<
+           std::pair<opentracing::string_view, opentracing::Value>>
+           /*fields*/) noexcept override {}
+
+  const opentracing::SpanContext& context() const noexcept override {
+    return span_context_;
+  }
+  const opentracing::Tracer& tracer() const noexcept override {
+    return *tracer_;
+  }
+
+ private:
+  std::shared_ptr<const opentracing::Tracer> tracer_;
+  Recorder& recorder_;
+  const BaggageLimits& baggage_limits_;
+  LightStepSpanContext span_context_;
+  std::atomic<bool> is_finished_{false};
+};
+}  // namespace lightstep
@@ -0,0 +1,85 @@
+#include "numa_topology.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+
+namespace lightstep {
+// The MPOL_PREFERRED policy of mbind(2); defined here so that the numa
+// headers aren't needed.
+const int MemoryPolicyPreferred = 1;
+
+//------------------------------------------------------------------------------
+// ReadNumNodes
+//------------------------------------------------------------------------------
+// Parses the last node of a range list such as "0-1" or "0,2".
+static int ReadNumNodes() {
+  std::ifstream in{"/sys/devices/system/node/online"};
+  std::string online;
+  if (!std::getline(in, online) || online.empty()) {
+    return 1;
+  }
+  auto last = online.find_last_of(",-");
+  auto last_node = online.substr(last == std::string::npos ? 0 : last + 1);
+  try {
+    return std::stoi(last_node) + 1;
+  } catch (const std::exception&) {
+    return 1;
+  }
+}
+
+namespace {
+class SystemNumaTopology final : public NumaTopology {
+ public:
+  SystemNumaTopology() : num_nodes_{ReadNumNodes()} {}
+
+  int num_nodes() const noexcept override { return num_nodes_; }
+
+  int current_node() const noexcept override {
+    if (num_nodes_ == 1) {
+      return 0;
+    }
+#ifdef SYS_getcpu
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 &&
+        static_cast<int>(node) < num_nodes_) {
+      return static_cast<int>(node);
+    }
+#endif
+    return 0;
+  }
+
+  bool BindToNode(void* data, size_t size, int node) const
+      noexcept override {
+    if (num_nodes_ == 1) {
+      return true;
+    }
+#ifdef SYS_mbind
+    unsigned long node_mask = 0;
+    if (node < 0 || node >= static_cast<int>(sizeof(node_mask) * 8)) {
+      return false;
+    }
+    node_mask = 1UL << node;
+    return ::syscall(SYS_mbind, data, size, MemoryPolicyPreferred,
+                     &node_mask, sizeof(node_mask) * 8, 0) == 0;
+#else
+    (void)data;
+    (void)size;
+    (void)node;
+    return false;
+#endif
+  }
+
+ private:
+  int num_nodes_;
+};
+}  // anonymous namespace
+
+//------------------------------------------------------------------------------
+// MakeSystemNumaTopology
+//------------------------------------------------------------------------------
+std::unique_ptr<NumaTopology> MakeSystemNumaTopology() {
+  return std::unique_ptr<NumaTopology>{new SystemNumaTopology{}};
+}
+}  // namespace lightstep
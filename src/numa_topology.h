@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+namespace lightstep {
+// NumaTopology describes the NUMA nodes of the machine to BufferPool. It's
+// abstract so that multi-node behavior can be tested with a simulated
+// topology on a single-node machine.
+class NumaTopology {
+ public:
+  virtual ~NumaTopology() = default;
+
+  // Returns the number of nodes, numbered from zero.
+  virtual int num_nodes() const noexcept = 0;
+
+  // Returns the node of the CPU that the calling thread is running on.
+  virtual int current_node() const noexcept = 0;
+
+  // Asks for the pages of `data` to be placed on `node` when they're first
+  // touched. Returns false if the placement couldn't be set.
+  virtual bool BindToNode(void* data, size_t size, int node) const
+      noexcept = 0;
+};
+
+// Returns the topology of the machine as reported by the kernel. If it can't
+// be determined, the machine is treated as a single node.
+std::unique_ptr<NumaTopology> MakeSystemNumaTopology();
+}  // namespace lightstep
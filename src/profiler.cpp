@@ -0,0 +1,87 @@
+#include "profiler.h"
+#include <array>
+#include <string>
+
+namespace lightstep {
+static const char* const ProfileStageNames[NumProfileStages] = {
+    "start_span", "set_tag", "finish_span", "record_span", "encode", "send"};
+
+//------------------------------------------------------------------------------
+// AddGauge
+//------------------------------------------------------------------------------
+static void AddGauge(collector::InternalMetrics& metrics,
+                     const std::string& name, uint64_t value) {
+  auto gauge = metrics.add_gauges();
+  gauge->set_name(name);
+  gauge->set_int_value(static_cast<int64_t>(value));
+}
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+Profiler::Profiler()
+    : last_flush_cycles_{ReadCycleCounter()},
+      last_flush_timestamp_{std::chrono::steady_clock::now()} {}
+
+//------------------------------------------------------------------------------
+// Flush
+//------------------------------------------------------------------------------
+void Profiler::Flush(collector::InternalMetrics& metrics) {
+  auto totals = counters_.Exchange();
+  auto cycles = totals.data();
+  auto counts = totals.data() + NumProfileStages;
+
+  auto flush_cycles = ReadCycleCounter();
+  auto flush_timestamp = std::chrono::steady_clock::now();
+  auto elapsed_cycles = flush_cycles - last_flush_cycles_;
+  auto elapsed_nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           flush_timestamp - last_flush_timestamp_)
+                           .count();
+  last_flush_cycles_ = flush_cycles;
+  last_flush_timestamp_ = flush_timestamp;
+  auto nanos_per_cycle =
+      elapsed_cycles == 0 || elapsed_nanos <= 0
+          ? 1.0
+          : static_cast<double>(elapsed_nanos) /
+                static_cast<double>(elapsed_cycles);
+
+  std::array<uint64_t, NumProfileStages> nanos{};
+  for (size_t i = 0; i < NumProfileStages; ++i) {
+    nanos[i] =
+        static_cast<uint64_t>(static_cast<double>(cycles[i]) * nanos_per_cycle);
+    auto prefix = std::string{"profile."} + ProfileStageNames[i];
+    AddGauge(metrics, prefix + ".nanos", nanos[i]);
+    AddGauge(metrics, prefix + ".count", counts[i]);
+  }
+
+  // Recording a span is part of finishing it, so it's not counted again.
+  // Sending a report mostly waits on the transporter rather than using the
+  // CPU, so it's left out too.
+  auto num_spans = counts[static_cast<size_t>(ProfileStage::finish_span)];
+  if (num_spans == 0) {
+    return;
+  }
+  uint64_t total_nanos = 0;
+  for (size_t i = 0; i < NumProfileStages; ++i) {
+    if (i != static_cast<size_t>(ProfileStage::record_span) &&
+        i != static_cast<size_t>(ProfileStage::send)) {
+      total_nanos += nanos[i];
+    }
+  }
+  AddGauge(metrics, "profile.nanos_per_span", total_nanos / num_spans);
+}
+
+//------------------------------------------------------------------------------
+// MakeProfiler
+//------------------------------------------------------------------------------
+std::unique_ptr<Profiler> MakeProfiler(bool enable_profiling) {
+#ifdef LIGHTSTEP_ENABLE_PROFILING
+  if (enable_profiling) {
+    return std::unique_ptr<Profiler>{new Profiler{}};
+  }
+#else
+  (void)enable_profiling;
+#endif
+  return nullptr;
+}
+}  // namespace lightstep
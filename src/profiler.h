@@ -0,0 +1,108 @@
+#pragma once
+
+#include <lightstep/config.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "lightstep-tracer-common/collector.pb.h"
+#include "utility.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace lightstep {
+// The stages of the tracer that are profiled. Recording a span happens
+// within finishing it.
+enum class ProfileStage {
+  start_span = 0,
+  set_tag,
+  finish_span,
+  record_span,
+  encode,
+  send
+};
+
+const size_t NumProfileStages = 6;
+
+// Returns a cheap, monotonic cycle count: the TSC on x86 and nanoseconds of
+// the steady clock elsewhere.
+inline uint64_t ReadCycleCounter() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+#endif
+}
+
+// Profiler accumulates the cycles spent in each ProfileStage. Add is
+// lock-free; the accumulators are only merged when flushed into a report.
+class Profiler {
+ public:
+  Profiler();
+
+  void Add(ProfileStage stage, uint64_t num_cycles) noexcept {
+    auto index = static_cast<size_t>(stage);
+    counters_.Add(index, num_cycles);
+    counters_.Add(NumProfileStages + index, 1);
+  }
+
+  // Adds the nanoseconds spent in, and number of calls to, each stage since
+  // the last call as gauges to `metrics`, along with the tracer's total
+  // nanoseconds per finished span, not counting sending. Cycles are converted
+  // to nanoseconds by comparing the cycle counter against the steady clock
+  // between flushes.
+  //
+  // Flush must only be called from a single thread at a time.
+  void Flush(collector::InternalMetrics& metrics);
+
+ private:
+  // The cycles spent in each stage, followed by the number of calls.
+  ShardedCounters<2 * NumProfileStages> counters_;
+  uint64_t last_flush_cycles_;
+  std::chrono::steady_clock::time_point last_flush_timestamp_;
+};
+
+// ScopedProfile adds the cycles spent in its scope to `profiler`, if it's not
+// null. When the library is built without profiling support, it does
+// nothing.
+class ScopedProfile {
+ public:
+#ifdef LIGHTSTEP_ENABLE_PROFILING
+  ScopedProfile(Profiler* profiler, ProfileStage stage) noexcept
+      : profiler_{profiler}, stage_{stage} {
+    if (profiler_ != nullptr) {
+      start_cycles_ = ReadCycleCounter();
+    }
+  }
+
+  ~ScopedProfile() {
+    if (profiler_ != nullptr) {
+      profiler_->Add(stage_, ReadCycleCounter() - start_cycles_);
+    }
+  }
+#else
+  ScopedProfile(Profiler* /*profiler*/, ProfileStage /*stage*/) noexcept {}
+#endif
+
+  ScopedProfile(const ScopedProfile&) = delete;
+  ScopedProfile(ScopedProfile&&) = delete;
+  ScopedProfile& operator=(const ScopedProfile&) = delete;
+  ScopedProfile& operator=(ScopedProfile&&) = delete;
+
+#ifdef LIGHTSTEP_ENABLE_PROFILING
+ private:
+  Profiler* profiler_;
+  ProfileStage stage_;
+  uint64_t start_cycles_ = 0;
+#endif
+};
+
+// Returns a Profiler if `enable_profiling` is set and the library was built
+// with profiling support; otherwise, returns null.
+std::unique_ptr<Profiler> MakeProfiler(bool enable_profiling);
+}  // namespace lightstep
@@ -1,14 +1,14 @@
 #include "propagation.h"
 #include <lightstep/base64/base64.h>
 #include <algorithm>
-#include <cctype>
+#include <array>
 #include <cstdint>
-#include <functional>
 #include <iomanip>
 #include <ios>
-#include <sstream>
+#include <iterator>
+#include "binary_carrier_format.h"
+#include "carrier_key_matcher.h"
 #include "in_memory_stream.h"
-#include "lightstep-tracer-common/lightstep_carrier.pb.h"
 
 namespace lightstep {
 #define PREFIX_TRACER_STATE "ot-tracer-"
@@ -23,13 +23,94 @@ const opentracing::string_view FieldNameSampled = PREFIX_TRACER_STATE "sampled";
 
 const opentracing::string_view PropagationSingleKey = "x-ot-span-context";
 
+// See https://github.com/openzipkin/b3-propagation
+const opentracing::string_view FieldNameB3TraceID = "x-b3-traceid";
+const opentracing::string_view FieldNameB3SpanID = "x-b3-spanid";
+const opentracing::string_view FieldNameB3Sampled = "x-b3-sampled";
+const opentracing::string_view FieldNameB3Flags = "x-b3-flags";
+const opentracing::string_view FieldNameB3 = "b3";
+
+// See https://www.w3.org/TR/trace-context/
+const opentracing::string_view FieldNameTraceParent = "traceparent";
+const size_t TraceParentLength = 55;
+
+const size_t HexUint64Length = 16;
+
+namespace {
+// The fields that can be extracted from a carrier. Values are collected in a
+// single pass over the carrier and decoded afterwards according to the
+// configured propagation modes.
+enum CarrierField {
+  SingleKeyField = 0,
+  TraceIdField,
+  SpanIdField,
+  SampledField,
+  B3TraceIdField,
+  B3SpanIdField,
+  B3SampledField,
+  B3FlagsField,
+  B3Field,
+  TraceParentField,
+  NumCarrierFields
+};
+
+struct CarrierFields {
+  std::array<opentracing::string_view, NumCarrierFields> values;
+  uint32_t found = 0;
+
+  bool has(CarrierField field) const { return (found & (1u << field)) != 0; }
+};
+}  // anonymous namespace
+
+// Names are listed in the order of CarrierField.
+static const CarrierKeyMatcher CarrierFieldMatcher{
+    {PropagationSingleKey, FieldNameTraceID, FieldNameSpanID, FieldNameSampled,
+     FieldNameB3TraceID, FieldNameB3SpanID, FieldNameB3Sampled,
+     FieldNameB3Flags, FieldNameB3, FieldNameTraceParent},
+    PrefixBaggage};
+
+//------------------------------------------------------------------------------
+// WriteHexUint64
+//------------------------------------------------------------------------------
+// Writes `x` as 16 lowercase hex digits.
+static void WriteHexUint64(uint64_t x, char* data) noexcept {
+  static const char HexDigits[] = "0123456789abcdef";
+  for (int i = static_cast<int>(HexUint64Length) - 1; i >= 0; --i) {
+    data[i] = HexDigits[x & 0xf];
+    x >>= 4;
+  }
+}
+
+//------------------------------------------------------------------------------
+// HexDigitValue
+//------------------------------------------------------------------------------
+static int HexDigitValue(char c) noexcept {
+  if ('0' <= c && c <= '9') {
+    return c - '0';
+  }
+  if ('a' <= c && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if ('A' <= c && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
 //------------------------------------------------------------------------------
-// Uint64ToHex
+// ParseHex
 //------------------------------------------------------------------------------
-static std::string Uint64ToHex(uint64_t u) {
-  std::ostringstream stream;
-  stream << std::setfill('0') << std::setw(16) << std::hex << u;
-  return stream.str();
+// Parses exactly `length` hex digits; returns false if any aren't valid.
+static bool ParseHex(const char* data, size_t length, uint64_t& x) noexcept {
+  x = 0;
+  for (size_t i = 0; i < length; ++i) {
+    auto digit = HexDigitValue(data[i]);
+    if (digit < 0) {
+      return false;
+    }
+    x = (x << 4) | static_cast<uint64_t>(digit);
+  }
+  return true;
 }
 
 //------------------------------------------------------------------------------
@@ -43,59 +124,124 @@ static uint64_t HexToUint64(opentracing::string_view s) {
 }
 
 //------------------------------------------------------------------------------
-// LookupKey
+// IsBaggageItemAllowed
 //------------------------------------------------------------------------------
-template <class KeyCompare>
-static opentracing::expected<opentracing::string_view> LookupKey(
-    const opentracing::TextMapReader& carrier, opentracing::string_view key,
-    KeyCompare key_compare) {
-  // First try carrier.LookupKey since that can potentially be the fastest
-  // approach.
-  auto result = carrier.LookupKey(key);
-  if (result || result.error() != opentracing::lookup_key_not_supported_error) {
-    return result;
+bool IsBaggageItemAllowed(
+    const BaggageLimits& baggage_limits,
+    const std::unordered_map<std::string, std::string>& baggage,
+    opentracing::string_view key, opentracing::string_view value) noexcept {
+  if (key.size() > baggage_limits.max_key_length ||
+      value.size() > baggage_limits.max_value_length) {
+    return false;
+  }
+  if (baggage.size() + 1 > baggage_limits.max_items) {
+    return false;
+  }
+  auto num_bytes = key.size() + value.size();
+  for (auto& baggage_item : baggage) {
+    num_bytes += baggage_item.first.size() + baggage_item.second.size();
   }
+  return num_bytes <= baggage_limits.max_bytes;
+}
 
-  // Fall back to iterating through all of the keys.
-  result = opentracing::make_unexpected(opentracing::key_not_found_error);
-  auto was_successful = carrier.ForeachKey(
-      [&](opentracing::string_view carrier_key,
-          opentracing::string_view value) -> opentracing::expected<void> {
-        if (!key_compare(carrier_key, key)) {
-          return {};
-        }
-        result = value;
+//------------------------------------------------------------------------------
+// ApplyBaggageLimits
+//------------------------------------------------------------------------------
+int ApplyBaggageLimits(const BaggageLimits& baggage_limits,
+                       std::unordered_map<std::string, std::string>& baggage) {
+  int num_dropped = 0;
+  size_t num_items = 0;
+  size_t num_bytes = 0;
+  for (auto iter = baggage.begin(); iter != baggage.end();) {
+    auto item_bytes = iter->first.size() + iter->second.size();
+    if (iter->first.size() > baggage_limits.max_key_length ||
+        iter->second.size() > baggage_limits.max_value_length ||
+        num_items + 1 > baggage_limits.max_items ||
+        num_bytes + item_bytes > baggage_limits.max_bytes) {
+      iter = baggage.erase(iter);
+      ++num_dropped;
+      continue;
+    }
+    ++num_items;
+    num_bytes += item_bytes;
+    ++iter;
+  }
+  return num_dropped;
+}
 
-        // Found key, so bail out of the loop with a success error code.
-        return opentracing::make_unexpected(std::error_code{});
+//------------------------------------------------------------------------------
+// IsWithinBaggageLimits
+//------------------------------------------------------------------------------
+bool IsWithinBaggageLimits(const BaggageLimits& baggage_limits,
+                           opentracing::string_view encoded_baggage) noexcept {
+  size_t num_items = 0;
+  size_t num_bytes = 0;
+  bool is_within_limits = true;
+  ForeachEncodedBaggageItem(
+      encoded_baggage,
+      [&](opentracing::string_view key, opentracing::string_view value) {
+        ++num_items;
+        num_bytes += key.size() + value.size();
+        is_within_limits = key.size() <= baggage_limits.max_key_length &&
+                           value.size() <= baggage_limits.max_value_length &&
+                           num_items <= baggage_limits.max_items &&
+                           num_bytes <= baggage_limits.max_bytes;
+        return is_within_limits;
       });
-  if (!was_successful && was_successful.error() != std::error_code{}) {
-    return opentracing::make_unexpected(was_successful.error());
-  }
-  return result;
+  return is_within_limits;
 }
 
 //------------------------------------------------------------------------------
-// InjectSpanContextMultiKey
+// InjectBaggage
 //------------------------------------------------------------------------------
-static opentracing::expected<void> InjectSpanContextMultiKey(
-    const opentracing::TextMapWriter& carrier, uint64_t trace_id,
-    uint64_t span_id, bool sampled,
-    const std::unordered_map<std::string, std::string>& baggage) {
-  std::string trace_id_hex, span_id_hex, baggage_key;
+static opentracing::expected<void> InjectBaggage(
+    const opentracing::TextMapWriter& carrier, const BaggageRef& baggage) {
+  if (baggage.empty()) {
+    return {};
+  }
+  std::string baggage_key;
   try {
-    trace_id_hex = Uint64ToHex(trace_id);
-    span_id_hex = Uint64ToHex(span_id);
     baggage_key = PrefixBaggage;
   } catch (const std::bad_alloc&) {
     return opentracing::make_unexpected(
         std::make_error_code(std::errc::not_enough_memory));
   }
-  auto result = carrier.Set(FieldNameTraceID, trace_id_hex);
+  opentracing::expected<void> result;
+  baggage.Foreach([&](opentracing::string_view key,
+                      opentracing::string_view value) {
+    try {
+      baggage_key.replace(std::begin(baggage_key) + PrefixBaggage.size(),
+                          std::end(baggage_key), key.data(), key.size());
+    } catch (const std::bad_alloc&) {
+      result = opentracing::make_unexpected(
+          std::make_error_code(std::errc::not_enough_memory));
+      return false;
+    }
+    result = carrier.Set(baggage_key, value);
+    return static_cast<bool>(result);
+  });
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// InjectSpanContextMultiKey
+//------------------------------------------------------------------------------
+static opentracing::expected<void> InjectSpanContextMultiKey(
+    const opentracing::TextMapWriter& carrier, uint64_t trace_id,
+    uint64_t span_id, bool sampled,
+    const BaggageRef& baggage) {
+  char trace_id_hex[HexUint64Length];
+  char span_id_hex[HexUint64Length];
+  WriteHexUint64(trace_id, trace_id_hex);
+  WriteHexUint64(span_id, span_id_hex);
+  auto result =
+      carrier.Set(FieldNameTraceID,
+                  opentracing::string_view{trace_id_hex, HexUint64Length});
   if (!result) {
     return result;
   }
-  result = carrier.Set(FieldNameSpanID, span_id_hex);
+  result = carrier.Set(FieldNameSpanID,
+                       opentracing::string_view{span_id_hex, HexUint64Length});
   if (!result) {
     return result;
   }
@@ -107,87 +253,144 @@ static opentracing::expected<void> InjectSpanContextMultiKey(
   if (!result) {
     return result;
   }
-  for (const auto& baggage_item : baggage) {
-    try {
-      baggage_key.replace(std::begin(baggage_key) + PrefixBaggage.size(),
-                          std::end(baggage_key), baggage_item.first);
-    } catch (const std::bad_alloc&) {
-      return opentracing::make_unexpected(
-          std::make_error_code(std::errc::not_enough_memory));
-    }
-    result = carrier.Set(baggage_key, baggage_item.second);
-    if (!result) {
-      return result;
-    }
-  }
-  return {};
+  return InjectBaggage(carrier, baggage);
 }
 
 //------------------------------------------------------------------------------
-// InjectSpanContextSingleKey
+// InjectSpanContextB3
 //------------------------------------------------------------------------------
-static opentracing::expected<void> InjectSpanContextSingleKey(
+static opentracing::expected<void> InjectSpanContextB3(
     const opentracing::TextMapWriter& carrier, uint64_t trace_id,
-    uint64_t span_id, bool sampled,
-    const std::unordered_map<std::string, std::string>& baggage) {
-  std::ostringstream ostream;
-  auto result = InjectSpanContext(PropagationOptions{}, ostream, trace_id,
-                                  sampled, span_id, baggage);
+    uint64_t span_id, bool sampled) {
+  char trace_id_hex[HexUint64Length];
+  char span_id_hex[HexUint64Length];
+  WriteHexUint64(trace_id, trace_id_hex);
+  WriteHexUint64(span_id, span_id_hex);
+  auto result =
+      carrier.Set(FieldNameB3TraceID,
+                  opentracing::string_view{trace_id_hex, HexUint64Length});
   if (!result) {
     return result;
   }
-  std::string context_value;
-  try {
-    auto binary_encoding = ostream.str();
-    context_value =
-        Base64::encode(binary_encoding.data(), binary_encoding.size());
-  } catch (const std::bad_alloc&) {
-    return opentracing::make_unexpected(
-        std::make_error_code(std::errc::not_enough_memory));
-  }
-
-  result = carrier.Set(PropagationSingleKey, context_value);
+  result = carrier.Set(FieldNameB3SpanID,
+                       opentracing::string_view{span_id_hex, HexUint64Length});
   if (!result) {
     return result;
   }
-  return {};
+  return carrier.Set(FieldNameB3Sampled, sampled ? "1" : "0");
 }
 
 //------------------------------------------------------------------------------
-// InjectSpanContext
+// InjectB3SingleHeader
 //------------------------------------------------------------------------------
-static opentracing::expected<void> InjectSpanContext(
-    BinaryCarrier& carrier, uint64_t trace_id, uint64_t span_id, bool sampled,
-    const std::unordered_map<std::string, std::string>& baggage) noexcept try {
-  carrier.Clear();
-  auto basic = carrier.mutable_basic_ctx();
-  basic->set_trace_id(trace_id);
-  basic->set_span_id(span_id);
-  basic->set_sampled(sampled);
-  auto mutable_baggage = basic->mutable_baggage_items();
-  for (auto& baggage_item : baggage) {
-    (*mutable_baggage)[baggage_item.first] = baggage_item.second;
+// Writes a `b3` header of the form {trace-id}-{span-id}-{sampling-state}.
+static opentracing::expected<void> InjectB3SingleHeader(
+    const opentracing::TextMapWriter& carrier, uint64_t trace_id,
+    uint64_t span_id, bool sampled) {
+  char b3[2 * HexUint64Length + 3];
+  auto data = b3;
+  WriteHexUint64(trace_id, data);
+  data += HexUint64Length;
+  *data++ = '-';
+  WriteHexUint64(span_id, data);
+  data += HexUint64Length;
+  *data++ = '-';
+  *data++ = sampled ? '1' : '0';
+  return carrier.Set(FieldNameB3, opentracing::string_view{b3, sizeof(b3)});
+}
+
+//------------------------------------------------------------------------------
+// InjectSpanContextTraceContext
+//------------------------------------------------------------------------------
+static opentracing::expected<void> InjectSpanContextTraceContext(
+    const opentracing::TextMapWriter& carrier, uint64_t trace_id,
+    uint64_t span_id, bool sampled) {
+  // version "-" trace-id "-" parent-id "-" trace-flags, where the upper half
+  // of the 128-bit trace-id is left as zeros.
+  char traceparent[TraceParentLength];
+  auto data = traceparent;
+  *data++ = '0';
+  *data++ = '0';
+  *data++ = '-';
+  std::fill_n(data, HexUint64Length, '0');
+  data += HexUint64Length;
+  WriteHexUint64(trace_id, data);
+  data += HexUint64Length;
+  *data++ = '-';
+  WriteHexUint64(span_id, data);
+  data += HexUint64Length;
+  *data++ = '-';
+  *data++ = '0';
+  *data++ = sampled ? '1' : '0';
+  return carrier.Set(FieldNameTraceParent,
+                     opentracing::string_view{traceparent, TraceParentLength});
+}
+
+//------------------------------------------------------------------------------
+// InjectSpanContextSingleKey
+//------------------------------------------------------------------------------
+static opentracing::expected<void> InjectSpanContextSingleKey(
+    const opentracing::TextMapWriter& carrier, uint64_t trace_id,
+    uint64_t span_id, bool sampled,
+    const BaggageRef& baggage, bool use_compact_encoding) {
+  // Serialize and encode into buffers on the stack. Only span contexts with
+  // baggage can need more space.
+  const size_t MaxBinarySize = std::max(MaxBinaryCarrierSizeWithoutBaggage,
+                                        MaxCompactCarrierSizeWithoutBaggage);
+  const size_t MaxEncodingSize = (MaxBinarySize + 2) / 3 * 4;
+  char binary_buffer[MaxBinarySize];
+  char encoding_buffer[MaxEncodingSize];
+  std::string binary_storage, encoding_storage;
+  auto binary_data = binary_buffer;
+  auto encoding_data = encoding_buffer;
+  auto binary_size =
+      use_compact_encoding
+          ? ComputeCompactCarrierSize(baggage)
+          : ComputeBinaryCarrierSize(trace_id, span_id, sampled, baggage);
+  if (binary_size > sizeof(binary_buffer)) {
+    try {
+      binary_storage.resize(binary_size);
+      encoding_storage.resize(Base64::encodedSize(binary_size));
+    } catch (const std::bad_alloc&) {
+      return opentracing::make_unexpected(
+          std::make_error_code(std::errc::not_enough_memory));
+    }
+    binary_data = &binary_storage[0];
+    encoding_data = &encoding_storage[0];
   }
-  return {};
-} catch (const std::bad_alloc&) {
-  return opentracing::make_unexpected(
-      std::make_error_code(std::errc::not_enough_memory));
+  if (use_compact_encoding) {
+    SerializeCompactCarrier(trace_id, span_id, sampled, baggage, binary_data);
+  } else {
+    SerializeBinaryCarrier(trace_id, span_id, sampled, baggage, binary_data);
+  }
+  auto encoding_size =
+      Base64::encode(binary_data, binary_size, encoding_data);
+  return carrier.Set(PropagationSingleKey,
+                     opentracing::string_view{encoding_data, encoding_size});
 }
 
+//------------------------------------------------------------------------------
+// InjectSpanContext
+//------------------------------------------------------------------------------
 opentracing::expected<void> InjectSpanContext(
     const PropagationOptions& /*propagation_options*/, std::ostream& carrier,
     uint64_t trace_id, uint64_t span_id, bool sampled,
-    const std::unordered_map<std::string, std::string>& baggage) {
-  BinaryCarrier binary_carrier;
-  auto result =
-      InjectSpanContext(binary_carrier, trace_id, span_id, sampled, baggage);
-  if (!result) {
-    return result;
-  }
-  if (!binary_carrier.SerializeToOstream(&carrier)) {
-    return opentracing::make_unexpected(
-        std::make_error_code(std::errc::io_error));
+    const BaggageRef& baggage) {
+  char buffer[MaxBinaryCarrierSizeWithoutBaggage];
+  std::string storage;
+  auto data = buffer;
+  auto size = ComputeBinaryCarrierSize(trace_id, span_id, sampled, baggage);
+  if (size > sizeof(buffer)) {
+    try {
+      storage.resize(size);
+    } catch (const std::bad_alloc&) {
+      return opentracing::make_unexpected(
+          std::make_error_code(std::errc::not_enough_memory));
+    }
+    data = &storage[0];
   }
+  SerializeBinaryCarrier(trace_id, span_id, sampled, baggage, data);
+  carrier.write(data, static_cast<std::streamsize>(size));
 
   // Flush so that when we call carrier.good(), we'll get an accurate view of
   // the error state.
@@ -204,128 +407,360 @@ opentracing::expected<void> InjectSpanContext(
     const PropagationOptions& propagation_options,
     const opentracing::TextMapWriter& carrier, uint64_t trace_id,
     uint64_t span_id, bool sampled,
-    const std::unordered_map<std::string, std::string>& baggage) {
-  if (propagation_options.use_single_key) {
-    return InjectSpanContextSingleKey(carrier, trace_id, span_id, sampled,
-                                      baggage);
-  } else {
-    return InjectSpanContextMultiKey(carrier, trace_id, span_id, sampled,
-                                     baggage);
+    const BaggageRef& baggage) {
+  // Formats other than LightStep's can't carry baggage, so they rely on the
+  // `ot-baggage-*` keys.
+  bool baggage_injected = false;
+  for (auto propagation_mode : propagation_options.propagation_modes) {
+    opentracing::expected<void> result;
+    switch (propagation_mode) {
+      case PropagationMode::lightstep:
+        if (propagation_options.use_single_key) {
+          result = InjectSpanContextSingleKey(
+              carrier, trace_id, span_id, sampled, baggage,
+              propagation_options.use_compact_single_key);
+        } else {
+          result = InjectSpanContextMultiKey(carrier, trace_id, span_id,
+                                             sampled, baggage);
+        }
+        baggage_injected = true;
+        break;
+      case PropagationMode::b3:
+        result = InjectSpanContextB3(carrier, trace_id, span_id, sampled);
+        break;
+      case PropagationMode::trace_context:
+        result =
+            InjectSpanContextTraceContext(carrier, trace_id, span_id, sampled);
+        break;
+    }
+    if (!result) {
+      return result;
+    }
   }
+  if (!baggage_injected) {
+    return InjectBaggage(carrier, baggage);
+  }
+  return {};
 }
 
 //------------------------------------------------------------------------------
-// ExtractSpanContextMultiKey
+// InjectPassthroughSpanContext
 //------------------------------------------------------------------------------
-template <class KeyCompare>
-static opentracing::expected<bool> ExtractSpanContextMultiKey(
-    const opentracing::TextMapReader& carrier, uint64_t& trace_id,
-    uint64_t& span_id, bool& sampled,
-    std::unordered_map<std::string, std::string>& baggage,
-    KeyCompare key_compare) {
-  int count = 0;
-  auto result = carrier.ForeachKey(
-      [&](opentracing::string_view key,
-          opentracing::string_view value) -> opentracing::expected<void> {
-        try {
-          if (key_compare(key, FieldNameTraceID)) {
-            trace_id = HexToUint64(value);
-            count++;
-          } else if (key_compare(key, FieldNameSpanID)) {
-            span_id = HexToUint64(value);
-            count++;
-          } else if (key_compare(key, FieldNameSampled)) {
-            if (value == "false" || value == "0") {
-              sampled = false;
-            } else {
-              sampled = true;
-            }
-            count++;
-          } else if (key.length() > PrefixBaggage.size() &&
-                     key_compare(opentracing::string_view{key.data(),
-                                                          PrefixBaggage.size()},
-                                 PrefixBaggage)) {
-            baggage.emplace(std::string{std::begin(key) + PrefixBaggage.size(),
-                                        std::end(key)},
-                            value);
-          }
-          return {};
-        } catch (const std::bad_alloc&) {
-          return opentracing::make_unexpected(
-              std::make_error_code(std::errc::not_enough_memory));
-        }
-      });
-  if (!result) {
-    return opentracing::make_unexpected(result.error());
+opentracing::expected<void> InjectPassthroughSpanContext(
+    const PropagationOptions& propagation_options,
+    const opentracing::HTTPHeadersWriter& carrier, uint64_t trace_id,
+    uint64_t span_id, bool sampled, const BaggageRef& baggage,
+    uint32_t passthrough_headers) {
+  if (passthrough_headers == 0) {
+    return InjectSpanContext(propagation_options, carrier, trace_id, span_id,
+                             sampled, baggage);
   }
-  if (count == 0) {
-    return false;
+  char span_id_hex[HexUint64Length];
+  WriteHexUint64(span_id, span_id_hex);
+  opentracing::string_view span_id_value{span_id_hex, HexUint64Length};
+  for (auto propagation_mode : propagation_options.propagation_modes) {
+    opentracing::expected<void> result;
+    switch (propagation_mode) {
+      case PropagationMode::lightstep:
+        // The single key's span id is encoded along with everything else, so
+        // the whole value is rewritten. Its baggage is still whatever was
+        // extracted. It's rewritten even if `use_single_key` is off, since
+        // forwarding it unchanged would point at the wrong parent.
+        if ((passthrough_headers & PassthroughSingleKeyHeader) != 0) {
+          result = InjectSpanContextSingleKey(
+              carrier, trace_id, span_id, sampled, baggage,
+              propagation_options.use_compact_single_key);
+        }
+        if (result &&
+            (passthrough_headers & PassthroughMultiKeyHeaders) != 0) {
+          result = carrier.Set(FieldNameSpanID, span_id_value);
+        }
+        break;
+      case PropagationMode::b3:
+        if ((passthrough_headers & PassthroughB3Headers) != 0) {
+          result = carrier.Set(FieldNameB3SpanID, span_id_value);
+        }
+        if (result && (passthrough_headers & PassthroughB3SingleHeader) != 0) {
+          result = InjectB3SingleHeader(carrier, trace_id, span_id, sampled);
+        }
+        break;
+      case PropagationMode::trace_context:
+        if ((passthrough_headers & PassthroughTraceParentHeader) != 0) {
+          result = InjectSpanContextTraceContext(carrier, trace_id, span_id,
+                                                 sampled);
+        }
+        break;
+    }
+    if (!result) {
+      return result;
+    }
   }
-  if (count > 0 && count != FieldCount) {
-    return opentracing::make_unexpected(
-        opentracing::span_context_corrupted_error);
+  return {};
+}
+
+//------------------------------------------------------------------------------
+// ParseSingleKeyCarrier
+//------------------------------------------------------------------------------
+// Parses either a BinaryCarrier or a compact carrier, whichever `data` holds.
+static bool ParseSingleKeyCarrier(
+    opentracing::string_view data, uint64_t& trace_id, uint64_t& span_id,
+    bool& sampled, std::string& encoded_baggage) {
+  if (!data.empty() && data.data()[0] == CompactCarrierVersion) {
+    return ParseCompactCarrier(data, trace_id, span_id, sampled,
+                               encoded_baggage);
   }
-  return true;
+  return ParseBinaryCarrier(data, trace_id, span_id, sampled, encoded_baggage);
 }
 
 //------------------------------------------------------------------------------
 // ExtractSpanContextSingleKey
 //------------------------------------------------------------------------------
-template <class KeyCompare>
 static opentracing::expected<bool> ExtractSpanContextSingleKey(
-    const opentracing::TextMapReader& carrier, uint64_t& trace_id,
-    uint64_t& span_id, bool& sampled,
-    std::unordered_map<std::string, std::string>& baggage,
-    KeyCompare key_compare) {
-  auto value_maybe = LookupKey(carrier, PropagationSingleKey, key_compare);
-  if (!value_maybe) {
-    if (value_maybe.error() == opentracing::key_not_found_error) {
-      return false;
-    } else {
-      return opentracing::make_unexpected(value_maybe.error());
+    opentracing::string_view value, uint64_t& trace_id, uint64_t& span_id,
+    bool& sampled, std::string& encoded_baggage) {
+  // Decode into a buffer on the stack unless the value carries enough baggage
+  // to need more space.
+  char buffer[128];
+  std::string storage;
+  auto data = buffer;
+  auto max_size = Base64::decodedSizeUpperBound(value.size());
+  if (max_size > sizeof(buffer)) {
+    try {
+      storage.resize(max_size);
+    } catch (const std::bad_alloc&) {
+      return opentracing::make_unexpected(
+          std::make_error_code(std::errc::not_enough_memory));
     }
+    data = &storage[0];
+  }
+  auto size = Base64::decode(value.data(), value.size(), data);
+  if (size == 0) {
+    return opentracing::make_unexpected(
+        opentracing::span_context_corrupted_error);
   }
-  auto value = *value_maybe;
-  std::string base64_decoding;
   try {
-    base64_decoding = Base64::decode(value.data(), value.size());
+    if (!ParseSingleKeyCarrier(opentracing::string_view{data, size},
+                               trace_id, span_id, sampled, encoded_baggage)) {
+      return opentracing::make_unexpected(
+          opentracing::span_context_corrupted_error);
+    }
   } catch (const std::bad_alloc&) {
     return opentracing::make_unexpected(
         std::make_error_code(std::errc::not_enough_memory));
   }
-  if (base64_decoding.empty()) {
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// ExtractSpanContextMultiKey
+//------------------------------------------------------------------------------
+static opentracing::expected<bool> ExtractSpanContextMultiKey(
+    const CarrierFields& fields, uint64_t& trace_id, uint64_t& span_id,
+    bool& sampled) {
+  auto count = static_cast<int>(fields.has(TraceIdField)) +
+               static_cast<int>(fields.has(SpanIdField)) +
+               static_cast<int>(fields.has(SampledField));
+  if (count == 0) {
+    return false;
+  }
+  if (count != FieldCount) {
     return opentracing::make_unexpected(
         opentracing::span_context_corrupted_error);
   }
-  in_memory_stream istream{base64_decoding.data(), base64_decoding.size()};
-  return ExtractSpanContext(PropagationOptions{}, istream, trace_id, span_id,
-                            sampled, baggage);
+  trace_id = HexToUint64(fields.values[TraceIdField]);
+  span_id = HexToUint64(fields.values[SpanIdField]);
+  auto sampled_value = fields.values[SampledField];
+  sampled = !(sampled_value == "false" || sampled_value == "0");
+  return true;
 }
 
 //------------------------------------------------------------------------------
-// ExtractSpanContext
+// ParseB3TraceId
 //------------------------------------------------------------------------------
-static opentracing::expected<bool> ExtractSpanContext(
-    const BinaryCarrier& carrier, uint64_t& trace_id, uint64_t& span_id,
-    bool& sampled,
-    std::unordered_map<std::string, std::string>& baggage) noexcept try {
-  auto& basic = carrier.basic_ctx();
-  trace_id = basic.trace_id();
-  span_id = basic.span_id();
-  sampled = basic.sampled();
-  for (const auto& entry : basic.baggage_items()) {
-    baggage.emplace(entry.first, entry.second);
+// B3 trace ids are either 16 or 32 hex digits; only the lower 64 bits are
+// kept.
+static bool ParseB3TraceId(opentracing::string_view value,
+                           uint64_t& trace_id) noexcept {
+  if (value.size() == 2 * HexUint64Length) {
+    uint64_t trace_id_high;
+    return ParseHex(value.data(), HexUint64Length, trace_id_high) &&
+           ParseHex(value.data() + HexUint64Length, HexUint64Length, trace_id);
   }
+  return value.size() == HexUint64Length &&
+         ParseHex(value.data(), HexUint64Length, trace_id);
+}
+
+//------------------------------------------------------------------------------
+// ParseB3SingleHeader
+//------------------------------------------------------------------------------
+// Parses a `b3` header of the form
+//    {trace-id}-{span-id}[-{sampling-state}[-{parent-span-id}]]
+static bool ParseB3SingleHeader(opentracing::string_view value,
+                                uint64_t& trace_id, uint64_t& span_id,
+                                bool& sampled) noexcept {
+  auto trace_id_length = 2 * HexUint64Length;
+  if (value.size() > HexUint64Length && value[HexUint64Length] == '-') {
+    trace_id_length = HexUint64Length;
+  }
+  auto span_id_last = trace_id_length + 1 + HexUint64Length;
+  if (value.size() < span_id_last || value[trace_id_length] != '-' ||
+      !ParseB3TraceId(opentracing::string_view{value.data(), trace_id_length},
+                      trace_id) ||
+      !ParseHex(value.data() + trace_id_length + 1, HexUint64Length,
+                span_id)) {
+    return false;
+  }
+  sampled = true;
+  if (value.size() == span_id_last) {
+    return true;
+  }
+  if (value.size() < span_id_last + 2 || value[span_id_last] != '-') {
+    return false;
+  }
+  switch (value[span_id_last + 1]) {
+    case '0':
+      sampled = false;
+      break;
+    case '1':
+    case 'd':
+      break;
+    default:
+      return false;
+  }
+  auto sampling_state_last = span_id_last + 2;
+  if (value.size() == sampling_state_last) {
+    return true;
+  }
+  uint64_t parent_span_id;
+  return value.size() == sampling_state_last + 1 + HexUint64Length &&
+         value[sampling_state_last] == '-' &&
+         ParseHex(value.data() + sampling_state_last + 1, HexUint64Length,
+                  parent_span_id);
+}
+
+//------------------------------------------------------------------------------
+// ExtractSpanContextB3
+//------------------------------------------------------------------------------
+static opentracing::expected<bool> ExtractSpanContextB3(
+    const CarrierFields& fields, uint64_t& trace_id, uint64_t& span_id,
+    bool& sampled) {
+  if (fields.has(B3TraceIdField) || fields.has(B3SpanIdField)) {
+    if (!fields.has(B3TraceIdField) || !fields.has(B3SpanIdField) ||
+        !ParseB3TraceId(fields.values[B3TraceIdField], trace_id) ||
+        fields.values[B3SpanIdField].size() != HexUint64Length ||
+        !ParseHex(fields.values[B3SpanIdField].data(), HexUint64Length,
+                  span_id)) {
+      return opentracing::make_unexpected(
+          opentracing::span_context_corrupted_error);
+    }
+    auto sampled_value = fields.values[B3SampledField];
+    sampled = !(sampled_value == "0" || sampled_value == "false") ||
+              fields.values[B3FlagsField] == "1";
+    return true;
+  }
+
+  // A `b3` header with only a sampling state doesn't carry a span context.
+  if (fields.has(B3Field) && fields.values[B3Field].size() > 1) {
+    if (!ParseB3SingleHeader(fields.values[B3Field], trace_id, span_id,
+                             sampled)) {
+      return opentracing::make_unexpected(
+          opentracing::span_context_corrupted_error);
+    }
+    return true;
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// ParseTraceParent
+//------------------------------------------------------------------------------
+// Decodes a `traceparent` value of the form
+//    {version}-{trace-id}-{parent-id}-{trace-flags}
+// in a single pass over its fixed layout.
+static bool ParseTraceParent(opentracing::string_view value, uint64_t& trace_id,
+                             uint64_t& span_id, bool& sampled) noexcept {
+  if (value.size() < TraceParentLength) {
+    return false;
+  }
+  auto data = value.data();
+  uint64_t version;
+  if (!ParseHex(data, 2, version) || version == 0xff) {
+    return false;
+  }
+
+  // Later versions may append fields, but must keep the layout of version 00.
+  if (value.size() > TraceParentLength &&
+      (version == 0 || data[TraceParentLength] != '-')) {
+    return false;
+  }
+  if (data[2] != '-' || data[35] != '-' || data[52] != '-') {
+    return false;
+  }
+  uint64_t trace_id_high;
+  uint64_t flags;
+  if (!ParseHex(data + 3, HexUint64Length, trace_id_high) ||
+      !ParseHex(data + 19, HexUint64Length, trace_id) ||
+      !ParseHex(data + 36, HexUint64Length, span_id) ||
+      !ParseHex(data + 53, 2, flags)) {
+    return false;
+  }
+
+  // All zero ids are invalid.
+  if ((trace_id_high == 0 && trace_id == 0) || span_id == 0) {
+    return false;
+  }
+  sampled = (flags & 1) != 0;
   return true;
-} catch (const std::bad_alloc&) {
-  return opentracing::make_unexpected(
-      std::make_error_code(std::errc::not_enough_memory));
 }
 
+//------------------------------------------------------------------------------
+// ExtractSpanContextTraceContext
+//------------------------------------------------------------------------------
+static opentracing::expected<bool> ExtractSpanContextTraceContext(
+    const CarrierFields& fields, uint64_t& trace_id, uint64_t& span_id,
+    bool& sampled) {
+  if (!fields.has(TraceParentField)) {
+    return false;
+  }
+  if (!ParseTraceParent(fields.values[TraceParentField], trace_id, span_id,
+                        sampled)) {
+    return opentracing::make_unexpected(
+        opentracing::span_context_corrupted_error);
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// GetPassthroughHeaders
+//------------------------------------------------------------------------------
+static uint32_t GetPassthroughHeaders(const CarrierFields& fields) noexcept {
+  uint32_t result = 0;
+  if (fields.has(TraceIdField) || fields.has(SpanIdField)) {
+    result |= PassthroughMultiKeyHeaders;
+  }
+  if (fields.has(SingleKeyField)) {
+    result |= PassthroughSingleKeyHeader;
+  }
+  if (fields.has(B3TraceIdField) || fields.has(B3SpanIdField)) {
+    result |= PassthroughB3Headers;
+  }
+  // A `b3` header with only a sampling state has no span id to rewrite.
+  if (fields.has(B3Field) && fields.values[B3Field].size() > 1) {
+    result |= PassthroughB3SingleHeader;
+  }
+  if (fields.has(TraceParentField)) {
+    result |= PassthroughTraceParentHeader;
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// ExtractSpanContext
+//------------------------------------------------------------------------------
 opentracing::expected<bool> ExtractSpanContext(
     const PropagationOptions& /*propagation_options*/, std::istream& carrier,
     uint64_t& trace_id, uint64_t& span_id, bool& sampled,
-    std::unordered_map<std::string, std::string>& baggage) try {
+    std::string& encoded_baggage) try {
   // istream::peek returns EOF if it's in an error state, so check for an error
   // state first before checking for an empty stream.
   if (!carrier.good()) {
@@ -338,48 +773,129 @@ opentracing::expected<bool> ExtractSpanContext(
     return false;
   }
 
-  BinaryCarrier binary_carrier;
-  if (!binary_carrier.ParseFromIstream(&carrier)) {
+  std::string data{std::istreambuf_iterator<char>{carrier},
+                   std::istreambuf_iterator<char>{}};
+  if (carrier.bad() ||
+      !ParseSingleKeyCarrier(data, trace_id, span_id, sampled,
+                             encoded_baggage)) {
     return opentracing::make_unexpected(
         opentracing::span_context_corrupted_error);
   }
-  return ExtractSpanContext(binary_carrier, trace_id, span_id, sampled,
-                            baggage);
+  return true;
 } catch (const std::bad_alloc&) {
   return opentracing::make_unexpected(
       std::make_error_code(std::errc::not_enough_memory));
 }
 
-template <class KeyCompare>
+// For passthrough extraction, `passthrough_headers` is set to the span context
+// headers found and baggage headers are skipped.
 static opentracing::expected<bool> ExtractSpanContext(
     const PropagationOptions& propagation_options,
     const opentracing::TextMapReader& carrier, uint64_t& trace_id,
-    uint64_t& span_id, bool& sampled,
-    std::unordered_map<std::string, std::string>& baggage,
-    KeyCompare key_compare) {
-  if (propagation_options.use_single_key) {
-    auto span_context_maybe = ExtractSpanContextSingleKey(
-        carrier, trace_id, span_id, sampled, baggage, key_compare);
-
-    // If no span context was found, fall back to multikey extraction so as to
-    // support interoperability with other tracers.
+    uint64_t& span_id, bool& sampled, std::string& encoded_baggage,
+    bool ignore_case, uint32_t* passthrough_headers) {
+  auto& propagation_modes = propagation_options.propagation_modes;
+
+  // If the single-key LightStep format takes precedence, first try
+  // carrier.LookupKey since that can potentially be the fastest approach.
+  // Passthrough extraction needs every header, so it always reads them all.
+  if (passthrough_headers == nullptr && propagation_options.use_single_key &&
+      !propagation_modes.empty() &&
+      propagation_modes.front() == PropagationMode::lightstep) {
+    auto value_maybe = carrier.LookupKey(PropagationSingleKey);
+    if (value_maybe) {
+      return ExtractSpanContextSingleKey(*value_maybe, trace_id, span_id,
+                                         sampled, encoded_baggage);
+    }
+    if (value_maybe.error() != opentracing::lookup_key_not_supported_error &&
+        value_maybe.error() != opentracing::key_not_found_error) {
+      return opentracing::make_unexpected(value_maybe.error());
+    }
+  }
+
+  // Otherwise, collect the fields of every format and the baggage in a single
+  // pass.
+  CarrierFields fields;
+
+  // Only the first value of a repeated baggage key is kept. A bit per key
+  // length marks the lengths seen so far, so the baggage is only searched for
+  // a repeat when a key has the same length as an earlier one.
+  uint64_t baggage_key_lengths = 0;
+  auto result = carrier.ForeachKey(
+      [&](opentracing::string_view key,
+          opentracing::string_view value) -> opentracing::expected<void> {
+        try {
+          auto field = CarrierFieldMatcher.Match(key, ignore_case);
+          if (field >= 0) {
+            fields.values[field] = value;
+            fields.found |= 1u << field;
+          } else if (field == CarrierKeyMatcher::PrefixMatch &&
+                     passthrough_headers == nullptr) {
+            opentracing::string_view baggage_key{
+                key.data() + PrefixBaggage.size(),
+                key.size() - PrefixBaggage.size()};
+            auto length_bit = uint64_t{1} << (baggage_key.size() % 64);
+            if ((baggage_key_lengths & length_bit) != 0 &&
+                HasEncodedBaggageItem(encoded_baggage, baggage_key)) {
+              return {};
+            }
+            baggage_key_lengths |= length_bit;
+            AppendEncodedBaggageItem(baggage_key, value, encoded_baggage);
+          }
+          return {};
+        } catch (const std::bad_alloc&) {
+          return opentracing::make_unexpected(
+              std::make_error_code(std::errc::not_enough_memory));
+        }
+      });
+  if (!result) {
+    return opentracing::make_unexpected(result.error());
+  }
+  if (passthrough_headers != nullptr) {
+    *passthrough_headers = GetPassthroughHeaders(fields);
+  }
+
+  for (auto propagation_mode : propagation_modes) {
+    opentracing::expected<bool> span_context_maybe = false;
+    switch (propagation_mode) {
+      case PropagationMode::lightstep:
+        // If no single-key span context was found, fall back to the multikey
+        // format so as to support interoperability with other tracers. A
+        // passthrough extraction always reads a single key that's present so
+        // that its baggage is kept when it's rewritten.
+        if ((propagation_options.use_single_key ||
+             passthrough_headers != nullptr) &&
+            fields.has(SingleKeyField)) {
+          span_context_maybe = ExtractSpanContextSingleKey(
+              fields.values[SingleKeyField], trace_id, span_id, sampled,
+              encoded_baggage);
+        } else {
+          span_context_maybe =
+              ExtractSpanContextMultiKey(fields, trace_id, span_id, sampled);
+        }
+        break;
+      case PropagationMode::b3:
+        span_context_maybe =
+            ExtractSpanContextB3(fields, trace_id, span_id, sampled);
+        break;
+      case PropagationMode::trace_context:
+        span_context_maybe =
+            ExtractSpanContextTraceContext(fields, trace_id, span_id, sampled);
+        break;
+    }
     if (!span_context_maybe || *span_context_maybe) {
       return span_context_maybe;
     }
   }
-
-  return ExtractSpanContextMultiKey(carrier, trace_id, span_id, sampled,
-                                    baggage, key_compare);
+  return false;
 }
 
 opentracing::expected<bool> ExtractSpanContext(
     const PropagationOptions& propagation_options,
     const opentracing::TextMapReader& carrier, uint64_t& trace_id,
-    uint64_t& span_id, bool& sampled,
-    std::unordered_map<std::string, std::string>& baggage) {
+    uint64_t& span_id, bool& sampled, std::string& encoded_baggage) {
   return ExtractSpanContext(propagation_options, carrier, trace_id, span_id,
-                            sampled, baggage,
-                            std::equal_to<opentracing::string_view>());
+                            sampled, encoded_baggage, false, nullptr);
 }
 
 // HTTP header field names are case insensitive, so we need to ignore case when
@@ -389,17 +905,22 @@ opentracing::expected<bool> ExtractSpanContext(
 opentracing::expected<bool> ExtractSpanContext(
     const PropagationOptions& propagation_options,
     const opentracing::HTTPHeadersReader& carrier, uint64_t& trace_id,
-    uint64_t& span_id, bool& sampled,
-    std::unordered_map<std::string, std::string>& baggage) {
-  auto iequals = [](opentracing::string_view lhs,
-                    opentracing::string_view rhs) {
-    return lhs.length() == rhs.length() &&
-           std::equal(std::begin(lhs), std::end(lhs), std::begin(rhs),
-                      [](char a, char b) {
-                        return std::tolower(a) == std::tolower(b);
-                      });
-  };
+    uint64_t& span_id, bool& sampled, std::string& encoded_baggage) {
+  return ExtractSpanContext(propagation_options, carrier, trace_id, span_id,
+                            sampled, encoded_baggage, true, nullptr);
+}
+
+//------------------------------------------------------------------------------
+// ExtractPassthroughSpanContext
+//------------------------------------------------------------------------------
+opentracing::expected<bool> ExtractPassthroughSpanContext(
+    const PropagationOptions& propagation_options,
+    const opentracing::HTTPHeadersReader& carrier, uint64_t& trace_id,
+    uint64_t& span_id, bool& sampled, std::string& encoded_baggage,
+    uint32_t& passthrough_headers) {
+  passthrough_headers = 0;
   return ExtractSpanContext(propagation_options, carrier, trace_id, span_id,
-                            sampled, baggage, iequals);
+                            sampled, encoded_baggage, true,
+                            &passthrough_headers);
 }
 }  // namespace lightstep
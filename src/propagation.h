@@ -1,38 +1,109 @@
 #pragma once
 
+#include <lightstep/tracer.h>
 #include <opentracing/propagation.h>
 #include <unordered_map>
+#include <vector>
+#include "encoded_baggage.h"
 
 namespace lightstep {
+// BaggageLimits bounds the baggage carried by a span context.
+struct BaggageLimits {
+  size_t max_items = 64;
+  size_t max_key_length = 256;
+  size_t max_value_length = 4096;
+  size_t max_bytes = 8192;
+};
+
 struct PropagationOptions {
   bool use_single_key = false;
+
+  // Use the compact length-prefixed encoding for the single key's value.
+  bool use_compact_single_key = false;
+
+  BaggageLimits baggage_limits;
+
+  // The formats used for TextMap and HTTPHeaders carriers, in order of
+  // precedence when extracting.
+  std::vector<PropagationMode> propagation_modes = {PropagationMode::lightstep};
 };
 
+// Returns true if the item `key`, `value` can be added to `baggage` without
+// exceeding `baggage_limits`.
+bool IsBaggageItemAllowed(
+    const BaggageLimits& baggage_limits,
+    const std::unordered_map<std::string, std::string>& baggage,
+    opentracing::string_view key, opentracing::string_view value) noexcept;
+
+// Removes items from `baggage` until it's within `baggage_limits` and returns
+// the number of items removed.
+int ApplyBaggageLimits(const BaggageLimits& baggage_limits,
+                       std::unordered_map<std::string, std::string>& baggage);
+
+// Returns true if none of the items in `encoded_baggage` exceed
+// `baggage_limits`.
+bool IsWithinBaggageLimits(const BaggageLimits& baggage_limits,
+                           opentracing::string_view encoded_baggage) noexcept;
+
 opentracing::expected<void> InjectSpanContext(
     const PropagationOptions& propagation_options, std::ostream& carrier,
     uint64_t trace_id, uint64_t span_id, bool sampled,
-    const std::unordered_map<std::string, std::string>& baggage);
+    const BaggageRef& baggage);
 
 opentracing::expected<void> InjectSpanContext(
     const PropagationOptions& propagation_options,
     const opentracing::TextMapWriter& carrier, uint64_t trace_id,
-    uint64_t span_id, bool sampled,
-    const std::unordered_map<std::string, std::string>& baggage);
+    uint64_t span_id, bool sampled, const BaggageRef& baggage);
 
 opentracing::expected<bool> ExtractSpanContext(
     const PropagationOptions& propagation_options, std::istream& carrier,
     uint64_t& trace_id, uint64_t& span_id, bool& sampled,
-    std::unordered_map<std::string, std::string>& baggage);
+    std::string& encoded_baggage);
 
 opentracing::expected<bool> ExtractSpanContext(
     const PropagationOptions& propagation_options,
     const opentracing::TextMapReader& carrier, uint64_t& trace_id,
-    uint64_t& span_id, bool& sampled,
-    std::unordered_map<std::string, std::string>& baggage);
+    uint64_t& span_id, bool& sampled, std::string& encoded_baggage);
 
 opentracing::expected<bool> ExtractSpanContext(
     const PropagationOptions& propagation_options,
     const opentracing::HTTPHeadersReader& carrier, uint64_t& trace_id,
-    uint64_t& span_id, bool& sampled,
-    std::unordered_map<std::string, std::string>& baggage);
+    uint64_t& span_id, bool& sampled, std::string& encoded_baggage);
+
+// Passthrough propagation is for proxies that forward the headers of a
+// request. Extraction skips baggage headers and records which span context
+// headers were found; injection only rewrites those headers, and within them
+// only what carries the span id.
+//
+// PassthroughReader and PassthroughWriter wrap a carrier to select
+// passthrough propagation.
+struct PassthroughReader {
+  const opentracing::HTTPHeadersReader& carrier;
+};
+
+struct PassthroughWriter {
+  const opentracing::HTTPHeadersWriter& carrier;
+};
+
+// Flags for the span context headers found by passthrough extraction.
+const uint32_t PassthroughMultiKeyHeaders = 1;         // ot-tracer-*
+const uint32_t PassthroughSingleKeyHeader = 1 << 1;    // x-ot-span-context
+const uint32_t PassthroughB3Headers = 1 << 2;          // x-b3-*
+const uint32_t PassthroughB3SingleHeader = 1 << 3;     // b3
+const uint32_t PassthroughTraceParentHeader = 1 << 4;  // traceparent
+
+opentracing::expected<bool> ExtractPassthroughSpanContext(
+    const PropagationOptions& propagation_options,
+    const opentracing::HTTPHeadersReader& carrier, uint64_t& trace_id,
+    uint64_t& span_id, bool& sampled, std::string& encoded_baggage,
+    uint32_t& passthrough_headers);
+
+// Rewrites the `passthrough_headers` found by ExtractPassthroughSpanContext.
+// With no headers found, the span context is injected as by
+// InjectSpanContext.
+opentracing::expected<void> InjectPassthroughSpanContext(
+    const PropagationOptions& propagation_options,
+    const opentracing::HTTPHeadersWriter& carrier, uint64_t trace_id,
+    uint64_t span_id, bool sampled, const BaggageRef& baggage,
+    uint32_t passthrough_headers);
 }  // namespace lightstep
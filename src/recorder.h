@@ -1,8 +1,12 @@
 #pragma once
 
+#include <lightstep/metrics_observer.h>
 #include <lightstep/tracer.h>
 #include <chrono>
-#include "lightstep-tracer-common/collector.pb.h"
+#include "memory_budget.h"
+#include "profiler.h"
+#include "tracer_stats.h"
+#include "span_record.h"
 
 namespace lightstep {
 // Abstract class that accepts spans from a Tracer once they are finished.
@@ -10,11 +14,33 @@ class Recorder {
  public:
   virtual ~Recorder() = default;
 
-  virtual void RecordSpan(collector::Span&& span) noexcept = 0;
+  virtual void RecordSpan(SpanRecord&& span) noexcept = 0;
 
   virtual bool FlushWithTimeout(
       std::chrono::system_clock::duration /*timeout*/) noexcept {
     return true;
   }
+
+  // Returns the observer that tracer events are reported to.
+  virtual MetricsObserver& metrics_observer() noexcept {
+    static MetricsObserver default_metrics_observer;
+    return default_metrics_observer;
+  }
+
+  // Returns the profiler that the tracer's stages are timed with, or null if
+  // profiling isn't enabled.
+  virtual Profiler* profiler() noexcept { return nullptr; }
+
+  // Returns the budget that the memory of spans is counted against.
+  virtual MemoryBudget& memory_budget() noexcept {
+    static MemoryBudget default_memory_budget;
+    return default_memory_budget;
+  }
+
+  // Returns the counters that span statistics are accumulated in.
+  virtual TracerStatsCounters& stats_counters() noexcept {
+    static TracerStatsCounters default_stats_counters;
+    return default_stats_counters;
+  }
 };
 }  // namespace lightstep
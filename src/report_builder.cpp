@@ -2,13 +2,52 @@
 #include "utility.h"
 
 namespace lightstep {
+//------------------------------------------------------------------------------
+// AddGauge
+//------------------------------------------------------------------------------
+static void AddGauge(collector::InternalMetrics& metrics, const char* name,
+                     uint64_t value) {
+  auto gauge = metrics.add_gauges();
+  gauge->set_name(name);
+  gauge->set_int_value(static_cast<int64_t>(value));
+}
+
+static void AddGauge(collector::InternalMetrics& metrics, const char* name,
+                     double value) {
+  auto gauge = metrics.add_gauges();
+  gauge->set_name(name);
+  gauge->set_double_value(value);
+}
+
+//------------------------------------------------------------------------------
+// Reset
+//------------------------------------------------------------------------------
+double SamplingRateCounter::Reset(const TracerStats& stats) noexcept {
+  auto num_spans_started = stats.num_spans_started - num_spans_started_;
+  auto num_spans_sampled_out =
+      stats.num_spans_sampled_out - num_spans_sampled_out_;
+  num_spans_started_ = stats.num_spans_started;
+  num_spans_sampled_out_ = stats.num_spans_sampled_out;
+
+  if (num_spans_started == 0) {
+    return 1.0;
+  }
+
+  // Spans that aren't sampled are only counted when they finish, which can
+  // be after the report that counted their start.
+  if (num_spans_sampled_out >= num_spans_started) {
+    return 0.0;
+  }
+  return static_cast<double>(num_spans_started - num_spans_sampled_out) /
+         static_cast<double>(num_spans_started);
+}
+
 //------------------------------------------------------------------------------
 // Constructor
 //------------------------------------------------------------------------------
 ReportBuilder::ReportBuilder(
     const std::string& access_token,
     const std::unordered_map<std::string, opentracing::Value>& tags) {
-  // TODO(rnburn): Fill in any core internal_metrics.
   collector::Reporter* reporter = preamble_.mutable_reporter();
   for (const auto& tag : tags) {
     *reporter->mutable_tags()->Add() = ToKeyValue(tag.first, tag.second);
@@ -20,21 +59,65 @@ ReportBuilder::ReportBuilder(
 //------------------------------------------------------------------------------
 // AddSpan
 //------------------------------------------------------------------------------
-void ReportBuilder::AddSpan(collector::Span&& span) {
-  if (reset_next_) {
-    pending_.Clear();
-    pending_.CopyFrom(preamble_);
-    reset_next_ = false;
-  }
-  *pending_.mutable_spans()->Add() = span;
+void ReportBuilder::AddSpan(SpanRecord&& span) {
+  ResetPendingIfNeeded();
+  pending_spans_.emplace_back(std::move(span));
 }
 
 //------------------------------------------------------------------------------
 // set_pending_client_dropped_spans
 //------------------------------------------------------------------------------
 void ReportBuilder::set_pending_client_dropped_spans(uint64_t spans) {
-  auto count = pending_.mutable_internal_metrics()->add_counts();
+  auto count = pending_internal_metrics().add_counts();
   count->set_name("spans.dropped");
   count->set_int_value(spans);
 }
+
+//------------------------------------------------------------------------------
+// set_pending_health_metrics
+//------------------------------------------------------------------------------
+void ReportBuilder::set_pending_health_metrics(
+    const HealthMetrics& health_metrics) {
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+  auto& metrics = pending_internal_metrics();
+  auto count = metrics.add_counts();
+  count->set_name("reports.failed");
+  count->set_int_value(
+      static_cast<int64_t>(health_metrics.num_failed_reports));
+  AddGauge(metrics, "spans.buffered",
+           static_cast<uint64_t>(health_metrics.num_buffered_spans));
+  AddGauge(metrics, "bytes.buffered",
+           static_cast<uint64_t>(health_metrics.num_buffered_bytes));
+  AddGauge(metrics, "memory.bytes",
+           static_cast<uint64_t>(health_metrics.num_memory_bytes));
+  AddGauge(metrics, "flush.duration_micros",
+           static_cast<uint64_t>(
+               duration_cast<microseconds>(health_metrics.flush_duration)
+                   .count()));
+  AddGauge(metrics, "encode.cpu_micros",
+           static_cast<uint64_t>(
+               duration_cast<microseconds>(health_metrics.encode_cpu_time)
+                   .count()));
+  AddGauge(metrics, "sampling.rate", health_metrics.sampling_rate);
+}
+
+//------------------------------------------------------------------------------
+// pending_internal_metrics
+//------------------------------------------------------------------------------
+collector::InternalMetrics& ReportBuilder::pending_internal_metrics() {
+  ResetPendingIfNeeded();
+  return *pending_.mutable_internal_metrics();
+}
+
+//------------------------------------------------------------------------------
+// ResetPendingIfNeeded
+//------------------------------------------------------------------------------
+void ReportBuilder::ResetPendingIfNeeded() {
+  if (reset_next_) {
+    pending_.Clear();
+    pending_.CopyFrom(preamble_);
+    reset_next_ = false;
+  }
+}
 }  // namespace lightstep
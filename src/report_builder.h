@@ -2,11 +2,53 @@
 
 #include <lightstep/tracer.h>
 #include <opentracing/value.h>
+#include <chrono>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include "lightstep-tracer-common/collector.pb.h"
+#include "span_record.h"
 
 namespace lightstep {
+// HealthMetrics describe the tracer's own state and overhead. They're sent
+// with each report as internal metrics so that tracers can be monitored from
+// the collector.
+struct HealthMetrics {
+  // The spans in the report and the memory they were estimated to take up
+  // while buffered.
+  size_t num_buffered_spans = 0;
+  size_t num_buffered_bytes = 0;
+
+  // The memory counted against the tracer's budget; see MemoryUsage.
+  size_t num_memory_bytes = 0;
+
+  // Reports that failed to send since the last report.
+  size_t num_failed_reports = 0;
+
+  // The time taken to flush the previous report, and the CPU time spent
+  // encoding it. A report can't include its own.
+  std::chrono::steady_clock::duration flush_duration{};
+  std::chrono::nanoseconds encode_cpu_time{};
+
+  // The fraction of spans started since the last report that weren't
+  // discarded by the tracer's span filter or sampled out.
+  double sampling_rate = 1.0;
+};
+
+// SamplingRateCounter computes HealthMetrics::sampling_rate from snapshots of
+// the tracer's TracerStatsCounters, so that spans aren't counted twice. Not
+// thread-safe.
+class SamplingRateCounter {
+ public:
+  // Returns the sampling rate of the spans counted in `stats` since the
+  // last call.
+  double Reset(const TracerStats& stats) noexcept;
+
+ private:
+  uint64_t num_spans_started_ = 0;
+  uint64_t num_spans_sampled_out_ = 0;
+};
+
 // ReportBuilder helps construct lightstep::collector::ReportRequest messages.
 // Not thread-safe, thread compatible.
 class ReportBuilder {
@@ -15,14 +57,21 @@ class ReportBuilder {
       const std::string& access_token,
       const std::unordered_map<std::string, opentracing::Value>& tags);
 
-  // AddSpan adds the span to the currently-building ReportRequest.
-  void AddSpan(collector::Span&& span);
+  // AddSpan adds the span to the currently-building ReportRequest. Spans are
+  // kept unencoded; see pending_spans().
+  void AddSpan(SpanRecord&& span);
 
   // num_pending_spans() is the number of pending spans.
-  size_t num_pending_spans() const { return pending_.spans_size(); }
+  size_t num_pending_spans() const { return pending_spans_.size(); }
 
   void set_pending_client_dropped_spans(uint64_t spans);
 
+  void set_pending_health_metrics(const HealthMetrics& health_metrics);
+
+  // pending_internal_metrics() returns the internal metrics of the
+  // currently-building ReportRequest.
+  collector::InternalMetrics& pending_internal_metrics();
+
   // pending() returns a mutable object, appropriate for swapping with
   // another ReportRequest object.
   collector::ReportRequest& pending() {
@@ -30,9 +79,17 @@ class ReportBuilder {
     return pending_;
   }
 
+  // pending_spans() returns the spans of the currently-building ReportRequest,
+  // appropriate for swapping. They're expected to be encoded into the report
+  // with EncodeSpanRecords after it's been swapped out.
+  std::vector<SpanRecord>& pending_spans() { return pending_spans_; }
+
  private:
+  void ResetPendingIfNeeded();
+
   bool reset_next_ = true;
   collector::ReportRequest preamble_;
   collector::ReportRequest pending_;
+  std::vector<SpanRecord> pending_spans_;
 };
 }  // namespace lightstep
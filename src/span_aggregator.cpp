@@ -0,0 +1,108 @@
+#include "span_aggregator.h"
+#include <opentracing/ext/tags.h>
+#include <algorithm>
+#include "utility.h"
+
+namespace lightstep {
+//------------------------------------------------------------------------------
+// IsError
+//------------------------------------------------------------------------------
+static bool IsError(const SpanRecord& span) noexcept {
+  auto iter = span.tags.find(opentracing::ext::error);
+  if (iter == span.tags.end()) {
+    return false;
+  }
+  return iter->second.is<bool>() && iter->second.get<bool>();
+}
+
+//------------------------------------------------------------------------------
+// ComputeBucket
+//------------------------------------------------------------------------------
+// Returns the index of the smallest power of two that's greater than or equal
+// to `duration_micros`.
+static size_t ComputeBucket(uint64_t duration_micros,
+                            size_t num_buckets) noexcept {
+  if (duration_micros <= 1) {
+    return 0;
+  }
+  auto bucket = static_cast<size_t>(64 - __builtin_clzll(duration_micros - 1));
+  return std::min(bucket, num_buckets - 1);
+}
+
+//------------------------------------------------------------------------------
+// AddCount
+//------------------------------------------------------------------------------
+static void AddCount(collector::InternalMetrics& metrics,
+                     const std::string& name, uint64_t value) {
+  auto count = metrics.add_counts();
+  count->set_name(name);
+  count->set_int_value(static_cast<int64_t>(value));
+}
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+SpanAggregator::SpanAggregator(
+    const std::vector<std::string>& operation_names) {
+  for (auto& operation_name : operation_names) {
+    operations_[operation_name].reset(new OperationStats{});
+  }
+}
+
+//------------------------------------------------------------------------------
+// AggregateSpan
+//------------------------------------------------------------------------------
+bool SpanAggregator::AggregateSpan(const SpanRecord& span) noexcept {
+  if (operations_.empty()) {
+    return false;
+  }
+  auto iter = operations_.find(span.operation_name);
+  if (iter == operations_.end()) {
+    return false;
+  }
+  auto& stats = *iter->second;
+  auto duration_micros = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(span.duration)
+          .count());
+  stats.Add(count_counter, 1);
+  if (IsError(span)) {
+    stats.Add(errors_counter, 1);
+  }
+  stats.Add(duration_micros_sum_counter, duration_micros);
+  stats.Add(first_bucket_counter + ComputeBucket(duration_micros, num_buckets),
+            1);
+
+  // Avoid writing to the shared flag when it's already set.
+  if (!has_aggregates_.load(std::memory_order_relaxed)) {
+    has_aggregates_.store(true, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Flush
+//------------------------------------------------------------------------------
+void SpanAggregator::Flush(collector::InternalMetrics& metrics) {
+  has_aggregates_.store(false, std::memory_order_relaxed);
+  for (auto& operation : operations_) {
+    auto totals = operation.second->Exchange();
+    if (totals[count_counter] == 0) {
+      continue;
+    }
+    auto buckets = totals.data() + first_bucket_counter;
+    auto prefix = "aggregate." + operation.first;
+    AddCount(metrics, prefix + ".count", totals[count_counter]);
+    AddCount(metrics, prefix + ".errors", totals[errors_counter]);
+    AddCount(metrics, prefix + ".duration_micros.sum",
+             totals[duration_micros_sum_counter]);
+    for (size_t i = 0; i < num_buckets; ++i) {
+      if (buckets[i] == 0) {
+        continue;
+      }
+      auto bound = i == num_buckets - 1 ? std::string{"inf"}
+                                        : std::to_string(uint64_t{1} << i);
+      AddCount(metrics, prefix + ".duration_micros.le_" + bound, buckets[i]);
+    }
+  }
+}
+}  // namespace lightstep
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "lightstep-tracer-common/collector.pb.h"
+#include "span_record.h"
+#include "utility.h"
+
+namespace lightstep {
+// SpanAggregator summarizes the finished spans of selected operations into
+// latency histograms and error counts instead of recording them
+// individually.
+//
+// AggregateSpan is lock-free and can be called concurrently: each operation's
+// statistics are kept in ShardedCounters and only merged when they're flushed
+// into a report.
+class SpanAggregator {
+ public:
+  explicit SpanAggregator(const std::vector<std::string>& operation_names);
+
+  // Returns true and adds `span` to the aggregates if its operation is
+  // aggregated; otherwise, returns false and leaves it to be recorded.
+  bool AggregateSpan(const SpanRecord& span) noexcept;
+
+  // Returns true if any span was aggregated since the last call to Flush.
+  bool has_aggregates() const noexcept {
+    return has_aggregates_.load(std::memory_order_relaxed);
+  }
+
+  // Adds a MetricsSample to `metrics` for each statistic accumulated since
+  // the last call to Flush and resets the statistics.
+  void Flush(collector::InternalMetrics& metrics);
+
+ private:
+  // Durations are bucketed by powers of two microseconds. The last bucket
+  // counts every duration above the largest bound.
+  static const size_t num_buckets = 32;
+
+  // An operation's counters: its count, errors and the sum of its durations,
+  // followed by the buckets.
+  enum Counter {
+    count_counter = 0,
+    errors_counter,
+    duration_micros_sum_counter,
+    first_bucket_counter,
+    num_counters = first_bucket_counter + num_buckets
+  };
+
+  using OperationStats = ShardedCounters<num_counters>;
+
+  std::unordered_map<std::string, std::unique_ptr<OperationStats>>
+      operations_;
+  std::atomic<bool> has_aggregates_{false};
+};
+}  // namespace lightstep
@@ -0,0 +1,156 @@
+#include "span_encoder_pool.h"
+#include <algorithm>
+#include "utility.h"
+
+namespace lightstep {
+// Batches are split into chunks of at least this many spans so that the
+// coordination cost stays small relative to the encoding.
+const size_t MinChunkSize = 64;
+
+// Each thread gets this many chunks on average so that threads that finish
+// early can pick up the remaining work.
+const size_t ChunksPerThread = 4;
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+SpanEncoderPool::SpanEncoderPool(Logger& logger, size_t num_threads)
+    : logger_{logger} {
+  workers_.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(&SpanEncoderPool::RunWorker, this);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Destructor
+//------------------------------------------------------------------------------
+SpanEncoderPool::~SpanEncoderPool() {
+  {
+    std::lock_guard<std::mutex> lock_guard{mutex_};
+    exit_ = true;
+  }
+  work_cond_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+//------------------------------------------------------------------------------
+// Encode
+//------------------------------------------------------------------------------
+std::chrono::nanoseconds SpanEncoderPool::Encode(
+    std::vector<SpanRecord>& records, collector::ReportRequest& report) {
+  auto num_threads = workers_.size() + 1;
+  auto start_cpu_time = GetThreadCpuTime();
+  if (workers_.empty() || records.size() < 2 * MinChunkSize) {
+    EncodeSpanRecords(logger_, records, report);
+    return GetThreadCpuTime() - start_cpu_time;
+  }
+
+  // Set up the batch and wake up the workers.
+  chunk_size_ = std::max(MinChunkSize,
+                         records.size() / (num_threads * ChunksPerThread));
+  num_chunks_ = (records.size() + chunk_size_ - 1) / chunk_size_;
+  if (fragments_.size() < num_chunks_) {
+    fragments_.resize(num_chunks_);
+  }
+  records_ = &records;
+  arena_ = report.GetArena();
+  next_chunk_.store(0, std::memory_order_relaxed);
+  cpu_time_.store(0, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock_guard{mutex_};
+    num_active_workers_ = workers_.size();
+    ++generation_;
+  }
+  work_cond_.notify_all();
+
+  EncodeChunks();
+
+  {
+    std::unique_lock<std::mutex> lock{mutex_};
+    done_cond_.wait(lock, [this] { return num_active_workers_ == 0; });
+  }
+  records_ = nullptr;
+  arena_ = nullptr;
+
+  // Stitch the fragments together. Ownership of the encoded spans is
+  // transferred so that nothing is copied; spans created on the report's
+  // arena are already owned by it.
+  auto spans = report.mutable_spans();
+  spans->Reserve(spans->size() + static_cast<int>(records.size()));
+  for (size_t chunk = 0; chunk < num_chunks_; ++chunk) {
+    auto& fragment = fragments_[chunk];
+    stitch_buffer_.resize(static_cast<size_t>(fragment.size()));
+    fragment.ExtractSubrange(0, fragment.size(), stitch_buffer_.data());
+    for (auto span : stitch_buffer_) {
+      spans->AddAllocated(span);
+    }
+  }
+  return GetThreadCpuTime() - start_cpu_time +
+         std::chrono::nanoseconds{cpu_time_.load(std::memory_order_relaxed)};
+}
+
+//------------------------------------------------------------------------------
+// RunWorker
+//------------------------------------------------------------------------------
+void SpanEncoderPool::RunWorker() noexcept {
+  size_t generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{mutex_};
+      work_cond_.wait(lock, [this, generation] {
+        return exit_ || generation_ != generation;
+      });
+      if (exit_) {
+        return;
+      }
+      generation = generation_;
+    }
+    auto start_cpu_time = GetThreadCpuTime();
+    EncodeChunks();
+    cpu_time_.fetch_add((GetThreadCpuTime() - start_cpu_time).count(),
+                        std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock_guard{mutex_};
+      if (--num_active_workers_ == 0) {
+        done_cond_.notify_one();
+      }
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// EncodeChunks
+//------------------------------------------------------------------------------
+void SpanEncoderPool::EncodeChunks() noexcept {
+  auto& records = *records_;
+  while (true) {
+    auto chunk = next_chunk_.fetch_add(1, std::memory_order_relaxed);
+    if (chunk >= num_chunks_) {
+      return;
+    }
+    auto& fragment = fragments_[chunk];
+    auto first = chunk * chunk_size_;
+    auto last = std::min(first + chunk_size_, records.size());
+    try {
+      fragment.Reserve(static_cast<int>(last - first));
+      for (auto i = first; i < last; ++i) {
+        if (arena_ == nullptr) {
+          EncodeSpanRecord(logger_, std::move(records[i]), *fragment.Add());
+          continue;
+        }
+        // Creating the span on this thread lets the arena take the memory
+        // from a block local to this thread's node.
+        auto span =
+            google::protobuf::Arena::CreateMessage<collector::Span>(arena_);
+        EncodeSpanRecord(logger_, std::move(records[i]), *span);
+        fragment.UnsafeArenaAddAllocated(span);
+      }
+    } catch (const std::exception& e) {
+      logger_.Error("Failed to encode spans: ", e.what());
+    }
+  }
+}
+}  // namespace lightstep
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "lightstep-tracer-common/collector.pb.h"
+#include "logger.h"
+#include "span_record.h"
+
+namespace lightstep {
+// SpanEncoderPool encodes batches of spans in parallel. A batch is split into
+// chunks that the pool's threads, together with the calling thread, claim
+// until none are left. Each chunk is encoded into its own fragment and the
+// fragments are then stitched into the report in order.
+//
+// If the report is allocated on an arena, spans are created on the same arena
+// by whichever thread encodes them.
+//
+// Encode must only be called from a single thread at a time.
+class SpanEncoderPool {
+ public:
+  SpanEncoderPool(Logger& logger, size_t num_threads);
+
+  SpanEncoderPool(const SpanEncoderPool&) = delete;
+  SpanEncoderPool(SpanEncoderPool&&) = delete;
+  SpanEncoderPool& operator=(const SpanEncoderPool&) = delete;
+  SpanEncoderPool& operator=(SpanEncoderPool&&) = delete;
+
+  ~SpanEncoderPool();
+
+  // Encodes all of `records` and appends them to the spans of `report`.
+  // Returns the CPU time spent encoding, summed over every thread.
+  std::chrono::nanoseconds Encode(std::vector<SpanRecord>& records,
+              collector::ReportRequest& report);
+
+ private:
+  Logger& logger_;
+  std::vector<std::thread> workers_;
+
+  // Worker state (protected by mutex_).
+  std::mutex mutex_;
+  std::condition_variable work_cond_;
+  std::condition_variable done_cond_;
+  bool exit_ = false;
+  size_t generation_ = 0;
+  size_t num_active_workers_ = 0;
+
+  // The batch being encoded. Only modified by Encode while no worker is
+  // active.
+  std::vector<SpanRecord>* records_ = nullptr;
+  google::protobuf::Arena* arena_ = nullptr;
+  size_t chunk_size_ = 0;
+  size_t num_chunks_ = 0;
+  std::atomic<size_t> next_chunk_{0};
+  std::atomic<int64_t> cpu_time_{0};
+  std::vector<google::protobuf::RepeatedPtrField<collector::Span>> fragments_;
+  std::vector<collector::Span*> stitch_buffer_;
+
+  void RunWorker() noexcept;
+
+  void EncodeChunks() noexcept;
+};
+}  // namespace lightstep
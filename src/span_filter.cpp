@@ -0,0 +1,59 @@
+#include "span_filter.h"
+#include <cstring>
+
+namespace lightstep {
+//------------------------------------------------------------------------------
+// HasPrefix
+//------------------------------------------------------------------------------
+static bool HasPrefix(opentracing::string_view s,
+                      const std::string& prefix) noexcept {
+  return s.size() >= prefix.size() &&
+         std::memcmp(s.data(), prefix.data(), prefix.size()) == 0;
+}
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+SpanFilterTable::SpanFilterTable(SpanFilter&& span_filter) noexcept
+    : span_filter_{std::move(span_filter)} {}
+
+//------------------------------------------------------------------------------
+// empty
+//------------------------------------------------------------------------------
+bool SpanFilterTable::empty() const noexcept {
+  return span_filter_.operation_names.empty() &&
+         span_filter_.operation_name_prefixes.empty() &&
+         !span_filter_.tag_predicate;
+}
+
+//------------------------------------------------------------------------------
+// IsFiltered
+//------------------------------------------------------------------------------
+bool SpanFilterTable::IsFiltered(
+    opentracing::string_view operation_name,
+    const opentracing::StartSpanOptions& options) const noexcept try {
+  // Filter tables are expected to be small, so a linear scan is cheaper than
+  // hashing the operation name.
+  for (auto& name : span_filter_.operation_names) {
+    if (operation_name == name) {
+      return true;
+    }
+  }
+  for (auto& prefix : span_filter_.operation_name_prefixes) {
+    if (HasPrefix(operation_name, prefix)) {
+      return true;
+    }
+  }
+  if (span_filter_.tag_predicate) {
+    for (auto& tag : options.tags) {
+      if (span_filter_.tag_predicate(tag.first, tag.second)) {
+        return true;
+      }
+    }
+  }
+  return false;
+} catch (const std::exception& /*e*/) {
+  // Don't filter spans if the tag predicate fails.
+  return false;
+}
+}  // namespace lightstep
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <lightstep/tracer.h>
+#include <opentracing/tracer.h>
+
+namespace lightstep {
+// SpanFilterTable is an immutable view of a SpanFilter that's checked when
+// spans are started.
+class SpanFilterTable {
+ public:
+  explicit SpanFilterTable(SpanFilter&& span_filter) noexcept;
+
+  // Returns true if no span can be filtered by the table.
+  bool empty() const noexcept;
+
+  // Returns true if a span started with `operation_name` and `options` should
+  // be discarded.
+  bool IsFiltered(opentracing::string_view operation_name,
+                  const opentracing::StartSpanOptions& options) const
+      noexcept;
+
+ private:
+  SpanFilter span_filter_;
+};
+}  // namespace lightstep
@@ -0,0 +1,171 @@
+#include "span_limits.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+namespace lightstep {
+// Replaces values nested past SpanLimits::max_json_depth.
+const char* const TruncatedValue = "...";
+
+//------------------------------------------------------------------------------
+// ToLimitedKey
+//------------------------------------------------------------------------------
+opentracing::string_view ToLimitedKey(const SpanLimits& span_limits,
+                                      opentracing::string_view key,
+                                      SpanTruncationCounts& counts) noexcept {
+  if (key.size() <= span_limits.max_key_length) {
+    return key;
+  }
+  ++counts.num_truncated_values;
+  return opentracing::string_view{key.data(), span_limits.max_key_length};
+}
+
+//------------------------------------------------------------------------------
+// ToLimitedValue
+//------------------------------------------------------------------------------
+static opentracing::Value ToLimitedValue(const SpanLimits& span_limits,
+                                         const opentracing::Value& value,
+                                         size_t depth,
+                                         size_t& num_elements_left,
+                                         SpanTruncationCounts& counts);
+
+namespace {
+struct LimitedValueVisitor {
+  const SpanLimits& span_limits;
+  size_t depth;
+  size_t& num_elements_left;
+  SpanTruncationCounts& counts;
+
+  // Takes one element from what's left of the value's max_json_elements, or
+  // counts the `num_remaining` elements of the container as dropped if none
+  // are left. Elements are taken in order, including those of nested values.
+  bool TakeElement(size_t num_remaining) const noexcept {
+    if (num_elements_left == 0) {
+      counts.num_dropped_values += num_remaining;
+      return false;
+    }
+    --num_elements_left;
+    return true;
+  }
+
+  opentracing::Value operator()(bool value) const { return value; }
+
+  opentracing::Value operator()(double value) const { return value; }
+
+  opentracing::Value operator()(int64_t value) const { return value; }
+
+  opentracing::Value operator()(uint64_t value) const { return value; }
+
+  opentracing::Value operator()(const std::string& s) const {
+    if (s.size() <= span_limits.max_value_length) {
+      return s;
+    }
+    ++counts.num_truncated_values;
+    return s.substr(0, span_limits.max_value_length);
+  }
+
+  opentracing::Value operator()(std::nullptr_t) const { return nullptr; }
+
+  opentracing::Value operator()(const char* s) const {
+    if (s == nullptr) {
+      return nullptr;
+    }
+    // Don't scan past the limit of a long string.
+    auto size = ::strnlen(s, span_limits.max_value_length + 1);
+    if (size > span_limits.max_value_length) {
+      ++counts.num_truncated_values;
+      size = span_limits.max_value_length;
+    }
+    return std::string{s, size};
+  }
+
+  opentracing::Value operator()(const opentracing::Values& values) const {
+    if (depth >= span_limits.max_json_depth) {
+      ++counts.num_truncated_values;
+      return TruncatedValue;
+    }
+    opentracing::Values result;
+    result.reserve(std::min(values.size(), num_elements_left));
+    for (size_t i = 0; i < values.size(); ++i) {
+      if (!TakeElement(values.size() - i)) {
+        break;
+      }
+      result.emplace_back(ToLimitedValue(span_limits, values[i], depth + 1,
+                                         num_elements_left, counts));
+    }
+    return result;
+  }
+
+  opentracing::Value operator()(
+      const opentracing::Dictionary& dictionary) const {
+    if (depth >= span_limits.max_json_depth) {
+      ++counts.num_truncated_values;
+      return TruncatedValue;
+    }
+    opentracing::Dictionary result;
+    result.reserve(std::min(dictionary.size(), num_elements_left));
+    size_t i = 0;
+    for (auto key_value = dictionary.begin(); key_value != dictionary.end();
+         ++key_value, ++i) {
+      if (!TakeElement(dictionary.size() - i)) {
+        break;
+      }
+      auto key = ToLimitedKey(span_limits, key_value->first, counts);
+      std::string limited_key{key.data(), key.size()};
+
+      // Keys that are only distinct past max_key_length keep the first value.
+      if (result.find(limited_key) != result.end()) {
+        ++counts.num_dropped_values;
+        continue;
+      }
+      result.emplace(std::move(limited_key),
+                     ToLimitedValue(span_limits, key_value->second, depth + 1,
+                                    num_elements_left, counts));
+    }
+    return result;
+  }
+};
+}  // anonymous namespace
+
+static opentracing::Value ToLimitedValue(const SpanLimits& span_limits,
+                                         const opentracing::Value& value,
+                                         size_t depth,
+                                         size_t& num_elements_left,
+                                         SpanTruncationCounts& counts) {
+  return apply_visitor(
+      LimitedValueVisitor{span_limits, depth, num_elements_left, counts},
+      value);
+}
+
+opentracing::Value ToLimitedValue(const SpanLimits& span_limits,
+                                  const opentracing::Value& value,
+                                  SpanTruncationCounts& counts) {
+  auto num_elements_left = span_limits.max_json_elements;
+  return ToLimitedValue(span_limits, value, 0, num_elements_left, counts);
+}
+
+//------------------------------------------------------------------------------
+// AddTruncationTags
+//------------------------------------------------------------------------------
+void AddTruncationTags(
+    const SpanTruncationCounts& counts,
+    std::unordered_map<std::string, opentracing::Value>& tags) {
+  if (counts.num_dropped_tags > 0) {
+    tags["lightstep.dropped_tags"] =
+        static_cast<uint64_t>(counts.num_dropped_tags);
+  }
+  if (counts.num_dropped_logs > 0) {
+    tags["lightstep.dropped_logs"] =
+        static_cast<uint64_t>(counts.num_dropped_logs);
+  }
+  if (counts.num_truncated_values > 0) {
+    tags["lightstep.truncated_values"] =
+        static_cast<uint64_t>(counts.num_truncated_values);
+  }
+  if (counts.num_dropped_values > 0) {
+    tags["lightstep.dropped_values"] =
+        static_cast<uint64_t>(counts.num_dropped_values);
+  }
+}
+}  // namespace lightstep
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <opentracing/string_view.h>
+#include <opentracing/value.h>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+namespace lightstep {
+// SpanLimits bounds the data held by a span. See LightStepTracerOptions.
+struct SpanLimits {
+  size_t max_tags = 1000;
+  size_t max_logs = 1000;
+  size_t max_key_length = 256;
+  size_t max_value_length = 16384;
+  size_t max_json_depth = 8;
+  size_t max_json_elements = 1000;
+};
+
+// Counts the data dropped from a span for exceeding its SpanLimits. Non-zero
+// counts are added to the span as tags when it's finished.
+struct SpanTruncationCounts {
+  size_t num_dropped_tags = 0;
+  size_t num_dropped_logs = 0;
+  size_t num_truncated_values = 0;
+  size_t num_dropped_values = 0;
+};
+
+// Returns the part of `key` that fits within `span_limits`.
+opentracing::string_view ToLimitedKey(const SpanLimits& span_limits,
+                                      opentracing::string_view key,
+                                      SpanTruncationCounts& counts) noexcept;
+
+// Returns an owned copy of `value` (see ToOwnedValue) that fits within
+// `span_limits`. Only as much of `value` as fits is read: longer strings are
+// cut off at `max_value_length`, and Values or Dictionary nested deeper than
+// `max_json_depth` are replaced by the string "...". At most
+// `max_json_elements` elements of Values or Dictionary, counted across all
+// levels of nesting, are copied; the rest are dropped, as are the values of
+// keys that collide once they're cut off.
+opentracing::Value ToLimitedValue(const SpanLimits& span_limits,
+                                  const opentracing::Value& value,
+                                  SpanTruncationCounts& counts);
+
+// Adds a tag to `tags` for each non-zero count in `counts`.
+void AddTruncationTags(
+    const SpanTruncationCounts& counts,
+    std::unordered_map<std::string, opentracing::Value>& tags);
+}  // namespace lightstep
@@ -0,0 +1,198 @@
+#include "span_record.h"
+#include <cstring>
+#include "clock.h"
+#include "utility.h"
+
+namespace lightstep {
+// The bytes taken up by a span's ids, timestamps and duration, and by each
+// key-value pair and reference, apart from the size of their strings.
+const size_t SpanEncodingOverhead = 48;
+const size_t KeyValueEncodingOverhead = 8;
+const size_t ReferenceEncodingOverhead = 24;
+
+//------------------------------------------------------------------------------
+// EstimateValueSize
+//------------------------------------------------------------------------------
+static size_t EstimateValueSize(const opentracing::Value& value) noexcept;
+
+namespace {
+struct ValueSizeVisitor {
+  size_t operator()(bool /*value*/) const noexcept { return 1; }
+
+  size_t operator()(double /*value*/) const noexcept { return 8; }
+
+  size_t operator()(int64_t /*value*/) const noexcept { return 8; }
+
+  size_t operator()(uint64_t /*value*/) const noexcept { return 8; }
+
+  size_t operator()(const std::string& s) const noexcept { return s.size(); }
+
+  size_t operator()(std::nullptr_t) const noexcept { return 1; }
+
+  size_t operator()(const char* s) const noexcept { return std::strlen(s); }
+
+  // Values and dictionaries are encoded as JSON.
+  size_t operator()(const opentracing::Values& values) const noexcept {
+    size_t result = 2;
+    for (auto& value : values) {
+      result += EstimateValueSize(value) + 1;
+    }
+    return result;
+  }
+
+  size_t operator()(const opentracing::Dictionary& dictionary) const noexcept {
+    size_t result = 2;
+    for (auto& key_value : dictionary) {
+      result += key_value.first.size() + EstimateValueSize(key_value.second) +
+                4;
+    }
+    return result;
+  }
+};
+}  // namespace
+
+static size_t EstimateValueSize(const opentracing::Value& value) noexcept {
+  return apply_visitor(ValueSizeVisitor{}, value);
+}
+
+//------------------------------------------------------------------------------
+// EstimateEncodedSize
+//------------------------------------------------------------------------------
+size_t EstimateEncodedSize(opentracing::string_view key,
+                           const opentracing::Value& value) noexcept {
+  return KeyValueEncodingOverhead + key.size() + EstimateValueSize(value);
+}
+
+size_t EstimateEncodedSize(const SpanRecord::Log& log_record) noexcept {
+  size_t result = KeyValueEncodingOverhead;
+  for (auto& field : log_record.fields) {
+    result += EstimateEncodedSize(field.first, field.second);
+  }
+  return result;
+}
+
+size_t EstimateEncodedSize(const SpanRecord& record) noexcept {
+  size_t result = SpanEncodingOverhead + record.operation_name.size() +
+                  ReferenceEncodingOverhead * record.references.size();
+  for (auto& tag : record.tags) {
+    result += EstimateEncodedSize(tag.first, tag.second);
+  }
+  for (auto& log_record : record.logs) {
+    result += EstimateEncodedSize(log_record);
+  }
+  for (auto& baggage_item : record.baggage) {
+    result += KeyValueEncodingOverhead + baggage_item.first.size() +
+              baggage_item.second.size();
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// EncodeSpanRecordImpl
+//------------------------------------------------------------------------------
+// Strings are moved out of `record` unless it's const, in which case they're
+// copied.
+template <class Record>
+static void EncodeSpanRecordImpl(Logger& logger, Record& record,
+                                 collector::Span& span) {
+  // Set the span context.
+  auto span_context = span.mutable_span_context();
+  span_context->set_trace_id(record.trace_id);
+  span_context->set_span_id(record.span_id);
+  auto baggage = span_context->mutable_baggage();
+  for (auto& baggage_item : record.baggage) {
+    using StringMap = google::protobuf::Map<std::string, std::string>;
+    baggage->insert(StringMap::value_type(std::move(baggage_item.first),
+                                          std::move(baggage_item.second)));
+  }
+
+  span.set_operation_name(std::move(record.operation_name));
+
+  // Set references.
+  auto references = span.mutable_references();
+  references->Reserve(static_cast<int>(record.references.size()));
+  for (auto& reference : record.references) {
+    auto collector_reference = references->Add();
+    switch (reference.type) {
+      case opentracing::SpanReferenceType::ChildOfRef:
+        collector_reference->set_relationship(collector::Reference::CHILD_OF);
+        break;
+      case opentracing::SpanReferenceType::FollowsFromRef:
+        collector_reference->set_relationship(
+            collector::Reference::FOLLOWS_FROM);
+        break;
+    }
+    collector_reference->mutable_span_context()->set_trace_id(
+        reference.trace_id);
+    collector_reference->mutable_span_context()->set_span_id(
+        reference.span_id);
+  }
+
+  // Set timing information.
+  auto start_timestamp = record.start_timestamp;
+  if (start_timestamp == std::chrono::system_clock::time_point{}) {
+    start_timestamp = ToSystemTime(record.start_steady_timestamp);
+  }
+  *span.mutable_start_timestamp() = ToTimestamp(start_timestamp);
+  span.set_duration_micros(
+      std::chrono::duration_cast<std::chrono::microseconds>(record.duration)
+          .count());
+
+  // Set tags and logs.
+  auto tags = span.mutable_tags();
+  tags->Reserve(static_cast<int>(record.tags.size()));
+  for (const auto& tag : record.tags) {
+    try {
+      auto key_value = ToKeyValue(tag.first, tag.second);
+      *tags->Add() = std::move(key_value);
+    } catch (const std::exception& e) {
+      logger.Error(R"(Dropping tag for key ")", tag.first, R"(": )", e.what());
+    }
+  }
+  auto logs = span.mutable_logs();
+  logs->Reserve(static_cast<int>(record.logs.size()));
+  for (const auto& log_record : record.logs) {
+    try {
+      collector::Log log;
+      auto timestamp = log_record.timestamp;
+      if (timestamp == std::chrono::system_clock::time_point{}) {
+        timestamp = ToSystemTime(log_record.steady_timestamp);
+      }
+      *log.mutable_timestamp() = ToTimestamp(timestamp);
+      auto key_values = log.mutable_fields();
+      key_values->Reserve(static_cast<int>(log_record.fields.size()));
+      for (auto& field : log_record.fields) {
+        *key_values->Add() = ToKeyValue(field.first, field.second);
+      }
+      *logs->Add() = std::move(log);
+    } catch (const std::exception& e) {
+      logger.Error("Dropping log record: ", e.what());
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// EncodeSpanRecord
+//------------------------------------------------------------------------------
+void EncodeSpanRecord(Logger& logger, SpanRecord&& record,
+                      collector::Span& span) {
+  EncodeSpanRecordImpl(logger, record, span);
+}
+
+void EncodeSpanRecord(Logger& logger, const SpanRecord& record,
+                      collector::Span& span) {
+  EncodeSpanRecordImpl(logger, record, span);
+}
+
+//------------------------------------------------------------------------------
+// EncodeSpanRecords
+//------------------------------------------------------------------------------
+void EncodeSpanRecords(Logger& logger, std::vector<SpanRecord>& records,
+                       collector::ReportRequest& report) {
+  auto spans = report.mutable_spans();
+  spans->Reserve(spans->size() + static_cast<int>(records.size()));
+  for (auto& record : records) {
+    EncodeSpanRecord(logger, std::move(record), *spans->Add());
+  }
+}
+}  // namespace lightstep
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <opentracing/span.h>
+#include <opentracing/value.h>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "lightstep-tracer-common/collector.pb.h"
+#include "logger.h"
+
+namespace lightstep {
+// SpanRecord holds the data of a finished span in the form it was collected.
+// It's cheap to build on the application's thread; the protobuf and JSON
+// encoding is left to the recorder, which calls EncodeSpanRecord when it's
+// ready to send a report.
+//
+// A SpanRecord must own all of its data: values are converted with
+// ToOwnedValue so that no `const char*` outlives the call that set it.
+struct SpanRecord {
+  struct Reference {
+    opentracing::SpanReferenceType type;
+    uint64_t trace_id;
+    uint64_t span_id;
+  };
+
+  // Like the span's start, a log record logged by the span only keeps a
+  // steady timestamp. If `timestamp` isn't set, it's computed from
+  // `steady_timestamp` when the record is encoded.
+  struct Log {
+    std::chrono::system_clock::time_point timestamp;
+    std::chrono::steady_clock::time_point steady_timestamp;
+    std::vector<std::pair<std::string, opentracing::Value>> fields;
+  };
+
+  uint64_t trace_id = 0;
+  uint64_t span_id = 0;
+  std::string operation_name;
+  std::vector<Reference> references;
+  // If start_timestamp isn't set, it's computed from start_steady_timestamp
+  // when the record is encoded.
+  std::chrono::system_clock::time_point start_timestamp;
+  std::chrono::steady_clock::time_point start_steady_timestamp;
+  std::chrono::steady_clock::duration duration{};
+  std::unordered_map<std::string, opentracing::Value> tags;
+  std::vector<Log> logs;
+  std::unordered_map<std::string, std::string> baggage;
+};
+
+// Estimate the number of bytes a tag, log record or span takes up when
+// encoded. They're used to account for the memory of spans without encoding
+// them; see MemoryBudget.
+size_t EstimateEncodedSize(opentracing::string_view key,
+                           const opentracing::Value& value) noexcept;
+
+size_t EstimateEncodedSize(const SpanRecord::Log& log_record) noexcept;
+
+size_t EstimateEncodedSize(const SpanRecord& record) noexcept;
+
+// Encodes `record` into the collector's protobuf representation. Tags and log
+// records that fail to encode are dropped and logged to `logger`.
+void EncodeSpanRecord(Logger& logger, SpanRecord&& record,
+                      collector::Span& span);
+
+// Encodes a copy of `record`, leaving it intact.
+void EncodeSpanRecord(Logger& logger, const SpanRecord& record,
+                      collector::Span& span);
+
+// Encodes all of `records` and appends them to the spans of `report`.
+void EncodeSpanRecords(Logger& logger, std::vector<SpanRecord>& records,
+                       collector::ReportRequest& report);
+}  // namespace lightstep
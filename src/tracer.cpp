@@ -63,8 +63,7 @@ const std::string& CollectorMethodName() {
 //------------------------------------------------------------------------------
 opentracing::expected<std::array<uint64_t, 2>> LightStepTracer::GetTraceSpanIds(
     const opentracing::SpanContext& span_context) const noexcept {
-  auto lightstep_span_context =
-      dynamic_cast<const LightStepSpanContext*>(&span_context);
+  auto lightstep_span_context = AsLightStepSpanContext(&span_context);
   if (lightstep_span_context == nullptr) {
     return opentracing::make_unexpected(
         opentracing::invalid_span_context_error);
@@ -89,6 +88,41 @@ LightStepTracer::MakeSpanContext(
       std::make_error_code(std::errc::not_enough_memory));
 }
 
+//------------------------------------------------------------------------------
+// MakePropagationOptions
+//------------------------------------------------------------------------------
+static PropagationOptions MakePropagationOptions(
+    const LightStepTracerOptions& options) {
+  PropagationOptions propagation_options{};
+  propagation_options.use_single_key = options.use_single_key_propagation;
+  propagation_options.propagation_modes = options.propagation_modes;
+  if (propagation_options.propagation_modes.empty()) {
+    propagation_options.propagation_modes = {PropagationMode::lightstep};
+  }
+  propagation_options.use_compact_single_key =
+      options.use_compact_single_key_propagation;
+  auto& baggage_limits = propagation_options.baggage_limits;
+  baggage_limits.max_items = options.max_baggage_items;
+  baggage_limits.max_key_length = options.max_baggage_key_length;
+  baggage_limits.max_value_length = options.max_baggage_value_length;
+  baggage_limits.max_bytes = options.max_baggage_bytes;
+  return propagation_options;
+}
+
+//------------------------------------------------------------------------------
+// MakeSpanLimits
+//------------------------------------------------------------------------------
+static SpanLimits MakeSpanLimits(const LightStepTracerOptions& options) {
+  SpanLimits span_limits;
+  span_limits.max_tags = options.max_tags_per_span;
+  span_limits.max_logs = options.max_logs_per_span;
+  span_limits.max_key_length = options.max_tag_key_length;
+  span_limits.max_value_length = options.max_tag_value_length;
+  span_limits.max_json_depth = options.max_tag_json_depth;
+  span_limits.max_json_elements = options.max_tag_json_elements;
+  return span_limits;
+}
+
 //------------------------------------------------------------------------------
 // MakeThreadedTracer
 //------------------------------------------------------------------------------
@@ -107,12 +141,16 @@ static std::shared_ptr<LightStepTracer> MakeThreadedTracer(
   } else {
     transporter = MakeGrpcTransporter(*logger, options);
   }
-  PropagationOptions propagation_options{};
-  propagation_options.use_single_key = options.use_single_key_propagation;
+  auto propagation_options = MakePropagationOptions(options);
+  auto span_limits = MakeSpanLimits(options);
+  auto span_filter = std::move(options.span_filter);
   auto recorder = std::unique_ptr<Recorder>{
       new AutoRecorder{*logger, std::move(options), std::move(transporter)}};
-  return std::shared_ptr<LightStepTracer>{new LightStepTracerImpl{
-      std::move(logger), propagation_options, std::move(recorder)}};
+  auto tracer = std::shared_ptr<LightStepTracer>{new LightStepTracerImpl{
+      std::move(logger), propagation_options, span_limits,
+      std::move(recorder)}};
+  tracer->SetSpanFilter(std::move(span_filter));
+  return tracer;
 }
 
 //------------------------------------------------------------------------------
@@ -135,12 +173,16 @@ static std::shared_ptr<LightStepTracer> MakeSingleThreadedTracer(
         "`options.transporter` must be set if `options.use_thread` is false");
     return nullptr;
   }
-  PropagationOptions propagation_options{};
-  propagation_options.use_single_key = options.use_single_key_propagation;
+  auto propagation_options = MakePropagationOptions(options);
+  auto span_limits = MakeSpanLimits(options);
+  auto span_filter = std::move(options.span_filter);
   auto recorder = std::unique_ptr<Recorder>{
       new ManualRecorder{*logger, std::move(options), std::move(transporter)}};
-  return std::shared_ptr<LightStepTracer>{new LightStepTracerImpl{
-      std::move(logger), propagation_options, std::move(recorder)}};
+  auto tracer = std::shared_ptr<LightStepTracer>{new LightStepTracerImpl{
+      std::move(logger), propagation_options, span_limits,
+      std::move(recorder)}};
+  tracer->SetSpanFilter(std::move(span_filter));
+  return tracer;
 }
 
 //------------------------------------------------------------------------------
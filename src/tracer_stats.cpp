@@ -0,0 +1,18 @@
+#include "tracer_stats.h"
+
+namespace lightstep {
+//------------------------------------------------------------------------------
+// snapshot
+//------------------------------------------------------------------------------
+TracerStats TracerStatsCounters::snapshot() const noexcept {
+  auto totals = counters_.Sum();
+  TracerStats result;
+  result.num_spans_started = totals[spans_started];
+  result.num_spans_finished = totals[spans_finished];
+  result.num_spans_sampled_out = totals[spans_sampled_out];
+  result.num_spans_dropped = totals[spans_dropped];
+  result.num_spans_sent = totals[spans_sent];
+  result.num_spans_aggregated = totals[spans_aggregated];
+  return result;
+}
+}  // namespace lightstep
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <lightstep/tracer.h>
+#include <cstddef>
+#include "utility.h"
+
+namespace lightstep {
+// TracerStatsCounters counts spans as they pass through the tracer. Updates
+// from the recording path are lock-free, and a snapshot can be taken at any
+// rate.
+class TracerStatsCounters {
+ public:
+  void OnSpanStarted() noexcept { Add(spans_started, 1); }
+
+  void OnSpanFinished() noexcept { Add(spans_finished, 1); }
+
+  void OnSpanSampledOut() noexcept { Add(spans_sampled_out, 1); }
+
+  void OnSpansDropped(size_t num_spans) noexcept {
+    Add(spans_dropped, num_spans);
+  }
+
+  void OnSpansSent(size_t num_spans) noexcept { Add(spans_sent, num_spans); }
+
+  void OnSpanAggregated() noexcept { Add(spans_aggregated, 1); }
+
+  TracerStats snapshot() const noexcept;
+
+ private:
+  enum Counter {
+    spans_started = 0,
+    spans_finished,
+    spans_sampled_out,
+    spans_dropped,
+    spans_sent,
+    spans_aggregated,
+    num_counters
+  };
+
+  ShardedCounters<num_counters> counters_;
+
+  void Add(Counter counter, size_t n) noexcept { counters_.Add(counter, n); }
+};
+}  // namespace lightstep
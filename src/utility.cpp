@@ -1,9 +1,14 @@
 #include "utility.h"
 #include <opentracing/string_view.h>
 #include <opentracing/value.h>
+#include <pthread.h>
+#include <time.h>
 #include <unistd.h>
+#include <atomic>
 #include <cmath>
+#include <cstdlib>
 #include <iomanip>
+#include <new>
 #include <random>
 #include <sstream>
 #include <stdexcept>
@@ -24,12 +29,152 @@ google::protobuf::Timestamp ToTimestamp(
   return ts;
 }
 
+namespace {
+// IdGenerator holds the state of a xoshiro256++ generator. See
+// http://prng.di.unimi.it/
+//
+// It's left zero-initialized so that the thread_local instance doesn't need
+// a constructor; `fork_generation` is zero until the state is seeded.
+struct IdGenerator {
+  uint64_t state[4];
+  uint64_t fork_generation;
+};
+
+// Incremented in the child after each fork so that every thread reseeds
+// rather than repeating the ids generated by the parent.
+std::atomic<uint64_t> ForkGeneration{1};
+
+thread_local IdGenerator IdGeneratorInstance;
+}  // namespace
+
+//------------------------------------------------------------------------------
+// OnForkChild
+//------------------------------------------------------------------------------
+static void OnForkChild() {
+  ForkGeneration.fetch_add(1, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// SplitMix64
+//------------------------------------------------------------------------------
+static uint64_t SplitMix64(uint64_t& x) noexcept {
+  uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+//------------------------------------------------------------------------------
+// RotateLeft
+//------------------------------------------------------------------------------
+static inline uint64_t RotateLeft(uint64_t x, int k) noexcept {
+  return (x << k) | (x >> (64 - k));
+}
+
+//------------------------------------------------------------------------------
+// SeedIdGenerator
+//------------------------------------------------------------------------------
+// Seeds from a per-process random value mixed with the thread and the pid, so
+// that only the first thread to generate an id pays for std::random_device.
+static void SeedIdGenerator(IdGenerator& generator,
+                            uint64_t fork_generation) {
+  static const uint64_t process_seed = [] {
+    pthread_atfork(nullptr, nullptr, OnForkChild);
+    std::random_device random_device;
+    return (static_cast<uint64_t>(random_device()) << 32) ^ random_device();
+  }();
+  static std::atomic<uint64_t> num_seeded{0};
+  auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+  uint64_t seed = process_seed;
+  seed ^= num_seeded.fetch_add(1, std::memory_order_relaxed) *
+          0x9e3779b97f4a7c15ULL;
+  seed ^= static_cast<uint64_t>(::getpid()) << 32;
+  seed ^= static_cast<uint64_t>(now);
+  for (auto& x : generator.state) {
+    x = SplitMix64(seed);
+  }
+  generator.fork_generation = fork_generation;
+}
+
+//------------------------------------------------------------------------------
+// GetIdGenerator
+//------------------------------------------------------------------------------
+static IdGenerator& GetIdGenerator() {
+  auto& generator = IdGeneratorInstance;
+  auto fork_generation = ForkGeneration.load(std::memory_order_relaxed);
+  if (generator.fork_generation != fork_generation) {
+    SeedIdGenerator(generator, fork_generation);
+  }
+  return generator;
+}
+
+//------------------------------------------------------------------------------
+// NextId
+//------------------------------------------------------------------------------
+static inline uint64_t NextId(IdGenerator& generator) noexcept {
+  auto& s = generator.state;
+  auto result = RotateLeft(s[0] + s[3], 23) + s[0];
+  auto t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = RotateLeft(s[3], 45);
+  return result;
+}
+
 //------------------------------------------------------------------------------
 // GenerateId
 //------------------------------------------------------------------------------
-uint64_t GenerateId() {
-  static thread_local std::mt19937_64 rand_source{std::random_device()()};
-  return rand_source();
+uint64_t GenerateId() { return NextId(GetIdGenerator()); }
+
+//------------------------------------------------------------------------------
+// GenerateIds
+//------------------------------------------------------------------------------
+void GenerateIds(uint64_t* ids, size_t num_ids) {
+  auto& generator = GetIdGenerator();
+  for (size_t i = 0; i < num_ids; ++i) {
+    ids[i] = NextId(generator);
+  }
+}
+
+//------------------------------------------------------------------------------
+// GetThreadShardIndex
+//------------------------------------------------------------------------------
+size_t GetThreadShardIndex() noexcept {
+  static std::atomic<size_t> next_index{0};
+  static thread_local size_t index =
+      next_index.fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+
+//------------------------------------------------------------------------------
+// AllocateCacheAligned
+//------------------------------------------------------------------------------
+void* AllocateCacheAligned(size_t size) {
+  void* result;
+  if (::posix_memalign(&result, CacheLineSize, size) != 0) {
+    throw std::bad_alloc{};
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// FreeCacheAligned
+//------------------------------------------------------------------------------
+void FreeCacheAligned(void* ptr) noexcept { std::free(ptr); }
+
+//------------------------------------------------------------------------------
+// GetThreadCpuTime
+//------------------------------------------------------------------------------
+std::chrono::nanoseconds GetThreadCpuTime() noexcept {
+  timespec cpu_time;
+  if (::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_time) != 0) {
+    return std::chrono::nanoseconds{0};
+  }
+  return std::chrono::seconds{cpu_time.tv_sec} +
+         std::chrono::nanoseconds{cpu_time.tv_nsec};
 }
 
 //------------------------------------------------------------------------------
@@ -217,6 +362,55 @@ collector::KeyValue ToKeyValue(opentracing::string_view key,
   return key_value;
 }
 
+//------------------------------------------------------------------------------
+// ToOwnedValue
+//------------------------------------------------------------------------------
+namespace {
+struct OwnedValueVisitor {
+  opentracing::Value operator()(bool value) const { return value; }
+
+  opentracing::Value operator()(double value) const { return value; }
+
+  opentracing::Value operator()(int64_t value) const { return value; }
+
+  opentracing::Value operator()(uint64_t value) const { return value; }
+
+  opentracing::Value operator()(const std::string& s) const { return s; }
+
+  opentracing::Value operator()(std::nullptr_t) const { return nullptr; }
+
+  opentracing::Value operator()(const char* s) const {
+    if (s == nullptr) {
+      return nullptr;
+    }
+    return std::string{s};
+  }
+
+  opentracing::Value operator()(const opentracing::Values& values) const {
+    opentracing::Values result;
+    result.reserve(values.size());
+    for (auto& value : values) {
+      result.emplace_back(ToOwnedValue(value));
+    }
+    return result;
+  }
+
+  opentracing::Value operator()(
+      const opentracing::Dictionary& dictionary) const {
+    opentracing::Dictionary result;
+    result.reserve(dictionary.size());
+    for (auto& key_value : dictionary) {
+      result.emplace(key_value.first, ToOwnedValue(key_value.second));
+    }
+    return result;
+  }
+};
+}  // anonymous namespace
+
+opentracing::Value ToOwnedValue(const opentracing::Value& value) {
+  return apply_visitor(OwnedValueVisitor{}, value);
+}
+
 //------------------------------------------------------------------------------
 // LogReportResponse
 //------------------------------------------------------------------------------
@@ -2,7 +2,11 @@
 
 #include <opentracing/string_view.h>
 #include <opentracing/value.h>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include "lightstep-tracer-common/collector.pb.h"
 #include "logger.h"
@@ -13,9 +17,103 @@ namespace lightstep {
 google::protobuf::Timestamp ToTimestamp(
     const std::chrono::system_clock::time_point& t);
 
-// Generates a random uint64_t.
+// Generates a random uint64_t. Each thread has its own generator, which is
+// reseeded after a fork so that child processes don't repeat the parent's ids.
 uint64_t GenerateId();
 
+// Generates `num_ids` random ids, e.g. a trace id and span id for a root span.
+void GenerateIds(uint64_t* ids, size_t num_ids);
+
+// Returns a small index that's fixed for the calling thread. It's used to
+// spread updates to shared counters across shards so that threads don't
+// contend on the same cache line.
+size_t GetThreadShardIndex() noexcept;
+
+const size_t CacheLineSize = 64;
+
+// Allocate and free memory aligned to a cache line. Before C++17, operator new
+// only guarantees the alignment of max_align_t, so types declared with a
+// larger alignment use these instead.
+void* AllocateCacheAligned(size_t size);
+
+void FreeCacheAligned(void* ptr) noexcept;
+
+// ShardedCounters holds `NumCounters` counters that are sharded by thread, so
+// that adding to them is lock-free and threads don't contend. Reading them
+// sums the shards without locking.
+template <size_t NumCounters>
+class ShardedCounters {
+ public:
+  static const size_t num_shards = 8;
+
+  ShardedCounters() : shards_{new Shards{}} {}
+
+  void Add(size_t counter, uint64_t n,
+           std::memory_order order = std::memory_order_relaxed) noexcept {
+    shards_->shards[GetThreadShardIndex() % num_shards]
+        .counts[counter]
+        .fetch_add(n, order);
+  }
+
+  // Returns the total of `counter`.
+  uint64_t Sum(size_t counter,
+               std::memory_order order = std::memory_order_relaxed) const
+      noexcept {
+    uint64_t result = 0;
+    for (auto& shard : shards_->shards) {
+      result += shard.counts[counter].load(order);
+    }
+    return result;
+  }
+
+  // Returns the total of each counter.
+  std::array<uint64_t, NumCounters> Sum() const noexcept {
+    std::array<uint64_t, NumCounters> result{};
+    for (auto& shard : shards_->shards) {
+      for (size_t i = 0; i < NumCounters; ++i) {
+        result[i] += shard.counts[i].load(std::memory_order_relaxed);
+      }
+    }
+    return result;
+  }
+
+  // Returns the total of each counter and resets them to zero.
+  std::array<uint64_t, NumCounters> Exchange() noexcept {
+    std::array<uint64_t, NumCounters> result{};
+    for (auto& shard : shards_->shards) {
+      for (size_t i = 0; i < NumCounters; ++i) {
+        result[i] += shard.counts[i].exchange(0, std::memory_order_relaxed);
+      }
+    }
+    return result;
+  }
+
+ private:
+  // Each shard starts on its own cache line.
+  struct alignas(CacheLineSize) Shard {
+    std::array<std::atomic<uint64_t>, NumCounters> counts{};
+  };
+
+  struct Shards {
+    std::array<Shard, num_shards> shards;
+
+    static void* operator new(size_t size) {
+      return AllocateCacheAligned(size);
+    }
+
+    static void operator delete(void* ptr) noexcept { FreeCacheAligned(ptr); }
+  };
+
+  std::unique_ptr<Shards> shards_;
+};
+
+template <size_t NumCounters>
+const size_t ShardedCounters<NumCounters>::num_shards;
+
+// Returns the CPU time consumed by the calling thread, or zero if it can't be
+// measured.
+std::chrono::nanoseconds GetThreadCpuTime() noexcept;
+
 // Attempts to determine the name of the executable invoked.  Returns
 // "c++-program" if unsuccessful.
 std::string GetProgramName();
@@ -25,6 +123,10 @@ std::string GetProgramName();
 collector::KeyValue ToKeyValue(opentracing::string_view key,
                                const opentracing::Value& value);
 
+// Returns a copy of `value` that doesn't reference memory it doesn't own;
+// `const char*` strings, including nested ones, are copied into std::strings.
+opentracing::Value ToOwnedValue(const opentracing::Value& value);
+
 // Logs any information returned by the collector.
 void LogReportResponse(Logger& logger, bool verbose,
                        const collector::ReportResponse& response);
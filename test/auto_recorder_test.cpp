@@ -1,7 +1,11 @@
 #include "../src/auto_recorder.h"
 #include <lightstep/tracer.h>
+#include <algorithm>
 #include <atomic>
+#include <thread>
+#include "../src/buffer_pool.h"
 #include "../src/lightstep_tracer_impl.h"
+#include "../src/span_encoder_pool.h"
 #include "counting_metrics_observer.h"
 #include "in_memory_sync_transporter.h"
 #include "testing_condition_variable_wrapper.h"
@@ -13,6 +17,57 @@
 using namespace lightstep;
 using namespace opentracing;
 
+namespace {
+// SimulatedNumaTopology lets each thread pick the node it's running on and
+// records the node every slab is bound to.
+class SimulatedNumaTopology final : public NumaTopology {
+ public:
+  struct Binding {
+    const char* data;
+    size_t size;
+    int node;
+  };
+
+  explicit SimulatedNumaTopology(int num_nodes) : num_nodes_{num_nodes} {}
+
+  static void set_current_node(int node) { thread_node() = node; }
+
+  int num_nodes() const noexcept override { return num_nodes_; }
+
+  int current_node() const noexcept override { return thread_node(); }
+
+  bool BindToNode(void* data, size_t size, int node) const
+      noexcept override {
+    std::lock_guard<std::mutex> lock_guard{mutex_};
+    bindings_.push_back(Binding{static_cast<const char*>(data), size, node});
+    return true;
+  }
+
+  // Returns the node of the slab containing `data`, or -1 if it didn't come
+  // from a slab.
+  int node_of(const void* data) const {
+    std::lock_guard<std::mutex> lock_guard{mutex_};
+    auto ptr = static_cast<const char*>(data);
+    for (auto& binding : bindings_) {
+      if (ptr >= binding.data && ptr < binding.data + binding.size) {
+        return binding.node;
+      }
+    }
+    return -1;
+  }
+
+ private:
+  int num_nodes_;
+  mutable std::mutex mutex_;
+  mutable std::vector<Binding> bindings_;
+
+  static int& thread_node() {
+    static thread_local int node = 0;
+    return node;
+  }
+};
+}  // namespace
+
 TEST_CASE("auto_recorder") {
   Logger logger{};
   auto metrics_observer = new CountingMetricsObserver{};
@@ -181,6 +236,25 @@ TEST_CASE("auto_recorder") {
     condition_variable->WaitTillNextEvent();
     CHECK(metrics_observer->num_spans_sent == max_buffered_spans);
     CHECK(metrics_observer->num_spans_dropped == 1);
+    CHECK(metrics_observer->num_dropped(SpanDropReason::buffer_full) == 1);
+    CHECK(metrics_observer->last_num_buffered_spans == max_buffered_spans);
+    CHECK(metrics_observer->last_max_buffered_spans == max_buffered_spans);
+  }
+
+  SECTION(
+      "The MetricsObserver is told when the writer thread wakes up and when "
+      "a report is encoded and sent.") {
+    condition_variable->WaitTillNextEvent();
+    auto span = tracer->StartSpan("abc");
+    span->Finish();
+    condition_variable->Step();
+    condition_variable->WaitTillNextEvent();
+    CHECK(metrics_observer->num_writer_wakeups == 1);
+    CHECK(metrics_observer->last_num_buffered_spans == 1);
+    CHECK(metrics_observer->num_reports_encoded == 1);
+    CHECK(metrics_observer->num_report_bytes ==
+          in_memory_transporter->reports().at(0).ByteSizeLong());
+    CHECK(metrics_observer->num_reports_sent == 1);
   }
 
   SECTION(
@@ -218,3 +292,278 @@ TEST_CASE("auto_recorder") {
     condition_variable->WaitTillNextEvent();
   }
 }
+
+TEST_CASE("span_encoder_pool") {
+  Logger logger{};
+  SpanEncoderPool encoder_pool{logger, 3};
+
+  SECTION(
+      "Spans encoded in parallel are added to the report in the order they "
+      "were recorded.") {
+    for (int report_index = 0; report_index < 2; ++report_index) {
+      const size_t num_spans = 1000;
+      std::vector<SpanRecord> records(num_spans);
+      for (size_t i = 0; i < num_spans; ++i) {
+        records[i].span_id = i;
+        records[i].operation_name = "abc";
+        records[i].tags.emplace("index", static_cast<uint64_t>(i));
+      }
+      collector::ReportRequest report;
+      encoder_pool.Encode(records, report);
+      REQUIRE(report.spans_size() == num_spans);
+      for (size_t i = 0; i < num_spans; ++i) {
+        auto& span = report.spans(static_cast<int>(i));
+        CHECK(span.span_context().span_id() == i);
+        CHECK(HasTag(span, "index", static_cast<uint64_t>(i)));
+      }
+    }
+  }
+
+  SECTION("Spans are created on the report's arena when it has one.") {
+    const size_t num_spans = 1000;
+    std::vector<SpanRecord> records(num_spans);
+    for (size_t i = 0; i < num_spans; ++i) {
+      records[i].span_id = i;
+      records[i].operation_name = "abc";
+    }
+    google::protobuf::Arena arena;
+    auto report =
+        google::protobuf::Arena::CreateMessage<collector::ReportRequest>(
+            &arena);
+    encoder_pool.Encode(records, *report);
+    REQUIRE(report->spans_size() == num_spans);
+    for (size_t i = 0; i < num_spans; ++i) {
+      auto& span = report->spans(static_cast<int>(i));
+      CHECK(span.GetArena() == &arena);
+      CHECK(span.span_context().span_id() == i);
+    }
+  }
+}
+
+TEST_CASE("buffer_pool") {
+  auto topology = new SimulatedNumaTopology{2};
+  BufferPoolOptions options;
+  options.block_size = 1024;
+  options.slab_size = 4 * 1024;
+  options.max_slabs_per_node = 1;
+  options.use_huge_pages = false;
+  BufferPool pool{std::unique_ptr<NumaTopology>{topology}, options};
+  const size_t blocks_per_slab = 3;
+  SimulatedNumaTopology::set_current_node(1);
+
+  SECTION("Blocks come from the node of the calling thread.") {
+    auto block = pool.Allocate(100);
+    REQUIRE(block != nullptr);
+    CHECK(topology->node_of(block) == 1);
+    CHECK(pool.stats().num_slabs == 1);
+    CHECK(pool.stats().num_local_allocations == 1);
+    pool.Deallocate(block, 100);
+  }
+
+  SECTION("Freed blocks are reused.") {
+    auto block1 = pool.Allocate(100);
+    pool.Deallocate(block1, 100);
+    auto block2 = pool.Allocate(100);
+    CHECK(block1 == block2);
+    pool.Deallocate(block2, 100);
+  }
+
+  SECTION("Blocks freed on another node return to the node they came from.") {
+    auto block = pool.Allocate(100);
+    std::thread{[&] {
+      SimulatedNumaTopology::set_current_node(0);
+      pool.Deallocate(block, 100);
+    }}.join();
+    auto reused_block = pool.Allocate(100);
+    CHECK(reused_block == block);
+    CHECK(pool.stats().num_local_allocations == 2);
+    pool.Deallocate(reused_block, 100);
+  }
+
+  SECTION(
+      "When a node is out of slabs, blocks are taken from other nodes and "
+      "then from the heap.") {
+    SimulatedNumaTopology::set_current_node(0);
+    auto remote_block = pool.Allocate(100);
+    pool.Deallocate(remote_block, 100);
+    SimulatedNumaTopology::set_current_node(1);
+    std::vector<void*> blocks;
+    for (size_t i = 0; i < 2 * blocks_per_slab + 1; ++i) {
+      blocks.push_back(pool.Allocate(100));
+      REQUIRE(blocks.back() != nullptr);
+    }
+    auto stats = pool.stats();
+    CHECK(stats.num_slabs == 2);
+    CHECK(stats.num_local_allocations == 1 + blocks_per_slab);
+    CHECK(stats.num_remote_allocations == blocks_per_slab);
+    CHECK(stats.num_heap_allocations == 1);
+    CHECK(topology->node_of(blocks.back()) == -1);
+    for (auto block : blocks) {
+      pool.Deallocate(block, 100);
+    }
+  }
+
+  SECTION("Allocations larger than a block come from the heap.") {
+    auto block = pool.Allocate(options.block_size + 1);
+    REQUIRE(block != nullptr);
+    std::fill_n(static_cast<char*>(block), options.block_size + 1, 'x');
+    CHECK(pool.stats().num_heap_allocations == 1);
+    CHECK(pool.stats().num_slabs == 0);
+    pool.Deallocate(block, options.block_size + 1);
+  }
+}
+
+TEST_CASE("buffer_pool release") {
+  BufferPoolOptions options;
+  options.block_size = 1024;
+  options.slab_size = 4 * 1024;
+  options.max_slabs_per_node = 32;
+  options.use_huge_pages = false;
+  BufferPool pool{
+      std::unique_ptr<NumaTopology>{new SimulatedNumaTopology{1}}, options};
+  const size_t blocks_per_slab = 3;
+  const size_t num_slabs = 30;
+  const size_t window_size = 16;
+  SimulatedNumaTopology::set_current_node(0);
+  std::vector<void*> blocks;
+  for (size_t i = 0; i < num_slabs * blocks_per_slab; ++i) {
+    blocks.push_back(pool.Allocate(100));
+    REQUIRE(blocks.back() != nullptr);
+  }
+  REQUIRE(pool.stats().num_slabs == num_slabs);
+
+  // Once the burst has passed out of both of the retention policy's windows,
+  // only enough slabs for BufferRetentionPolicy::min_retained_capacity blocks
+  // are kept.
+  const size_t num_retained_slabs =
+      BufferRetentionPolicy::min_retained_capacity / blocks_per_slab;
+
+  SECTION("Slabs aren't released while a burst is recent.") {
+    for (auto block : blocks) {
+      pool.Deallocate(block, 100);
+    }
+    for (size_t i = 0; i < window_size; ++i) {
+      pool.ReleaseIdleSlabs();
+    }
+    CHECK(pool.stats().num_slabs == num_slabs);
+    CHECK(pool.stats().num_released_slabs == 0);
+  }
+
+  SECTION("Idle slabs are released once a burst has passed.") {
+    for (auto block : blocks) {
+      pool.Deallocate(block, 100);
+    }
+    for (size_t i = 0; i < 2 * window_size; ++i) {
+      pool.ReleaseIdleSlabs();
+    }
+    CHECK(pool.stats().num_slabs == num_retained_slabs);
+    CHECK(pool.stats().num_released_slabs == num_slabs - num_retained_slabs);
+    auto block = pool.Allocate(100);
+    CHECK(block != nullptr);
+    CHECK(pool.stats().num_slabs == num_retained_slabs);
+    pool.Deallocate(block, 100);
+  }
+
+  SECTION("Slabs with allocated blocks are kept.") {
+    // Keep a block of each of the last slabs mapped.
+    std::vector<void*> kept_blocks;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      if (i >= (num_slabs - 10) * blocks_per_slab && i % blocks_per_slab == 0) {
+        kept_blocks.push_back(blocks[i]);
+      } else {
+        pool.Deallocate(blocks[i], 100);
+      }
+    }
+    for (size_t i = 0; i < 2 * window_size; ++i) {
+      pool.ReleaseIdleSlabs();
+    }
+    CHECK(pool.stats().num_slabs == num_retained_slabs);
+    for (auto block : kept_blocks) {
+      std::fill_n(static_cast<char*>(block), options.block_size, 'x');
+      pool.Deallocate(block, 100);
+    }
+  }
+}
+
+TEST_CASE("auto_recorder with a buffer pool") {
+  Logger logger{};
+  LightStepTracerOptions options;
+  options.reporting_period = std::chrono::milliseconds{1};
+  options.num_encoding_threads = 2;
+  options.use_buffer_pool = true;
+  auto in_memory_transporter = new InMemorySyncTransporter{};
+  auto recorder =
+      new AutoRecorder{logger, std::move(options),
+                       std::unique_ptr<SyncTransporter>{in_memory_transporter}};
+  auto tracer = std::shared_ptr<LightStepTracerImpl>{new LightStepTracerImpl{
+      PropagationOptions{}, std::unique_ptr<Recorder>{recorder}}};
+  auto stats_before = GetReportBufferPool().stats();
+
+  SECTION("Reports encoded into pooled memory are sent intact.") {
+    const size_t num_spans = 500;
+    for (size_t i = 0; i < num_spans; ++i) {
+      auto span = tracer->StartSpan("abc");
+      span->SetTag("index", static_cast<uint64_t>(i));
+      span->Finish();
+    }
+    REQUIRE(tracer->Flush());
+    auto spans = in_memory_transporter->spans();
+    REQUIRE(spans.size() == num_spans);
+    for (size_t i = 0; i < num_spans; ++i) {
+      CHECK(HasTag(spans[i], "index", static_cast<uint64_t>(i)));
+    }
+    auto stats = GetReportBufferPool().stats();
+    CHECK(stats.num_local_allocations + stats.num_remote_allocations +
+              stats.num_heap_allocations >
+          stats_before.num_local_allocations +
+              stats_before.num_remote_allocations +
+              stats_before.num_heap_allocations);
+  }
+}
+
+TEST_CASE("auto_recorder stats") {
+  Logger logger{};
+  LightStepTracerOptions options;
+  options.reporting_period = std::chrono::milliseconds{1};
+  auto in_memory_transporter = new InMemorySyncTransporter{};
+  auto recorder =
+      new AutoRecorder{logger, std::move(options),
+                       std::unique_ptr<SyncTransporter>{in_memory_transporter}};
+  auto tracer = std::shared_ptr<LightStepTracerImpl>{new LightStepTracerImpl{
+      PropagationOptions{}, std::unique_ptr<Recorder>{recorder}}};
+
+  SECTION(
+      "GetStats can be polled while spans are recorded on other threads.") {
+    const int num_threads = 4;
+    const int num_spans_per_thread = 1000;
+    std::atomic<bool> done{false};
+    std::thread poller{[&] {
+      uint64_t last_num_spans_started = 0;
+      while (!done) {
+        auto num_spans_started = tracer->GetStats().num_spans_started;
+        CHECK(num_spans_started >= last_num_spans_started);
+        last_num_spans_started = num_spans_started;
+      }
+    }};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back([&] {
+        for (int j = 0; j < num_spans_per_thread; ++j) {
+          tracer->StartSpan("abc")->Finish();
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    done = true;
+    poller.join();
+    REQUIRE(tracer->Flush());
+    auto stats = tracer->GetStats();
+    const uint64_t num_spans = num_threads * num_spans_per_thread;
+    CHECK(stats.num_spans_started == num_spans);
+    CHECK(stats.num_spans_finished == num_spans);
+    CHECK(stats.num_spans_sent + stats.num_spans_dropped == num_spans);
+    CHECK(in_memory_transporter->spans().size() == stats.num_spans_sent);
+  }
+}
@@ -11,10 +11,49 @@ struct CountingMetricsObserver : MetricsObserver {
     num_spans_dropped += num_spans;
   }
 
+  void OnSpansDroppedForReason(SpanDropReason reason, int num_spans) override {
+    num_spans_dropped_for_reason[static_cast<int>(reason)] += num_spans;
+    MetricsObserver::OnSpansDroppedForReason(reason, num_spans);
+  }
+
   void OnFlush() override { ++num_flushes; }
 
+  void OnBufferFill(size_t num_buffered_spans,
+                    size_t max_buffered_spans) override {
+    last_num_buffered_spans = num_buffered_spans;
+    last_max_buffered_spans = max_buffered_spans;
+  }
+
+  void OnReportEncoded(std::chrono::steady_clock::duration /*encode_time*/,
+                       size_t num_bytes) override {
+    ++num_reports_encoded;
+    num_report_bytes += num_bytes;
+  }
+
+  void OnReportSent(std::chrono::steady_clock::duration /*latency*/) override {
+    ++num_reports_sent;
+  }
+
+  void OnWriterWakeup() override { ++num_writer_wakeups; }
+
+  void OnBaggageItemsDropped(int num_baggage_items) override {
+    num_baggage_items_dropped += num_baggage_items;
+  }
+
+  int num_dropped(SpanDropReason reason) const {
+    return num_spans_dropped_for_reason[static_cast<int>(reason)];
+  }
+
   std::atomic<int> num_flushes{0};
   std::atomic<int> num_spans_sent{0};
   std::atomic<int> num_spans_dropped{0};
+  std::atomic<int> num_spans_dropped_for_reason[5] = {};
+  std::atomic<size_t> last_num_buffered_spans{0};
+  std::atomic<size_t> last_max_buffered_spans{0};
+  std::atomic<int> num_reports_encoded{0};
+  std::atomic<size_t> num_report_bytes{0};
+  std::atomic<int> num_reports_sent{0};
+  std::atomic<int> num_writer_wakeups{0};
+  std::atomic<int> num_baggage_items_dropped{0};
 };
 }  // namespace lightstep
@@ -4,14 +4,20 @@
 #include <stdexcept>
 #include <vector>
 #include "../src/recorder.h"
+#include "counting_metrics_observer.h"
 
 namespace lightstep {
 // InMemoryRecorder is used for testing only.
 class InMemoryRecorder : public Recorder {
  public:
-  void RecordSpan(collector::Span&& span) noexcept override {
+  explicit InMemoryRecorder(size_t max_memory_bytes = 0)
+      : memory_budget_{max_memory_bytes} {}
+
+  void RecordSpan(SpanRecord&& span) noexcept override {
+    collector::Span collector_span;
+    EncodeSpanRecord(logger_, std::move(span), collector_span);
     std::lock_guard<std::mutex> lock_guard{mutex_};
-    spans_.emplace_back(std::move(span));
+    spans_.emplace_back(std::move(collector_span));
   }
 
   std::vector<collector::Span> spans() const {
@@ -24,6 +30,16 @@ class InMemoryRecorder : public Recorder {
     return spans_.size();
   }
 
+  MetricsObserver& metrics_observer() noexcept override {
+    return metrics_observer_;
+  }
+
+  const CountingMetricsObserver& counting_metrics_observer() const noexcept {
+    return metrics_observer_;
+  }
+
+  MemoryBudget& memory_budget() noexcept override { return memory_budget_; }
+
   collector::Span top() const {
     std::lock_guard<std::mutex> lock_guard{mutex_};
     if (spans_.empty()) throw std::runtime_error("no spans");
@@ -31,6 +47,9 @@ class InMemoryRecorder : public Recorder {
   }
 
  private:
+  Logger logger_;
+  CountingMetricsObserver metrics_observer_;
+  MemoryBudget memory_budget_;
   mutable std::mutex mutex_;
   std::vector<collector::Span> spans_;
 };
@@ -1,6 +1,12 @@
 #include "../src/manual_recorder.h"
+#include <lightstep/config.h>
+#include <lightstep/flight_recorder.h>
 #include <lightstep/tracer.h>
+#include <unistd.h>
 #include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
 #include "../src/lightstep_tracer_impl.h"
 #include "counting_metrics_observer.h"
 #include "in_memory_async_transporter.h"
@@ -21,6 +27,7 @@ TEST_CASE("manual_recorder") {
   options.max_buffered_spans =
       std::function<size_t()>{[&] { return max_buffered_spans; }};
   options.metrics_observer.reset(metrics_observer);
+  options.aggregated_operations = {"aggregated"};
   auto in_memory_transporter = new InMemoryAsyncTransporter{};
   auto recorder = new ManualRecorder{
       logger, std::move(options),
@@ -67,6 +74,10 @@ TEST_CASE("manual_recorder") {
     CHECK(tracer->Flush());
     in_memory_transporter->Write();
     CHECK(LookupSpansDropped(in_memory_transporter->reports().at(0)) == 1);
+    CHECK(metrics_observer->num_dropped(SpanDropReason::transport_failure) ==
+          1);
+    CHECK(metrics_observer->num_reports_encoded == 2);
+    CHECK(metrics_observer->num_reports_sent == 1);
   }
 
   SECTION(
@@ -83,6 +94,8 @@ TEST_CASE("manual_recorder") {
     CHECK(span);
     span->Finish();
     CHECK(!tracer->Flush());
+    CHECK(metrics_observer->num_dropped(SpanDropReason::disabled) == 1);
+    CHECK(metrics_observer->num_spans_dropped == 1);
   }
 
   SECTION("Flush is called when the tracer's buffer is filled.") {
@@ -143,4 +156,282 @@ TEST_CASE("manual_recorder") {
     in_memory_transporter->Write();
     CHECK(in_memory_transporter->reports().size() == 1);
   }
+
+  SECTION(
+      "Spans of aggregated operations are sent as metrics instead of "
+      "individually.") {
+    tracer->StartSpan("aggregated")->Finish();
+    tracer->StartSpan("aggregated", {SetTag("error", true)})->Finish();
+    CHECK(tracer->Flush());
+    in_memory_transporter->Write();
+    CHECK(in_memory_transporter->reports().size() == 1);
+    auto& report = in_memory_transporter->reports().at(0);
+    CHECK(report.spans_size() == 0);
+    CHECK(report.reporter().reporter_id() != 0);
+    CHECK(LookupCount(report, "aggregate.aggregated.count") == 2);
+    CHECK(LookupCount(report, "aggregate.aggregated.errors") == 1);
+
+    // Aggregates are reset after each report.
+    tracer->StartSpan("abc")->Finish();
+    CHECK(tracer->Flush());
+    in_memory_transporter->Write();
+    CHECK(LookupCount(in_memory_transporter->reports().at(1),
+                      "aggregate.aggregated.count") == 0);
+  }
+
+  SECTION("Each report carries the tracer's health metrics.") {
+    SpanFilter span_filter;
+    span_filter.operation_names = {"filtered"};
+    tracer->SetSpanFilter(std::move(span_filter));
+    tracer->StartSpan("filtered")->Finish();
+    for (int i = 0; i < 3; ++i) {
+      tracer->StartSpan("abc")->Finish();
+    }
+    CHECK(tracer->Flush());
+    in_memory_transporter->Write();
+    auto& report = in_memory_transporter->reports().at(0);
+    REQUIRE(LookupGauge(report, "spans.buffered") != nullptr);
+    CHECK(LookupGauge(report, "spans.buffered")->int_value() == 3);
+    CHECK(LookupGauge(report, "bytes.buffered")->int_value() > 0);
+    CHECK(LookupGauge(report, "memory.bytes")->int_value() > 0);
+    CHECK(LookupGauge(report, "sampling.rate")->double_value() == 0.75);
+    CHECK(LookupGauge(report, "flush.duration_micros") != nullptr);
+    CHECK(LookupGauge(report, "encode.cpu_micros") != nullptr);
+    CHECK(LookupCount(report, "reports.failed") == 0);
+
+    // Failures are counted in the following report.
+    logger.set_level(LogLevel::off);
+    tracer->StartSpan("abc")->Finish();
+    CHECK(tracer->Flush());
+    in_memory_transporter->Fail(
+        std::make_error_code(std::errc::network_unreachable));
+    tracer->StartSpan("abc")->Finish();
+    CHECK(tracer->Flush());
+    in_memory_transporter->Write();
+    auto& next_report = in_memory_transporter->reports().at(1);
+    CHECK(LookupCount(next_report, "reports.failed") == 1);
+    CHECK(LookupGauge(next_report, "sampling.rate")->double_value() == 1.0);
+  }
+
+  SECTION("GetStats counts spans as they pass through the tracer.") {
+    SpanFilter span_filter;
+    span_filter.operation_names = {"filtered"};
+    tracer->SetSpanFilter(std::move(span_filter));
+    tracer->StartSpan("filtered")->Finish();
+    auto unsampled_span = tracer->StartSpan("abc");
+    unsampled_span->SetTag("sampling.priority", 0);
+    unsampled_span->Finish();
+    tracer->StartSpan("abc")->Finish();
+    tracer->StartSpan("abc")->Finish();
+    tracer->StartSpan("aggregated")->Finish();
+    CHECK(tracer->Flush());
+    in_memory_transporter->Write();
+    auto stats = tracer->GetStats();
+    CHECK(stats.num_spans_started == 5);
+    CHECK(stats.num_spans_finished == 5);
+    CHECK(stats.num_spans_sampled_out == 2);
+    CHECK(stats.num_spans_sent == 2);
+    CHECK(stats.num_spans_dropped == 0);
+    CHECK(stats.num_spans_aggregated == 1);
+
+    // Every finished span is accounted for.
+    CHECK(stats.num_spans_sampled_out + stats.num_spans_sent +
+              stats.num_spans_dropped + stats.num_spans_aggregated ==
+          stats.num_spans_finished);
+
+    logger.set_level(LogLevel::off);
+    tracer->StartSpan("abc")->Finish();
+    CHECK(tracer->Flush());
+    in_memory_transporter->Fail(
+        std::make_error_code(std::errc::network_unreachable));
+    stats = tracer->GetStats();
+    CHECK(stats.num_spans_sent == 2);
+    CHECK(stats.num_spans_dropped == 1);
+  }
+
+  SECTION("Memory is accounted for as spans move through the recorder.") {
+    auto span = tracer->StartSpan("abc");
+    CHECK(tracer->GetMemoryUsage().open_spans > 0);
+    span->Finish();
+    auto usage = tracer->GetMemoryUsage();
+    CHECK(usage.open_spans == 0);
+    CHECK(usage.buffered_spans > 0);
+    CHECK(tracer->Flush());
+    usage = tracer->GetMemoryUsage();
+    CHECK(usage.buffered_spans == 0);
+    CHECK(usage.inflight_reports > 0);
+    in_memory_transporter->Write();
+    CHECK(tracer->GetMemoryUsage().total() == 0);
+  }
+}
+
+TEST_CASE("flight_recorder") {
+  Logger logger{};
+  char path[] = "/tmp/lightstep_flight_recorder_XXXXXX";
+  auto fd = ::mkstemp(path);
+  REQUIRE(fd != -1);
+  ::close(fd);
+  LightStepTracerOptions options;
+  options.flight_recorder_path = path;
+  options.flight_recorder_size = 8 * 1024;
+  options.aggregated_operations = {"aggregated"};
+  auto in_memory_transporter = new InMemoryAsyncTransporter{};
+  auto recorder = new ManualRecorder{
+      logger, std::move(options),
+      std::unique_ptr<AsyncTransporter>{in_memory_transporter}};
+  auto tracer = std::shared_ptr<LightStepTracer>{new LightStepTracerImpl{
+      PropagationOptions{}, std::unique_ptr<Recorder>{recorder}}};
+
+  auto read_operation_names = [&](size_t max_spans) {
+    auto contents = ReadFlightRecorder(path, max_spans);
+    REQUIRE(contents);
+    std::vector<std::string> result;
+    for (auto& serialized_span : contents->spans) {
+      collector::Span span;
+      REQUIRE(span.ParseFromString(serialized_span));
+      result.push_back(span.operation_name());
+    }
+    return result;
+  };
+
+  SECTION("Recorded spans can be read back before they're flushed.") {
+    auto span = tracer->StartSpan("abc");
+    span->SetTag("index", 1);
+    span->Finish();
+    tracer->StartSpan("aggregated")->Finish();
+    auto contents = ReadFlightRecorder(path, 10);
+    REQUIRE(contents);
+    CHECK(contents->pid == static_cast<int>(::getpid()));
+    CHECK(!contents->finalized);
+    CHECK(!contents->closed);
+    REQUIRE(contents->spans.size() == 1);
+    collector::Span encoded_span;
+    REQUIRE(encoded_span.ParseFromString(contents->spans[0]));
+    CHECK(encoded_span.operation_name() == "abc");
+    CHECK(HasTag(encoded_span, "index", 1));
+  }
+
+  SECTION("Only the most recent spans are kept, oldest first.") {
+    const int num_spans = 1000;
+    for (int i = 0; i < num_spans; ++i) {
+      tracer->StartSpan(std::to_string(i))->Finish();
+    }
+    auto operation_names = read_operation_names(num_spans);
+    REQUIRE(!operation_names.empty());
+    CHECK(operation_names.size() < num_spans);
+    auto first = num_spans - static_cast<int>(operation_names.size());
+    for (size_t i = 0; i < operation_names.size(); ++i) {
+      CHECK(operation_names[i] == std::to_string(first + static_cast<int>(i)));
+    }
+
+    operation_names = read_operation_names(3);
+    CHECK(operation_names == std::vector<std::string>{"997", "998", "999"});
+  }
+
+  SECTION("Finalizing marks the file so a crash can be told apart.") {
+    FinalizeFlightRecorders();
+    auto contents = ReadFlightRecorder(path, 10);
+    REQUIRE(contents);
+    CHECK(contents->finalized);
+    CHECK(!contents->closed);
+  }
+
+  SECTION("The file is marked as closed when the tracer is destroyed.") {
+    tracer->StartSpan("abc")->Finish();
+    tracer.reset();
+    auto contents = ReadFlightRecorder(path, 10);
+    REQUIRE(contents);
+    CHECK(contents->closed);
+    CHECK(contents->spans.size() == 1);
+  }
+
+  SECTION("The ring can be found inside a larger file such as a core file.") {
+    tracer->StartSpan("abc")->Finish();
+    std::ostringstream ring;
+    ring << std::ifstream{path}.rdbuf();
+    std::string core_path = std::string{path} + ".core";
+    {
+      std::ofstream core{core_path};
+      core << std::string(4096, 'x') << ring.str() << std::string(100, 'y');
+    }
+    auto contents = ReadFlightRecorder(core_path, 10);
+    ::unlink(core_path.c_str());
+    REQUIRE(contents);
+    CHECK(contents->spans.size() == 1);
+  }
+
+  SECTION("Reading a file without a flight recorder fails.") {
+    std::string other_path = std::string{path} + ".other";
+    {
+      std::ofstream other{other_path};
+      other << std::string(4096, 'x');
+    }
+    CHECK(!ReadFlightRecorder(other_path, 10));
+    ::unlink(other_path.c_str());
+  }
+
+  tracer.reset();
+  ::unlink(path);
+}
+
+#ifdef LIGHTSTEP_ENABLE_PROFILING
+TEST_CASE("profiling") {
+  Logger logger{};
+  LightStepTracerOptions options;
+  options.enable_profiling = true;
+  auto in_memory_transporter = new InMemoryAsyncTransporter{};
+  auto recorder = new ManualRecorder{
+      logger, std::move(options),
+      std::unique_ptr<AsyncTransporter>{in_memory_transporter}};
+  auto tracer = std::shared_ptr<LightStepTracer>{new LightStepTracerImpl{
+      PropagationOptions{}, std::unique_ptr<Recorder>{recorder}}};
+  REQUIRE(recorder->profiler() != nullptr);
+
+  auto lookup_gauge = [](const collector::ReportRequest& report,
+                         opentracing::string_view name) {
+    auto gauge = LookupGauge(report, name);
+    REQUIRE(gauge != nullptr);
+    return gauge->int_value();
+  };
+
+  SECTION("Each stage's time and calls are sent with the next report.") {
+    for (int i = 0; i < 3; ++i) {
+      auto span = tracer->StartSpan("abc");
+      span->SetTag("index", i);
+      span->SetTag("other", i);
+      span->Finish();
+    }
+    CHECK(tracer->Flush());
+    in_memory_transporter->Write();
+    auto& report = in_memory_transporter->reports().at(0);
+    CHECK(lookup_gauge(report, "profile.start_span.count") == 3);
+    CHECK(lookup_gauge(report, "profile.set_tag.count") == 6);
+    CHECK(lookup_gauge(report, "profile.finish_span.count") == 3);
+    CHECK(lookup_gauge(report, "profile.record_span.count") == 3);
+    CHECK(lookup_gauge(report, "profile.finish_span.nanos") >=
+          lookup_gauge(report, "profile.record_span.nanos"));
+    CHECK(lookup_gauge(report, "profile.nanos_per_span") > 0);
+
+    // The encoding and sending of a report are sent with the following one.
+    CHECK(lookup_gauge(report, "profile.encode.count") == 0);
+    tracer->StartSpan("abc")->Finish();
+    CHECK(tracer->Flush());
+    in_memory_transporter->Write();
+    auto& next_report = in_memory_transporter->reports().at(1);
+    CHECK(lookup_gauge(next_report, "profile.encode.count") == 1);
+    CHECK(lookup_gauge(next_report, "profile.send.count") == 1);
+    CHECK(lookup_gauge(next_report, "profile.start_span.count") == 1);
+  }
+
+  SECTION("Finishing a span again isn't profiled.") {
+    auto span = tracer->StartSpan("abc");
+    span->Finish();
+    span->Finish();
+    span.reset();
+    CHECK(tracer->Flush());
+    in_memory_transporter->Write();
+    auto& report = in_memory_transporter->reports().at(0);
+    CHECK(lookup_gauge(report, "profile.finish_span.count") == 1);
+  }
 }
+#endif
@@ -1,12 +1,18 @@
 #include <google/protobuf/util/message_differencer.h>
+#include <lightstep/batch_carrier_writer.h>
 #include <lightstep/binary_carrier.h>
 #include <lightstep/tracer.h>
+#include <opentracing/ext/tags.h>
 #include <opentracing/noop.h>
 #include <algorithm>
 #include <cctype>
 #include <sstream>
 #include <string>
 #include <unordered_map>
+#include <vector>
+#include "../src/binary_carrier_format.h"
+#include "../src/carrier_key_matcher.h"
+#include "../src/encoded_baggage.h"
 #include "../src/lightstep_span_context.h"
 #include "../src/lightstep_tracer_impl.h"
 #include "../src/utility.h"
@@ -91,6 +97,63 @@ struct HTTPHeadersCarrier : opentracing::HTTPHeadersReader,
   std::unordered_map<std::string, std::string>& text_map;
 };
 
+//------------------------------------------------------------------------------
+// HeaderListCarrier
+//------------------------------------------------------------------------------
+// HeaderListCarrier reads headers in order and, unlike a map, can hold repeated
+// keys.
+struct HeaderListCarrier : opentracing::HTTPHeadersReader {
+  HeaderListCarrier(
+      std::vector<std::pair<std::string, std::string>>& headers_)
+      : headers(headers_) {}
+
+  opentracing::expected<void> ForeachKey(
+      std::function<opentracing::expected<void>(opentracing::string_view key,
+                                                opentracing::string_view value)>
+          f) const override {
+    for (const auto& key_value : headers) {
+      auto result = f(key_value.first, key_value.second);
+      if (!result) return result;
+    }
+    return {};
+  }
+
+  std::vector<std::pair<std::string, std::string>>& headers;
+};
+
+//------------------------------------------------------------------------------
+// BatchTextMapCarrier
+//------------------------------------------------------------------------------
+struct BatchTextMapCarrier : opentracing::TextMapWriter, BatchCarrierWriter {
+  BatchTextMapCarrier(std::unordered_map<std::string, std::string>& text_map_)
+      : text_map(text_map_) {}
+
+  opentracing::expected<void> Set(
+      opentracing::string_view key,
+      opentracing::string_view value) const override {
+    ++set_call_count;
+    text_map[key] = value;
+    return {};
+  }
+
+  opentracing::expected<void> SetBatch(const CarrierField* fields,
+                                       size_t num_fields,
+                                       size_t total_size) const override {
+    ++set_batch_call_count;
+    last_total_size = total_size;
+    text_map.reserve(text_map.size() + num_fields);
+    for (size_t i = 0; i < num_fields; ++i) {
+      text_map[fields[i].key] = fields[i].value;
+    }
+    return {};
+  }
+
+  mutable int set_call_count = 0;
+  mutable int set_batch_call_count = 0;
+  mutable size_t last_total_size = 0;
+  std::unordered_map<std::string, std::string>& text_map;
+};
+
 //------------------------------------------------------------------------------
 // are_span_contexts_equivalent
 //------------------------------------------------------------------------------
@@ -158,6 +221,106 @@ TEST_CASE("propagation") {
     }
   }
 
+  SECTION("Injected headers are re-encoded when the span context changes.") {
+    auto span = tracer->StartSpan("a");
+    CHECK(span);
+    CHECK(tracer->Inject(span->context(), text_map_carrier));
+    auto injection_map1 = text_map;
+
+    // The headers are saved by the second inject and reused by the third.
+    for (int i = 0; i < 2; ++i) {
+      text_map.clear();
+      CHECK(tracer->Inject(span->context(), text_map_carrier));
+      CHECK(injection_map1 == text_map);
+    }
+
+    span->SetBaggageItem("abc", "123");
+    for (int i = 0; i < 3; ++i) {
+      text_map.clear();
+      CHECK(tracer->Inject(span->context(), text_map_carrier));
+      CHECK(text_map.size() == injection_map1.size() + 1);
+    }
+
+    span->SetTag(opentracing::ext::sampling_priority, 0);
+    auto injection_map2 = text_map;
+    text_map.clear();
+    CHECK(tracer->Inject(span->context(), text_map_carrier));
+    CHECK(text_map.size() == injection_map2.size());
+    CHECK(text_map != injection_map2);
+  }
+
+  SECTION("Batch carriers receive every field in a single call.") {
+    BatchTextMapCarrier batch_carrier(text_map);
+    auto span = tracer->StartSpan("a");
+    span->SetBaggageItem("abc", "123");
+    auto lightstep_tracer = AsLightStepTracer(*tracer);
+    REQUIRE(lightstep_tracer != nullptr);
+    for (int i = 1; i <= 3; ++i) {
+      text_map.clear();
+      CHECK(lightstep_tracer->InjectBatch(span->context(), batch_carrier));
+      CHECK(batch_carrier.set_call_count == 0);
+      CHECK(batch_carrier.set_batch_call_count == i);
+      size_t total_size = 0;
+      for (auto& key_value : text_map) {
+        total_size += key_value.first.size() + key_value.second.size();
+      }
+      CHECK(batch_carrier.last_total_size == total_size);
+    }
+
+    auto batch_map = text_map;
+    text_map.clear();
+    CHECK(tracer->Inject(span->context(), text_map_carrier));
+    CHECK(batch_map == text_map);
+  }
+
+  SECTION("Baggage of an extracted span context is forwarded to children.") {
+    text_map = {{"ot-tracer-traceid", "123"},
+                {"ot-tracer-spanid", "456"},
+                {"ot-tracer-sampled", "true"},
+                {"ot-baggage-abc", "123"},
+                {"ot-baggage-xyz", "qrz"}};
+    auto span_context_maybe = tracer->Extract(text_map_carrier);
+    CHECK((span_context_maybe && span_context_maybe->get()));
+    auto span = tracer->StartSpan(
+        "a", {opentracing::ChildOf(span_context_maybe->get())});
+    CHECK(span);
+    text_map.clear();
+    CHECK(tracer->Inject(span->context(), text_map_carrier));
+    CHECK(text_map["ot-baggage-abc"] == "123");
+    CHECK(text_map["ot-baggage-xyz"] == "qrz");
+    CHECK(span->BaggageItem("abc") == "123");
+    span->SetBaggageItem("def", "789");
+    CHECK(span->BaggageItem("xyz") == "qrz");
+    CHECK(span->BaggageItem("def") == "789");
+  }
+
+  SECTION("Only the first value of a repeated baggage key is extracted.") {
+    std::vector<std::pair<std::string, std::string>> headers = {
+        {"ot-tracer-traceid", "7b"},
+        {"ot-tracer-spanid", "1c8"},
+        {"ot-tracer-sampled", "true"},
+        {"ot-baggage-abc", "123"},
+        {"ot-baggage-xyz", "456"},
+        {"OT-BAGGAGE-abc", "789"}};
+    auto span_context_maybe = tracer->Extract(HeaderListCarrier{headers});
+    CHECK((span_context_maybe && span_context_maybe->get()));
+    CHECK(tracer->Inject(*span_context_maybe->get(), text_map_carrier));
+    CHECK(text_map.size() == 5);
+    CHECK(text_map["ot-baggage-abc"] == "123");
+    CHECK(dynamic_cast<const LightStepSpanContext&>(*span_context_maybe->get())
+              .baggage_item("abc") == "123");
+  }
+
+  SECTION("Extracted span contexts reuse the memory of freed contexts.") {
+    CHECK(tracer->Inject(*test_span_contexts[0], text_map_carrier));
+    auto span_context_maybe = tracer->Extract(text_map_carrier);
+    CHECK((span_context_maybe && span_context_maybe->get()));
+    auto address = span_context_maybe->get();
+    span_context_maybe->reset();
+    span_context_maybe = tracer->Extract(text_map_carrier);
+    CHECK((span_context_maybe && span_context_maybe->get() == address));
+  }
+
   SECTION("Inject, extract, inject yields the same BinaryCarrier.") {
     for (auto& span_context : test_span_contexts) {
       CHECK(
@@ -173,6 +336,61 @@ TEST_CASE("propagation") {
     }
   }
 
+  SECTION("Inject, extract into a buffer produces the same span context.") {
+    for (auto& span_context : test_span_contexts) {
+      auto size_maybe = LightStepBufferWriter::ComputeSize(*span_context);
+      CHECK(size_maybe);
+      std::string buffer(*size_maybe, ' ');
+      LightStepBufferWriter buffer_writer{&buffer[0], buffer.size()};
+      CHECK(tracer->Inject(*span_context, buffer_writer));
+      CHECK(buffer_writer.num_bytes_written() == buffer.size());
+      auto span_context_maybe = tracer->Extract(
+          LightStepBufferReader{buffer.data(), buffer.size()});
+      CHECK((span_context_maybe && span_context_maybe->get()));
+      CHECK(are_span_contexts_equivalent(*tracer, *span_context,
+                                         *span_context_maybe->get()));
+      CHECK(dynamic_cast<const LightStepSpanContext&>(*span_context)
+                .sampled() ==
+            dynamic_cast<const LightStepSpanContext&>(
+                *span_context_maybe->get())
+                .sampled());
+
+      LightStepBufferWriter small_buffer_writer{&buffer[0],
+                                                buffer.size() - 1};
+      auto was_successful = tracer->Inject(*span_context, small_buffer_writer);
+      CHECK(!was_successful);
+      CHECK(was_successful.error() ==
+            std::make_error_code(std::errc::no_buffer_space));
+    }
+    auto span_context_maybe = tracer->Extract(LightStepBufferReader{"", 0});
+    CHECK((span_context_maybe && span_context_maybe->get() == nullptr));
+  }
+
+  SECTION("Baggage extracted from a buffer is limited.") {
+    auto span = tracer->StartSpan("a");
+    CHECK(span);
+    span->SetBaggageItem("abc", "123");
+    std::string buffer(*LightStepBufferWriter::ComputeSize(span->context()),
+                       ' ');
+    CHECK(tracer->Inject(span->context(),
+                         LightStepBufferWriter{&buffer[0], buffer.size()}));
+
+    PropagationOptions propagation_options;
+    propagation_options.baggage_limits.max_value_length = 2;
+    auto limited_recorder = new InMemoryRecorder{};
+    auto limited_tracer =
+        std::shared_ptr<opentracing::Tracer>{new LightStepTracerImpl{
+            propagation_options, std::unique_ptr<Recorder>{limited_recorder}}};
+    auto span_context_maybe = limited_tracer->Extract(
+        LightStepBufferReader{buffer.data(), buffer.size()});
+    CHECK((span_context_maybe && span_context_maybe->get()));
+    auto& span_context =
+        dynamic_cast<const LightStepSpanContext&>(*span_context_maybe->get());
+    CHECK(span_context.baggage_item("abc").empty());
+    CHECK(limited_recorder->counting_metrics_observer()
+              .num_baggage_items_dropped == 1);
+  }
+
   SECTION(
       "Inject, extract, inject into binary produces the same span context.") {
     for (auto& span_context : test_span_contexts) {
@@ -197,6 +415,17 @@ TEST_CASE("propagation") {
     CHECK(span_context_maybe->get() == nullptr);
   }
 
+  SECTION("Only LightStep span contexts are recovered from a SpanContext.") {
+    auto noop_span = opentracing::MakeNoopTracer()->StartSpan("a");
+    CHECK(noop_span);
+    CHECK(AsLightStepSpanContext(nullptr) == nullptr);
+    CHECK(AsLightStepSpanContext(&noop_span->context()) == nullptr);
+    CHECK(AsLightStepSpanContext(test_span_contexts[0].get()) ==
+          test_span_contexts[0].get());
+    CHECK(AsLightStepTracer(*tracer) == tracer.get());
+    CHECK(AsLightStepTracer(noop_span->tracer()) == nullptr);
+  }
+
   SECTION(
       "Injecting a non-LightStep span returns invalid_span_context_error.") {
     auto noop_tracer = opentracing::MakeNoopTracer();
@@ -330,6 +559,61 @@ TEST_CASE("propagation - single key") {
     CHECK(text_map_carrier.foreach_key_call_count == 1);
   }
 
+  SECTION("Single-key injection preserves the span and trace ids.") {
+    auto span_context_maybe = tracer->Extract(text_map_carrier);
+    CHECK((span_context_maybe && span_context_maybe->get()));
+    auto& span_context =
+        dynamic_cast<const LightStepSpanContext&>(*span_context_maybe->get());
+    auto& original_context =
+        dynamic_cast<const LightStepSpanContext&>(span->context());
+    CHECK(span_context.trace_id() == original_context.trace_id());
+    CHECK(span_context.span_id() == original_context.span_id());
+    CHECK(span_context.sampled());
+    CHECK(span_context.baggage_item("abc") == "123");
+  }
+
+  SECTION("The compact single-key encoding round-trips.") {
+    propagation_options.use_compact_single_key = true;
+    auto compact_tracer =
+        std::shared_ptr<opentracing::Tracer>{new LightStepTracerImpl{
+            propagation_options,
+            std::unique_ptr<Recorder>{new InMemoryRecorder{}}}};
+    auto binary_value = text_map.begin()->second;
+    text_map.clear();
+    CHECK(compact_tracer->Inject(span->context(), text_map_carrier));
+    CHECK(text_map.size() == 1);
+    CHECK(text_map.begin()->second.size() < binary_value.size());
+
+    // Both tracers accept either encoding.
+    for (auto& extract_tracer : {tracer, compact_tracer}) {
+      auto span_context_maybe = extract_tracer->Extract(text_map_carrier);
+      CHECK((span_context_maybe && span_context_maybe->get()));
+      auto& span_context = dynamic_cast<const LightStepSpanContext&>(
+          *span_context_maybe->get());
+      auto& original_context =
+          dynamic_cast<const LightStepSpanContext&>(span->context());
+      CHECK(span_context.trace_id() == original_context.trace_id());
+      CHECK(span_context.span_id() == original_context.span_id());
+      CHECK(span_context.sampled());
+      CHECK(span_context.baggage_item("abc") == "123");
+    }
+  }
+
+  SECTION("Extracted baggage is limited.") {
+    propagation_options.baggage_limits.max_value_length = 2;
+    auto limited_recorder = new InMemoryRecorder{};
+    auto limited_tracer =
+        std::shared_ptr<opentracing::Tracer>{new LightStepTracerImpl{
+            propagation_options, std::unique_ptr<Recorder>{limited_recorder}}};
+    auto span_context_maybe = limited_tracer->Extract(text_map_carrier);
+    CHECK((span_context_maybe && span_context_maybe->get()));
+    auto& span_context =
+        dynamic_cast<const LightStepSpanContext&>(*span_context_maybe->get());
+    CHECK(span_context.baggage_item("abc").empty());
+    CHECK(limited_recorder->counting_metrics_observer()
+              .num_baggage_items_dropped == 1);
+  }
+
   SECTION("Verify only valid base64 characters are used.") {
     // Follows the guidelines given in RFC-4648 on what characters are
     // permissible. See
@@ -345,3 +629,403 @@ TEST_CASE("propagation - single key") {
     CHECK(value.size() % 4 == 0);
   }
 }
+
+TEST_CASE("propagation - b3 and trace context") {
+  PropagationOptions propagation_options;
+  propagation_options.propagation_modes = {PropagationMode::trace_context,
+                                           PropagationMode::b3};
+  auto tracer = std::shared_ptr<opentracing::Tracer>{new LightStepTracerImpl{
+      propagation_options, std::unique_ptr<Recorder>{new InMemoryRecorder{}}}};
+  std::unordered_map<std::string, std::string> text_map;
+  TextMapCarrier text_map_carrier(text_map);
+  HTTPHeadersCarrier http_headers_carrier(text_map);
+
+  auto extract_ids = [&](uint64_t& trace_id, uint64_t& span_id,
+                         bool& sampled) {
+    auto span_context_maybe = tracer->Extract(http_headers_carrier);
+    REQUIRE((span_context_maybe && span_context_maybe->get()));
+    auto& span_context =
+        dynamic_cast<const LightStepSpanContext&>(*span_context_maybe->get());
+    trace_id = span_context.trace_id();
+    span_id = span_context.span_id();
+    sampled = span_context.sampled();
+  };
+  uint64_t trace_id, span_id;
+  bool sampled;
+
+  SECTION("Span contexts are injected in every format and round-trip.") {
+    auto span = tracer->StartSpan("a");
+    span->SetBaggageItem("abc", "123");
+    CHECK(tracer->Inject(span->context(), text_map_carrier));
+    CHECK(text_map.count("traceparent") == 1);
+    CHECK(text_map.count("x-b3-traceid") == 1);
+    CHECK(text_map.at("ot-baggage-abc") == "123");
+    auto span_context_maybe = tracer->Extract(text_map_carrier);
+    REQUIRE((span_context_maybe && span_context_maybe->get()));
+    CHECK(text_map_carrier.foreach_key_call_count == 1);
+    CHECK(are_span_contexts_equivalent(*tracer, span->context(),
+                                       *span_context_maybe->get()));
+  }
+
+  SECTION("traceparent headers are decoded.") {
+    text_map["Traceparent"] =
+        "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01";
+    extract_ids(trace_id, span_id, sampled);
+    CHECK(trace_id == 0x8448eb211c80319cULL);
+    CHECK(span_id == 0xb7ad6b7169203331ULL);
+    CHECK(sampled);
+  }
+
+  SECTION("Invalid traceparent headers are rejected.") {
+    for (auto value :
+         {"00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-1",
+          "00-00000000000000000000000000000000-b7ad6b7169203331-01",
+          "00-0af7651916cd43dd8448eb211c80319c-0000000000000000-01",
+          "ff-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01",
+          "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01-ab",
+          "00-0af7651916cd43dd8448eb211c80319x-b7ad6b7169203331-01"}) {
+      text_map["traceparent"] = value;
+      CHECK(!tracer->Extract(http_headers_carrier));
+    }
+  }
+
+  SECTION("The first configured format found takes precedence.") {
+    text_map["x-b3-traceid"] = "0000000000000001";
+    text_map["x-b3-spanid"] = "0000000000000002";
+    text_map["x-b3-sampled"] = "0";
+    extract_ids(trace_id, span_id, sampled);
+    CHECK(trace_id == 1);
+    CHECK(span_id == 2);
+    CHECK(!sampled);
+
+    text_map["traceparent"] =
+        "00-00000000000000000000000000000003-0000000000000004-01";
+    extract_ids(trace_id, span_id, sampled);
+    CHECK(trace_id == 3);
+    CHECK(span_id == 4);
+    CHECK(sampled);
+  }
+
+  SECTION("Single b3 headers are decoded.") {
+    text_map["b3"] =
+        "80f198ee56343ba864fe8b2a57d3eff7-e457b5a2e4d86bd1-0-05e3ac9a4f6e3b90";
+    extract_ids(trace_id, span_id, sampled);
+    CHECK(trace_id == 0x64fe8b2a57d3eff7ULL);
+    CHECK(span_id == 0xe457b5a2e4d86bd1ULL);
+    CHECK(!sampled);
+
+    text_map["b3"] = "1";
+    auto span_context_maybe = tracer->Extract(http_headers_carrier);
+    CHECK((span_context_maybe && span_context_maybe->get() == nullptr));
+  }
+}
+
+TEST_CASE("propagation - passthrough") {
+  PropagationOptions propagation_options;
+  propagation_options.propagation_modes = {
+      PropagationMode::lightstep, PropagationMode::b3,
+      PropagationMode::trace_context};
+  auto tracer = std::shared_ptr<LightStepTracer>{new LightStepTracerImpl{
+      propagation_options, std::unique_ptr<Recorder>{new InMemoryRecorder{}}}};
+  std::unordered_map<std::string, std::string> inbound;
+  HTTPHeadersCarrier inbound_carrier(inbound);
+
+  auto span = tracer->StartSpan("a");
+  span->SetBaggageItem("abc", "123");
+  REQUIRE(tracer->Inject(span->context(), inbound_carrier));
+
+  SECTION("Passthrough extraction reads the ids but skips baggage.") {
+    auto span_context_maybe = tracer->ExtractPassthrough(inbound_carrier);
+    REQUIRE((span_context_maybe && span_context_maybe->get()));
+    auto& span_context =
+        static_cast<const LightStepSpanContext&>(*span_context_maybe->get());
+    auto& parent_context =
+        static_cast<const LightStepSpanContext&>(span->context());
+    CHECK(span_context.trace_id() == parent_context.trace_id());
+    CHECK(span_context.span_id() == parent_context.span_id());
+    CHECK(span_context.baggage_item("abc").empty());
+  }
+
+  SECTION("Passthrough injection only rewrites the span id headers.") {
+    auto span_context_maybe = tracer->ExtractPassthrough(inbound_carrier);
+    REQUIRE((span_context_maybe && span_context_maybe->get()));
+    auto child = tracer->StartSpan(
+        "b", {opentracing::ChildOf(span_context_maybe->get())});
+    auto outbound = inbound;
+    HTTPHeadersCarrier outbound_carrier(outbound);
+    REQUIRE(tracer->InjectPassthrough(child->context(), outbound_carrier));
+    CHECK(outbound.size() == inbound.size());
+    for (auto& header : inbound) {
+      auto is_span_id_header = header.first == "ot-tracer-spanid" ||
+                               header.first == "x-b3-spanid" ||
+                               header.first == "traceparent";
+      CHECK((outbound.at(header.first) != header.second) == is_span_id_header);
+    }
+
+    auto outbound_context_maybe = tracer->Extract(outbound_carrier);
+    REQUIRE((outbound_context_maybe && outbound_context_maybe->get()));
+    auto& outbound_context = static_cast<const LightStepSpanContext&>(
+        *outbound_context_maybe->get());
+    auto& child_context =
+        static_cast<const LightStepSpanContext&>(child->context());
+    CHECK(outbound_context.trace_id() == child_context.trace_id());
+    CHECK(outbound_context.span_id() == child_context.span_id());
+    CHECK(outbound_context.baggage_item("abc") == "123");
+  }
+
+  SECTION("Passthrough injection keeps the baggage of a single key.") {
+    propagation_options.use_single_key = true;
+    tracer = std::shared_ptr<LightStepTracer>{new LightStepTracerImpl{
+        propagation_options,
+        std::unique_ptr<Recorder>{new InMemoryRecorder{}}}};
+    inbound.clear();
+    span = tracer->StartSpan("a");
+    span->SetBaggageItem("abc", "123");
+    REQUIRE(tracer->Inject(span->context(), inbound_carrier));
+    auto span_context_maybe = tracer->ExtractPassthrough(inbound_carrier);
+    REQUIRE((span_context_maybe && span_context_maybe->get()));
+    auto child = tracer->StartSpan(
+        "b", {opentracing::ChildOf(span_context_maybe->get())});
+    std::unordered_map<std::string, std::string> outbound;
+    HTTPHeadersCarrier outbound_carrier(outbound);
+    REQUIRE(tracer->InjectPassthrough(child->context(), outbound_carrier));
+    auto outbound_context_maybe = tracer->Extract(outbound_carrier);
+    REQUIRE((outbound_context_maybe && outbound_context_maybe->get()));
+    auto& outbound_context = static_cast<const LightStepSpanContext&>(
+        *outbound_context_maybe->get());
+    CHECK(outbound_context.baggage_item("abc") == "123");
+    CHECK(outbound_context.span_id() ==
+          static_cast<const LightStepSpanContext&>(child->context()).span_id());
+  }
+
+  SECTION(
+      "Passthrough injection rewrites a single key even if use_single_key is "
+      "off.") {
+    auto single_key_options = propagation_options;
+    single_key_options.use_single_key = true;
+    auto single_key_tracer =
+        std::shared_ptr<LightStepTracer>{new LightStepTracerImpl{
+            single_key_options,
+            std::unique_ptr<Recorder>{new InMemoryRecorder{}}}};
+    inbound.clear();
+    span = single_key_tracer->StartSpan("a");
+    span->SetBaggageItem("abc", "123");
+    REQUIRE(single_key_tracer->Inject(span->context(), inbound_carrier));
+    auto span_context_maybe = tracer->ExtractPassthrough(inbound_carrier);
+    REQUIRE((span_context_maybe && span_context_maybe->get()));
+    auto child = tracer->StartSpan(
+        "b", {opentracing::ChildOf(span_context_maybe->get())});
+    auto outbound = inbound;
+    HTTPHeadersCarrier outbound_carrier(outbound);
+    REQUIRE(tracer->InjectPassthrough(child->context(), outbound_carrier));
+    CHECK(outbound.size() == inbound.size());
+    auto outbound_context_maybe = single_key_tracer->Extract(outbound_carrier);
+    REQUIRE((outbound_context_maybe && outbound_context_maybe->get()));
+    auto& outbound_context = static_cast<const LightStepSpanContext&>(
+        *outbound_context_maybe->get());
+    CHECK(outbound_context.baggage_item("abc") == "123");
+    CHECK(outbound_context.span_id() ==
+          static_cast<const LightStepSpanContext&>(child->context()).span_id());
+  }
+
+  SECTION("Passthrough injection only rewrites the formats it extracted.") {
+    inbound = {{"x-b3-traceid", "80f198ee56343ba864fe8b2a57d3eff7"},
+               {"x-b3-spanid", "e457b5a2e4d86bd1"},
+               {"x-b3-sampled", "1"}};
+    auto span_context_maybe = tracer->ExtractPassthrough(inbound_carrier);
+    REQUIRE((span_context_maybe && span_context_maybe->get()));
+    auto child = tracer->StartSpan(
+        "b", {opentracing::ChildOf(span_context_maybe->get())});
+    auto outbound = inbound;
+    HTTPHeadersCarrier outbound_carrier(outbound);
+    REQUIRE(tracer->InjectPassthrough(child->context(), outbound_carrier));
+    CHECK(outbound.size() == inbound.size());
+    CHECK(outbound["x-b3-traceid"] == inbound["x-b3-traceid"]);
+    CHECK(outbound["x-b3-spanid"] != inbound["x-b3-spanid"]);
+
+    auto outbound_context_maybe = tracer->Extract(outbound_carrier);
+    REQUIRE((outbound_context_maybe && outbound_context_maybe->get()));
+    CHECK(static_cast<const LightStepSpanContext&>(
+              *outbound_context_maybe->get())
+              .span_id() ==
+          static_cast<const LightStepSpanContext&>(child->context()).span_id());
+  }
+
+  SECTION("Passthrough injection rewrites a single b3 header.") {
+    inbound = {{"b3", "64fe8b2a57d3eff7-e457b5a2e4d86bd1-0-05e3ac9a4f6e3b90"}};
+    auto span_context_maybe = tracer->ExtractPassthrough(inbound_carrier);
+    REQUIRE((span_context_maybe && span_context_maybe->get()));
+    auto child = tracer->StartSpan(
+        "b", {opentracing::ChildOf(span_context_maybe->get())});
+    auto outbound = inbound;
+    HTTPHeadersCarrier outbound_carrier(outbound);
+    REQUIRE(tracer->InjectPassthrough(child->context(), outbound_carrier));
+    CHECK(outbound.size() == 1);
+
+    auto outbound_context_maybe = tracer->Extract(outbound_carrier);
+    REQUIRE((outbound_context_maybe && outbound_context_maybe->get()));
+    auto& outbound_context = static_cast<const LightStepSpanContext&>(
+        *outbound_context_maybe->get());
+    auto& child_context =
+        static_cast<const LightStepSpanContext&>(child->context());
+    CHECK(outbound_context.trace_id() == 0x64fe8b2a57d3eff7ULL);
+    CHECK(outbound_context.span_id() == child_context.span_id());
+    CHECK(!outbound_context.sampled());
+  }
+
+  SECTION("Passthrough injection rejects foreign span contexts.") {
+    auto noop_tracer = opentracing::MakeNoopTracer();
+    auto noop_span = noop_tracer->StartSpan("a");
+    std::unordered_map<std::string, std::string> outbound;
+    HTTPHeadersCarrier outbound_carrier(outbound);
+    CHECK(!tracer->InjectPassthrough(noop_span->context(), outbound_carrier));
+  }
+}
+
+TEST_CASE("binary carrier format") {
+  std::unordered_map<std::string, std::string> baggage;
+
+  SECTION("Serialization matches the protobuf serialization.") {
+    for (int num_baggage_items = 0; num_baggage_items < 2;
+         ++num_baggage_items) {
+      if (num_baggage_items == 1) {
+        baggage = {{"abc", std::string(200, 'x')}};
+      }
+      for (bool sampled : {false, true}) {
+        BinaryCarrier binary_carrier;
+        auto basic = binary_carrier.mutable_basic_ctx();
+        basic->set_trace_id(123);
+        basic->set_span_id(456);
+        basic->set_sampled(sampled);
+        basic->mutable_baggage_items()->insert(baggage.begin(), baggage.end());
+        auto expected = binary_carrier.SerializeAsString();
+
+        std::string serialization(
+            ComputeBinaryCarrierSize(123, 456, sampled, baggage), ' ');
+        CHECK(SerializeBinaryCarrier(123, 456, sampled, baggage,
+                                     &serialization[0]) ==
+              serialization.size());
+        CHECK(serialization == expected);
+      }
+    }
+  }
+
+  SECTION("Protobuf serializations can be parsed.") {
+    BinaryCarrier binary_carrier;
+    binary_carrier.add_deprecated_text_ctx("abc");
+    auto basic = binary_carrier.mutable_basic_ctx();
+    basic->set_trace_id(123);
+    basic->set_span_id(456);
+    basic->set_sampled(true);
+    (*basic->mutable_baggage_items())["abc"] = "123";
+    (*basic->mutable_baggage_items())["xyz"] = "";
+    uint64_t trace_id, span_id;
+    bool sampled;
+    CHECK(ParseBinaryCarrier(binary_carrier.SerializeAsString(), trace_id,
+                             span_id, sampled, baggage));
+    CHECK(trace_id == 123);
+    CHECK(span_id == 456);
+    CHECK(sampled);
+    CHECK(baggage ==
+          std::unordered_map<std::string, std::string>{{"abc", "123"},
+                                                       {"xyz", ""}});
+  }
+
+  SECTION("Compact serializations round-trip.") {
+    baggage = {{"abc", "123"}, {"xyz", std::string(200, 'x')}};
+    std::string serialization(ComputeCompactCarrierSize(baggage), ' ');
+    CHECK(SerializeCompactCarrier(123, 456, true, baggage,
+                                  &serialization[0]) == serialization.size());
+    uint64_t trace_id, span_id;
+    bool sampled;
+    std::unordered_map<std::string, std::string> parsed_baggage;
+    CHECK(ParseCompactCarrier(serialization, trace_id, span_id, sampled,
+                              parsed_baggage));
+    CHECK(trace_id == 123);
+    CHECK(span_id == 456);
+    CHECK(sampled);
+    CHECK(parsed_baggage == baggage);
+    for (size_t size = 1; size < MaxCompactCarrierSizeWithoutBaggage;
+         ++size) {
+      CHECK(!ParseCompactCarrier(
+          opentracing::string_view{serialization.data(), size}, trace_id,
+          span_id, sampled, parsed_baggage));
+    }
+  }
+
+  SECTION("Truncated serializations are rejected.") {
+    std::string serialization(ComputeBinaryCarrierSize(123, 456, true, baggage),
+                              ' ');
+    SerializeBinaryCarrier(123, 456, true, baggage, &serialization[0]);
+    uint64_t trace_id, span_id;
+    bool sampled;
+    for (size_t size = 1; size < serialization.size(); ++size) {
+      CHECK(!ParseBinaryCarrier(
+          opentracing::string_view{serialization.data(), size}, trace_id,
+          span_id, sampled, baggage));
+    }
+  }
+}
+
+TEST_CASE("encoded baggage") {
+  std::string encoded_baggage;
+  AppendEncodedBaggageItem("abc", "123", encoded_baggage);
+  AppendEncodedBaggageItem("xyz", std::string(200, 'x'), encoded_baggage);
+  AppendEncodedBaggageItem("abc", "456", encoded_baggage);
+
+  SECTION("Decoding keeps the last value of a repeated key.") {
+    std::unordered_map<std::string, std::string> baggage;
+    CHECK(DecodeBaggage(encoded_baggage, baggage));
+    CHECK(baggage == std::unordered_map<std::string, std::string>{
+                         {"abc", "456"}, {"xyz", std::string(200, 'x')}});
+  }
+
+  SECTION("Truncated encodings are rejected.") {
+    std::unordered_map<std::string, std::string> baggage;
+    CHECK(!DecodeBaggage(
+        opentracing::string_view{encoded_baggage.data(), 10}, baggage));
+  }
+
+  SECTION("Limits are checked without decoding.") {
+    BaggageLimits baggage_limits;
+    CHECK(IsWithinBaggageLimits(baggage_limits, encoded_baggage));
+    baggage_limits.max_items = 2;
+    CHECK(!IsWithinBaggageLimits(baggage_limits, encoded_baggage));
+    baggage_limits = BaggageLimits{};
+    baggage_limits.max_value_length = 100;
+    CHECK(!IsWithinBaggageLimits(baggage_limits, encoded_baggage));
+  }
+}
+
+TEST_CASE("carrier key matcher") {
+  CarrierKeyMatcher matcher{{"b3", "x-b3-traceid", "ot-tracer-spanid",
+                             "a-name-longer-than-sixteen-bytes"},
+                            "ot-baggage-"};
+
+  SECTION("Keys are matched against the names and the prefix.") {
+    CHECK(matcher.Match("b3", false) == 0);
+    CHECK(matcher.Match("x-b3-traceid", false) == 1);
+    CHECK(matcher.Match("ot-tracer-spanid", false) == 2);
+    CHECK(matcher.Match("a-name-longer-than-sixteen-bytes", false) == 3);
+    CHECK(matcher.Match("ot-baggage-abc", false) ==
+          CarrierKeyMatcher::PrefixMatch);
+    CHECK(matcher.Match("ot-baggage-", false) == CarrierKeyMatcher::NoMatch);
+    CHECK(matcher.Match("x-b3-traceie", false) == CarrierKeyMatcher::NoMatch);
+    CHECK(matcher.Match("a-name-longer-than-sixteen-byte5", false) ==
+          CarrierKeyMatcher::NoMatch);
+    CHECK(matcher.Match("", false) == CarrierKeyMatcher::NoMatch);
+  }
+
+  SECTION("Case is only ignored when requested.") {
+    CHECK(matcher.Match("X-B3-TraceId", false) == CarrierKeyMatcher::NoMatch);
+    CHECK(matcher.Match("X-B3-TraceId", true) == 1);
+    CHECK(matcher.Match("OT-Baggage-abc", true) ==
+          CarrierKeyMatcher::PrefixMatch);
+  }
+
+  SECTION("Only letters are folded when ignoring case.") {
+    // '\r' | 0x20 == '-', so a naive fold would match these.
+    CHECK(matcher.Match("x\rb3\rtraceid", true) == CarrierKeyMatcher::NoMatch);
+    CHECK(matcher.Match("B\x13", true) == CarrierKeyMatcher::NoMatch);
+  }
+}
@@ -1,6 +1,9 @@
+#include <atomic>
 #include <lightstep/tracer.h>
 #include <opentracing/ext/tags.h>
 #include <opentracing/noop.h>
+#include <thread>
+#include <vector>
 #include "../src/lightstep_tracer_impl.h"
 #include "../src/utility.h"
 #include "in_memory_recorder.h"
@@ -167,6 +170,16 @@ TEST_CASE("tracer") {
     CHECK(HasTag(recorder->top(), "abc", 123));
   }
 
+  SECTION("String tags are copied when they're set.") {
+    auto span = tracer->StartSpan("a");
+    CHECK(span);
+    char value[] = "xyz";
+    span->SetTag("abc", static_cast<const char*>(value));
+    value[0] = 'w';
+    span->Finish();
+    CHECK(HasTag(recorder->top(), "abc", std::string{"xyz"}));
+  }
+
   SECTION("Logs are appended and sent to the collector.") {
     auto span = tracer->StartSpan("a");
     CHECK(span);
@@ -183,4 +196,370 @@ TEST_CASE("tracer") {
     span->FinishWithOptions(options);
     CHECK(recorder->top().logs().size() == 1);
   }
+
+  SECTION("Start timestamps are derived from the steady clock if not set.") {
+    auto before = SystemClock::now() - std::chrono::seconds{1};
+    auto span = tracer->StartSpan("a");
+    CHECK(span);
+    span->Finish();
+    auto after = SystemClock::now() + std::chrono::seconds{1};
+    auto seconds = recorder->top().start_timestamp().seconds();
+    CHECK(seconds >= SystemClock::to_time_t(before));
+    CHECK(seconds <= SystemClock::to_time_t(after));
+  }
+
+  SECTION("Log timestamps are derived from the steady clock.") {
+    auto before = SystemClock::now() - std::chrono::seconds{1};
+    auto span = tracer->StartSpan("a");
+    CHECK(span);
+    span->Log({{"abc", 123}});
+    span->Finish();
+    auto after = SystemClock::now() + std::chrono::seconds{1};
+    auto seconds = recorder->top().logs(0).timestamp().seconds();
+    CHECK(seconds >= SystemClock::to_time_t(before));
+    CHECK(seconds <= SystemClock::to_time_t(after));
+  }
+
+  SECTION("A start system timestamp that's set is kept.") {
+    opentracing::StartSpanOptions options;
+    options.start_system_timestamp =
+        SystemTime{} + std::chrono::seconds{123456789};
+    auto span = tracer->StartSpanWithOptions("a", options);
+    CHECK(span);
+    span->Finish();
+    CHECK(recorder->top().start_timestamp().seconds() == 123456789);
+  }
+}
+
+TEST_CASE("span filter") {
+  auto recorder = new InMemoryRecorder{};
+  auto tracer = std::shared_ptr<LightStepTracer>{new LightStepTracerImpl{
+      PropagationOptions{}, std::unique_ptr<Recorder>{recorder}}};
+
+  SECTION("Spans with a filtered operation name aren't recorded.") {
+    SpanFilter span_filter;
+    span_filter.operation_names = {"health_check"};
+    tracer->SetSpanFilter(std::move(span_filter));
+    auto span = tracer->StartSpan("health_check");
+    CHECK(span);
+    span->SetTag("abc", 123);
+    span->Log({{"abc", 123}});
+    span->Finish();
+    CHECK(recorder->size() == 0);
+    tracer->StartSpan("health_check_other")->Finish();
+    CHECK(recorder->size() == 1);
+  }
+
+  SECTION("Spans can be filtered by an operation name prefix.") {
+    SpanFilter span_filter;
+    span_filter.operation_name_prefixes = {"cache."};
+    tracer->SetSpanFilter(std::move(span_filter));
+    tracer->StartSpan("cache.ping")->Finish();
+    tracer->StartSpan("cache")->Finish();
+    CHECK(recorder->size() == 1);
+    CHECK(recorder->top().operation_name() == "cache");
+  }
+
+  SECTION("Spans can be filtered by their start tags.") {
+    SpanFilter span_filter;
+    span_filter.tag_predicate = [](opentracing::string_view key,
+                                   const opentracing::Value& value) {
+      return key == "component" && value == opentracing::Value{"redis"};
+    };
+    tracer->SetSpanFilter(std::move(span_filter));
+    tracer->StartSpan("a", {SetTag("component", "redis")})->Finish();
+    tracer->StartSpan("b", {SetTag("component", "grpc")})->Finish();
+    CHECK(recorder->size() == 1);
+    CHECK(recorder->top().operation_name() == "b");
+  }
+
+  SECTION(
+      "A filtered span can be propagated, but its children aren't sampled.") {
+    SpanFilter span_filter;
+    span_filter.operation_names = {"a"};
+    tracer->SetSpanFilter(std::move(span_filter));
+    auto span_a = tracer->StartSpan("a");
+    CHECK(span_a);
+    span_a->SetBaggageItem("abc", "123");
+    auto span_b = tracer->StartSpan("b", {ChildOf(&span_a->context())});
+    CHECK(span_b);
+    CHECK(span_b->BaggageItem("abc") == "123");
+    span_b->Finish();
+    CHECK(recorder->size() == 0);
+    CHECK(tracer->GetTraceSpanIds(span_a->context()));
+  }
+
+  SECTION(
+      "A filtered span is transparent to the children of a sampled parent.") {
+    SpanFilter span_filter;
+    span_filter.operation_names = {"b"};
+    tracer->SetSpanFilter(std::move(span_filter));
+    auto span_a = tracer->StartSpan("a");
+    CHECK(span_a);
+    auto span_b = tracer->StartSpan("b", {ChildOf(&span_a->context())});
+    CHECK(span_b);
+    CHECK(*tracer->GetTraceSpanIds(span_b->context()) ==
+          *tracer->GetTraceSpanIds(span_a->context()));
+    auto span_c = tracer->StartSpan("c", {ChildOf(&span_b->context())});
+    CHECK(span_c);
+    span_c->Finish();
+    span_b->Finish();
+    span_a->Finish();
+    auto spans = recorder->spans();
+    CHECK(spans.size() == 2);
+    CHECK(HasRelationship(SpanReferenceType::ChildOfRef, spans.at(0),
+                          spans.at(1)));
+  }
+
+  SECTION("The span filter can be changed at runtime.") {
+    SpanFilter span_filter;
+    span_filter.operation_names = {"a"};
+    tracer->SetSpanFilter(std::move(span_filter));
+    tracer->StartSpan("a")->Finish();
+    CHECK(recorder->size() == 0);
+    tracer->SetSpanFilter(SpanFilter{});
+    tracer->StartSpan("a")->Finish();
+    CHECK(recorder->size() == 1);
+  }
+
+  SECTION("The span filter can be replaced while spans are being started.") {
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.emplace_back([&] {
+        while (!done.load()) {
+          tracer->StartSpan("a")->Finish();
+        }
+      });
+    }
+    for (int i = 0; i < 1000; ++i) {
+      SpanFilter span_filter;
+      span_filter.operation_names = {"a", std::to_string(i)};
+      tracer->SetSpanFilter(std::move(span_filter));
+    }
+    done = true;
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    auto num_spans = recorder->size();
+    tracer->StartSpan("a")->Finish();
+    CHECK(recorder->size() == num_spans);
+  }
+}
+
+TEST_CASE("baggage limits") {
+  auto recorder = new InMemoryRecorder{};
+  PropagationOptions propagation_options;
+  propagation_options.baggage_limits.max_items = 2;
+  propagation_options.baggage_limits.max_key_length = 3;
+  propagation_options.baggage_limits.max_value_length = 4;
+  propagation_options.baggage_limits.max_bytes = 9;
+  auto tracer = std::shared_ptr<opentracing::Tracer>{new LightStepTracerImpl{
+      propagation_options, std::unique_ptr<Recorder>{recorder}}};
+  auto& metrics_observer = recorder->counting_metrics_observer();
+
+  SECTION("Baggage items with an oversized key or value are dropped.") {
+    auto span = tracer->StartSpan("a");
+    CHECK(span);
+    span->SetBaggageItem("abcd", "1");
+    span->SetBaggageItem("a", "12345");
+    span->SetBaggageItem("a", "1234");
+    CHECK(span->BaggageItem("abcd").empty());
+    CHECK(span->BaggageItem("a") == "1234");
+    CHECK(metrics_observer.num_baggage_items_dropped == 2);
+  }
+
+  SECTION("Baggage items past the item or byte limit are dropped.") {
+    auto span = tracer->StartSpan("a");
+    CHECK(span);
+    span->SetBaggageItem("a", "1234");
+    span->SetBaggageItem("b", "1234");
+    CHECK(metrics_observer.num_baggage_items_dropped == 1);
+    span->SetBaggageItem("a", "1");
+    CHECK(metrics_observer.num_baggage_items_dropped == 1);
+    auto other_span = tracer->StartSpan("b");
+    CHECK(other_span);
+    other_span->SetBaggageItem("b", "1");
+    other_span->SetBaggageItem("c", "1");
+    CHECK(metrics_observer.num_baggage_items_dropped == 1);
+    other_span->SetBaggageItem("d", "1");
+    CHECK(metrics_observer.num_baggage_items_dropped == 2);
+  }
+
+  SECTION("Baggage merged from several references is limited.") {
+    auto span_a = tracer->StartSpan("a");
+    CHECK(span_a);
+    span_a->SetBaggageItem("a", "1234");
+    auto span_b = tracer->StartSpan("b");
+    CHECK(span_b);
+    span_b->SetBaggageItem("b", "1234");
+    auto span_c = tracer->StartSpan(
+        "c", {ChildOf(&span_a->context()), ChildOf(&span_b->context())});
+    CHECK(span_c);
+    CHECK(span_c->BaggageItem("a").empty() != span_c->BaggageItem("b").empty());
+    CHECK(metrics_observer.num_baggage_items_dropped == 1);
+  }
+}
+
+TEST_CASE("memory budget") {
+  SECTION("Reservations past the limit fail.") {
+    MemoryBudget memory_budget{100};
+    CHECK(memory_budget.Reserve(MemoryCategory::open_spans, 60));
+    CHECK(!memory_budget.Reserve(MemoryCategory::buffered_spans, 60));
+    memory_budget.Transfer(MemoryCategory::open_spans,
+                           MemoryCategory::buffered_spans, 60);
+    auto usage = memory_budget.usage();
+    CHECK(usage.open_spans == 0);
+    CHECK(usage.buffered_spans == 60);
+    CHECK(usage.num_rejected_reservations == 1);
+    memory_budget.Release(MemoryCategory::buffered_spans, 60);
+    CHECK(memory_budget.Reserve(MemoryCategory::open_spans, 100));
+  }
+
+  SECTION("Buffers are released once a burst has passed.") {
+    BufferRetentionPolicy retention_policy{2};
+    retention_policy.Update(1000);
+    CHECK(!retention_policy.ShouldRelease(1000));
+    for (int i = 0; i < 3; ++i) {
+      retention_policy.Update(1);
+    }
+    CHECK(retention_policy.ShouldRelease(1000));
+    CHECK(!retention_policy.ShouldRelease(
+        BufferRetentionPolicy::min_retained_capacity));
+  }
+
+  SECTION("Open spans drop tags and logs that exceed the limit.") {
+    auto recorder = new InMemoryRecorder{2048};
+    auto tracer = std::shared_ptr<LightStepTracer>{new LightStepTracerImpl{
+        PropagationOptions{}, std::unique_ptr<Recorder>{recorder}}};
+    auto span = tracer->StartSpan("a");
+    CHECK(span);
+    auto open_span_bytes = tracer->GetMemoryUsage().open_spans;
+    CHECK(open_span_bytes > 0);
+    span->SetTag("abc", 123);
+    span->SetTag("large", std::string(4096, 'x'));
+    span->Log({{"large", std::string(4096, 'x')}});
+    CHECK(tracer->GetMemoryUsage().open_spans > open_span_bytes);
+    CHECK(tracer->GetMemoryUsage().num_rejected_reservations == 2);
+    span->Finish();
+    CHECK(tracer->GetMemoryUsage().open_spans == 0);
+    auto span_record = recorder->top();
+    CHECK(span_record.tags_size() == 1);
+    CHECK(span_record.logs_size() == 0);
+  }
+
+  SECTION("Start tags and operation names that exceed the limit are cut.") {
+    auto recorder = new InMemoryRecorder{2048};
+    auto tracer = std::shared_ptr<LightStepTracer>{new LightStepTracerImpl{
+        PropagationOptions{}, std::unique_ptr<Recorder>{recorder}}};
+    auto span = tracer->StartSpan(
+        std::string(4096, 'a'),
+        {SetTag("large", std::string(4096, 'x')), SetTag("abc", 123)});
+    CHECK(span);
+    CHECK(tracer->GetMemoryUsage().num_rejected_reservations == 2);
+    span->SetOperationName(std::string(4096, 'b'));
+    CHECK(tracer->GetMemoryUsage().num_rejected_reservations == 3);
+    CHECK(tracer->GetMemoryUsage().open_spans < 2048);
+    span->Finish();
+    CHECK(tracer->GetMemoryUsage().open_spans == 0);
+    auto span_record = recorder->top();
+    CHECK(span_record.operation_name() == std::string(256, 'b'));
+    CHECK(span_record.tags_size() == 2);
+  }
+}
+
+TEST_CASE("span limits") {
+  SpanLimits span_limits;
+  span_limits.max_tags = 2;
+  span_limits.max_logs = 1;
+  span_limits.max_key_length = 4;
+  span_limits.max_value_length = 5;
+  span_limits.max_json_depth = 1;
+  auto recorder = new InMemoryRecorder{};
+  auto tracer = std::shared_ptr<opentracing::Tracer>{new LightStepTracerImpl{
+      std::make_shared<Logger>(), PropagationOptions{}, span_limits,
+      std::unique_ptr<Recorder>{recorder}}};
+
+  auto lookup_tag = [](const collector::Span& span, const std::string& key) {
+    for (auto& tag : span.tags()) {
+      if (tag.key() == key) {
+        return tag;
+      }
+    }
+    return collector::KeyValue{};
+  };
+
+  SECTION("Tags past the limit are dropped and counted.") {
+    auto span = tracer->StartSpan("a", {SetTag("t1", 1)});
+    span->SetTag("t2", 2);
+    span->SetTag("t3", 3);
+    span->SetTag("t1", 4);
+    span->Finish();
+    auto span_record = recorder->top();
+    CHECK(lookup_tag(span_record, "t1").int_value() == 4);
+    CHECK(lookup_tag(span_record, "t3").key().empty());
+    CHECK(lookup_tag(span_record, "lightstep.dropped_tags").int_value() == 1);
+    CHECK(lookup_tag(span_record, "lightstep.truncated_values").key().empty());
+  }
+
+  SECTION("Long keys and values are truncated.") {
+    auto span = tracer->StartSpan("a");
+    span->SetTag("abcdefg", "1234567");
+    span->SetTag("x", std::string{"1234567"});
+    span->Finish();
+    auto span_record = recorder->top();
+    CHECK(lookup_tag(span_record, "abcd").string_value() == "12345");
+    CHECK(lookup_tag(span_record, "x").string_value() == "12345");
+    CHECK(lookup_tag(span_record, "lightstep.truncated_values").int_value() ==
+          3);
+  }
+
+  SECTION("Deeply nested values are replaced.") {
+    auto span = tracer->StartSpan("a");
+    span->SetTag("x", Values{1, Values{2}});
+    span->Finish();
+    auto span_record = recorder->top();
+    CHECK(lookup_tag(span_record, "x").json_value() == R"([1,"..."])");
+  }
+
+  SECTION("Values past the element limit are dropped and counted.") {
+    span_limits.max_json_depth = 8;
+    span_limits.max_json_elements = 3;
+    tracer = std::shared_ptr<opentracing::Tracer>{new LightStepTracerImpl{
+        std::make_shared<Logger>(), PropagationOptions{}, span_limits,
+        std::unique_ptr<Recorder>{recorder = new InMemoryRecorder{}}}};
+    auto span = tracer->StartSpan("a");
+    span->SetTag("x", Values(1000000, "abc"));
+    span->SetTag("y", Values{1, Values{2, 3}, 4});
+    span->Finish();
+    auto span_record = recorder->top();
+    CHECK(lookup_tag(span_record, "x").json_value() ==
+          R"(["abc","abc","abc"])");
+    CHECK(lookup_tag(span_record, "y").json_value() == R"([1,[2]])");
+    CHECK(lookup_tag(span_record, "lightstep.dropped_values").int_value() ==
+          999997 + 2);
+  }
+
+  SECTION("Dictionary keys that collide once truncated are counted.") {
+    auto span = tracer->StartSpan("a");
+    span->SetTag("x", Dictionary{{"abcd1", 1}, {"abcd2", 2}});
+    span->Finish();
+    auto span_record = recorder->top();
+    CHECK(lookup_tag(span_record, "lightstep.dropped_values").int_value() ==
+          1);
+    CHECK(lookup_tag(span_record, "lightstep.truncated_values").int_value() ==
+          2);
+  }
+
+  SECTION("Logs past the limit are dropped, including those added on finish.") {
+    auto span = tracer->StartSpan("a");
+    span->Log({{"abc", 1}});
+    span->Log({{"abc", 2}});
+    opentracing::FinishSpanOptions options;
+    options.log_records = {{SystemClock::now(), {{"abc", 3}}}};
+    span->FinishWithOptions(options);
+    auto span_record = recorder->top();
+    CHECK(span_record.logs_size() == 1);
+    CHECK(lookup_tag(span_record, "lightstep.dropped_logs").int_value() == 2);
+  }
 }
@@ -28,6 +28,32 @@ int LookupSpansDropped(const collector::ReportRequest& report) {
   return static_cast<int>(iter->int_value());
 }
 
+//------------------------------------------------------------------------------
+// LookupCount
+//------------------------------------------------------------------------------
+int64_t LookupCount(const collector::ReportRequest& report,
+                    opentracing::string_view name) {
+  for (auto& count : report.internal_metrics().counts()) {
+    if (count.name() == name) {
+      return count.int_value();
+    }
+  }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// LookupGauge
+//------------------------------------------------------------------------------
+const collector::MetricsSample* LookupGauge(
+    const collector::ReportRequest& report, opentracing::string_view name) {
+  for (auto& gauge : report.internal_metrics().gauges()) {
+    if (gauge.name() == name) {
+      return &gauge;
+    }
+  }
+  return nullptr;
+}
+
 //------------------------------------------------------------------------------
 // HasTag
 //------------------------------------------------------------------------------
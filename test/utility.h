@@ -6,6 +6,13 @@
 namespace lightstep {
 int LookupSpansDropped(const collector::ReportRequest& report);
 
+int64_t LookupCount(const collector::ReportRequest& report,
+                    opentracing::string_view name);
+
+// Returns the gauge named `name`, or null if the report doesn't have one.
+const collector::MetricsSample* LookupGauge(
+    const collector::ReportRequest& report, opentracing::string_view name);
+
 bool HasTag(const collector::Span& span, opentracing::string_view key,
             const opentracing::Value& value);
 
@@ -1,12 +1,100 @@
 #include "../src/utility.h"
+#include "../src/clock.h"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
 #include <cmath>
 #include <limits>
+#include <set>
+#include <thread>
 
 #define CATCH_CONFIG_MAIN
 #include <lightstep/catch2/catch.hpp>
 using namespace lightstep;
 using namespace opentracing;
 
+TEST_CASE("GenerateId") {
+  SECTION("Ids don't repeat.") {
+    std::set<uint64_t> ids;
+    for (int i = 0; i < 1000; ++i) {
+      ids.insert(GenerateId());
+    }
+    uint64_t batch[100];
+    GenerateIds(batch, 100);
+    ids.insert(std::begin(batch), std::end(batch));
+    CHECK(ids.size() == 1100);
+  }
+
+  SECTION("Threads generate different ids.") {
+    uint64_t id1 = 0;
+    uint64_t id2 = 0;
+    std::thread thread1{[&] { id1 = GenerateId(); }};
+    std::thread thread2{[&] { id2 = GenerateId(); }};
+    thread1.join();
+    thread2.join();
+    CHECK(id1 != id2);
+  }
+
+  SECTION("A forked child doesn't repeat the parent's ids.") {
+    GenerateId();
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+    auto pid = ::fork();
+    REQUIRE(pid != -1);
+    if (pid == 0) {
+      auto id = GenerateId();
+      auto num_written = ::write(fds[1], &id, sizeof(id));
+      ::_exit(num_written == sizeof(id) ? 0 : 1);
+    }
+    auto parent_id = GenerateId();
+    uint64_t child_id = 0;
+    CHECK(::read(fds[0], &child_id, sizeof(child_id)) == sizeof(child_id));
+    int status;
+    ::waitpid(pid, &status, 0);
+    ::close(fds[0]);
+    ::close(fds[1]);
+    CHECK(child_id != parent_id);
+  }
+}
+
+TEST_CASE("ToSystemTime") {
+  SECTION("Steady times convert to about the current system time.") {
+    auto system_time = ToSystemTime(std::chrono::steady_clock::now());
+    auto difference = std::chrono::system_clock::now() - system_time;
+    CHECK(std::abs(std::chrono::duration_cast<std::chrono::milliseconds>(
+                       difference)
+                       .count()) < 100);
+  }
+
+  SECTION("Durations between steady times are preserved.") {
+    auto steady_time = std::chrono::steady_clock::now();
+    CalibrateClockOffset();
+    auto system_time1 = ToSystemTime(steady_time);
+    auto system_time2 =
+        ToSystemTime(steady_time + std::chrono::milliseconds{5});
+    CHECK(system_time2 - system_time1 == std::chrono::milliseconds{5});
+  }
+
+  SECTION("Conversions are consistent while the offset is recalibrated.") {
+    std::atomic<bool> is_done{false};
+    std::thread calibrator{[&] {
+      while (!is_done) {
+        CalibrateClockOffset();
+      }
+    }};
+    auto steady_time = std::chrono::steady_clock::now();
+    auto system_time = std::chrono::system_clock::now();
+    for (int i = 0; i < 10000; ++i) {
+      auto difference = ToSystemTime(steady_time) - system_time;
+      CHECK(std::abs(std::chrono::duration_cast<std::chrono::milliseconds>(
+                         difference)
+                         .count()) < 100);
+    }
+    is_done = true;
+    calibrator.join();
+  }
+}
+
 TEST_CASE("Json") {
   SECTION("Arrays jsonify correctly.") {
     auto key_value1 = ToKeyValue("", Values{1});